@@ -4,6 +4,8 @@
 #include "util/timer.hpp"
 #include "util/system.hpp"
 #include "util/buffer.hpp"
+#include "util/wildcard_table.hpp"
+#include "util/dispatch.hpp"
 #include "freeflow/capture.hpp"
 
 #include <cstring>
@@ -16,17 +18,17 @@ main(int argc, char* argv[])
 {
   // Read the file containing filter instructions.
   if (argc < 2)
-    throw std::runtime_error("Usage: driver <steve-program> <pcap-file> <output-file> [ <iterations> ]");
+    throw std::runtime_error("Usage: driver <steve-program> <pcap-file> <output-file> [ <iterations> [ tss | tree [ <workers> [ cache ] ] ] ]");
   char* steve_file = argv[1];
 
   // Load the given pcap file.
   if (argc < 3)
-    throw std::runtime_error("Usage: driver <steve-program> <pcap-file> <output-file> [ <iterations> ]");
+    throw std::runtime_error("Usage: driver <steve-program> <pcap-file> <output-file> [ <iterations> [ tss | tree [ <workers> [ cache ] ] ] ]");
   char* pcap_file = argv[2];
 
   // Get the dump output file.
   if (argc < 4)
-    throw std::runtime_error("Usage: driver <steve-program> <pcap-file> <output-file> [ <iterations> ]");
+    throw std::runtime_error("Usage: driver <steve-program> <pcap-file> <output-file> [ <iterations> [ tss | tree [ <workers> [ cache ] ] ] ]");
   char* dump_file = argv[3];
 
   // Check for number of copies/iterations. Default 1.
@@ -37,6 +39,35 @@ main(int argc, char* argv[])
 
   // Dataplane stuff.
   Dataplane dp("dp1", steve_file);
+
+  // Choose the wildcard table algorithm. Default tuple space search.
+  if (argc > 5) {
+    if (!std::strcmp(argv[5], "tree"))
+      dp.wildcard_algorithm_ = Table::DECISION_TREE;
+    else if (!std::strcmp(argv[5], "tss"))
+      dp.wildcard_algorithm_ = Table::TUPLE_SPACE;
+    else
+      throw std::runtime_error("Unknown wildcard algorithm");
+  }
+
+  // Choose the number of workers. Tables are sharded among them, and
+  // each packet is steered to a worker by its flow. Packets are still
+  // processed here, one at a time, by whichever worker they are
+  // steered to.
+  int workers = 1;
+  if (argc > 6)
+    workers = std::stoi(argv[6]);
+  if (workers < 1)
+    throw std::runtime_error("Invalid number of workers");
+  dp.workers_ = workers;
+
+  // Enable the flow cache, which replays the outcome of the first
+  // packet of a flow for the packets that follow.
+  if (argc > 7) {
+    if (std::strcmp(argv[7], "cache"))
+      throw std::runtime_error("Unknown option");
+    dp.enable_cache();
+  }
   Pool& pool = Buffer_pool::get_pool(&dp);
   dp.set_pool(&pool);
 
@@ -64,11 +95,14 @@ main(int argc, char* argv[])
 
   Timer t;
 
+  // The context is reused for every packet, and reset before each.
+  Byte buf[2048];
+  Context cxt(&dp, buf);
   while (true) {
-    Byte buf[2048];
-    Context cxt(&dp, buf);
+    cxt.reset(buf);
     try {
       if (in.recv(cxt)) {
+        set_worker(dispatch(cxt.packet(), workers));
         dp.process(cxt);
         cxt.apply_actions();
 
@@ -111,4 +145,27 @@ main(int argc, char* argv[])
   // }
 
   std::cout << "Pps: " << pktno / t.elapsed() << '\n';
+
+  // Report the hit rate of the flow cache.
+  if (dp.cache()) {
+    Flow_cache_stats s = dp.cache_stats();
+    std::cout << "Flow cache: " << s.hits << " hits of " << s.lookups
+              << " lookups (" << s.hit_rate() * 100 << "%), "
+              << s.invalidations << " invalidated, "
+              << s.uncacheable << " uncacheable\n";
+  }
+
+  // Report the classification cost of wildcard tables.
+  for (Table* tbl : dp.tables()) {
+    if (Classifier* w = dynamic_cast<Classifier*>(tbl))
+      std::cout << "Table " << w->id() << ": "
+                << w->stats().probes_per_lookup() << " probes/lookup\n";
+  }
+
+  // Report the memory used by each table.
+  for (Table* tbl : dp.tables()) {
+    Table_memory m = fp_get_table_memory(tbl);
+    std::cout << "Table " << tbl->id() << ": " << m.flows << " flows, "
+              << m.bytes << " bytes (" << m.bytes_per_flow() << " bytes/flow)\n";
+  }
 }
@@ -7,4 +7,7 @@
 namespace fp
 {
 
+constexpr int Set_action::inline_size;
+constexpr int Action_set::capacity;
+
 } // namespace fp
@@ -6,6 +6,10 @@
 
 #include "types.hpp"
 
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 
@@ -46,31 +50,70 @@ struct Field
 // Copies a value into the given field. Note that
 // value + field.length must be within the range
 // of memory designated by field.address.
+//
+// Values of up to inline_size bytes (e.g., addresses and ports)
+// are stored in the action itself, so that creating and copying
+// the action does not allocate.
 struct Set_action
 {
+  static constexpr int inline_size = 16;
+
   Set_action()
-    : field {0, 0, 0}, value(nullptr)
+    : field {0, 0, 0}
   { }
 
-  Set_action(std::uint8_t addr, std::uint16_t off, std::uint16_t len, Byte* v)
-    : field{addr, off, len}, value(new Byte[len])
+  Set_action(std::uint8_t addr, std::uint16_t off, std::uint16_t len, Byte const* v)
+    : field{addr, off, len}
   {
-    std::copy(v, v + len, value);
+    init(v);
   }
 
   Set_action(Set_action const& s)
-    : field(s.field), value(new Byte[s.field.length])
+    : field(s.field)
+  {
+    init(s.value());
+  }
+
+  Set_action& operator=(Set_action const& s)
+  {
+    if (this != &s) {
+      release();
+      field = s.field;
+      init(s.value());
+    }
+    return *this;
+  }
+
+  ~Set_action()
+  {
+    release();
+  }
+
+  bool is_inline() const { return field.length <= inline_size; }
+
+  // Returns the value to copy into the field.
+  Byte const* value() const { return is_inline() ? data.bytes : data.ptr; }
+
+  Field field;
+
+private:
+  void init(Byte const* v)
   {
-    std::copy(s.value, s.value + s.field.length, value);
+    Byte* p = is_inline() ? data.bytes : (data.ptr = new Byte[field.length]);
+    std::copy(v, v + field.length, p);
   }
 
-  ~Set_action() {
-    if (value)
-      delete [] value;
+  void release()
+  {
+    if (!is_inline())
+      delete [] data.ptr;
   }
 
-  Field       field;
-  Byte*       value;
+  union
+  {
+    Byte  bytes[inline_size];
+    Byte* ptr;
+  } data;
 };
 
 
@@ -121,7 +164,7 @@ struct Action
     SET, COPY, OUTPUT, QUEUE, GROUP, ACTION
   };
 
-  Action() { }
+  Action() : type(ACTION) { }
   Action(Set_action const& s) : value(s), type(SET) { }
   Action(Copy_action const& c) : value(c), type(COPY) { }
   Action(Output_action const& o) : value(o), type(OUTPUT) { }
@@ -129,6 +172,8 @@ struct Action
   Action(Group_action const& g) : value(g), type(GROUP) { }
   Action(Action const&);
 
+  Action& operator=(Action const&);
+
   ~Action()
   {
     clear();
@@ -156,41 +201,66 @@ struct Action
 
   Action_data value;
   std::uint8_t type;
+
+private:
+  void assign(Action const&);
 };
 
 
+// Destroys the value of the action, which no longer holds one.
 inline void
 Action::clear()
 {
   if (type == SET)
     value.set.~Set_action();
+  type = ACTION;
 }
 
-inline
-Action::Action(Action const& a)
+
+// Copies the value of a, which the action does not hold yet.
+inline void
+Action::assign(Action const& a)
 {
   type = a.type;
   switch (a.type)
   {
     case SET:
-      value = Action_data(a.value.set);
+      ::new (&value.set) Set_action(a.value.set);
       break;
     case COPY:
-      value = Action_data(a.value.copy);
+      value.copy = a.value.copy;
       break;
     case OUTPUT:
-      value = Action_data(a.value.output);
+      value.output = a.value.output;
       break;
     case QUEUE:
-      value = Action_data(a.value.queue);
+      value.queue = a.value.queue;
       break;
     case GROUP:
-      value = Action_data(a.value.group);
+      value.group = a.value.group;
       break;
   }
 }
 
 
+inline
+Action::Action(Action const& a)
+{
+  assign(a);
+}
+
+
+inline Action&
+Action::operator=(Action const& a)
+{
+  if (this != &a) {
+    clear();
+    assign(a);
+  }
+  return *this;
+}
+
+
 // A list of actions.
 using Action_list = std::vector<Action>;
 
@@ -198,14 +268,94 @@ using Action_list = std::vector<Action>;
 // The action set maintains a sequence of instructions
 // to be executed on a packet (context) prior to egress.
 //
+// Actions are stored in the set itself, up to its capacity, so
+// that writing actions for a packet never allocates. Writing more
+// actions than that throws an exception.
+//
 // FIXME: This is a highly structured list of actions,
 // and the order in which those actions are applied matters.
-struct Action_set : Action_list
+struct Action_set
 {
+  static constexpr int capacity = 16;
 
+  Action_set()
+    : size_(0)
+  { }
+
+  Action_set(Action_set const&);
+  Action_set& operator=(Action_set const&);
+
+  ~Action_set()
+  {
+    clear();
+  }
+
+  void push_back(Action const&);
+  void clear();
+
+  Action const* begin() const { return data(); }
+  Action const* end() const   { return data() + size_; }
+
+  Action const& operator[](int n) const { return data()[n]; }
+  Action&       operator[](int n)       { return data()[n]; }
+
+  int  size() const  { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  Action const* data() const { return reinterpret_cast<Action const*>(slots_); }
+  Action*       data()       { return reinterpret_cast<Action*>(slots_); }
+
+  using Slot = typename std::aligned_storage<sizeof(Action), alignof(Action)>::type;
+
+  Slot slots_[capacity];
+  int  size_;
 };
 
 
+inline
+Action_set::Action_set(Action_set const& s)
+  : size_(0)
+{
+  for (Action const& a : s)
+    push_back(a);
+}
+
+
+inline Action_set&
+Action_set::operator=(Action_set const& s)
+{
+  if (this != &s) {
+    clear();
+    for (Action const& a : s)
+      push_back(a);
+  }
+  return *this;
+}
+
+
+// Appends a copy of the action. Throws an exception if the set is
+// full.
+inline void
+Action_set::push_back(Action const& a)
+{
+  if (size_ == capacity)
+    throw std::runtime_error("action set is full");
+  ::new (&slots_[size_]) Action(a);
+  ++size_;
+}
+
+
+// Removes every action.
+inline void
+Action_set::clear()
+{
+  for (int i = 0; i < size_; ++i)
+    data()[i].~Action();
+  size_ = 0;
+}
+
+
 } // namespace fp
 
 
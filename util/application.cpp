@@ -76,6 +76,11 @@ Library::Library(char const* p)
   port_changed = (Port_fn)lib_resolve(handle, "port_changed");
 
   proc = (Proc_fn)lib_require(handle, "process");
+
+  if (Layout_fn f = (Layout_fn)lib_resolve(handle, "binding_layout"))
+    f(&layout);
+  if (!fits(layout.headers, layout.depth) || !fits(layout.fields, layout.depth))
+    throw std::runtime_error("binding layout exceeds the capacity of a context");
 }
 
 
@@ -190,4 +195,17 @@ Application::process(Context& cxt)
 }
 
 
+// Returns the symbol with the given name in the library with the
+// given handle or, failing that, in the runtime and the other
+// globally loaded libraries. Returns nullptr if there is no such
+// symbol. This is used to find flow instructions by name.
+void*
+resolve_symbol(void* lib, char const* name)
+{
+  if (void* sym = lib_resolve(lib, name))
+    return sym;
+  return lib_resolve(RTLD_DEFAULT, name);
+}
+
+
 } // end namespace fp
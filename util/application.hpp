@@ -2,6 +2,7 @@
 #define FP_APPLICATION_HPP
 
 #include "port.hpp"
+#include "binding.hpp"
 
 namespace fp
 {
@@ -16,6 +17,7 @@ struct Library
   using Init_fn = int (*)(Dataplane*);
   using Port_fn = int (*)(unsigned int);
   using Proc_fn = int (*)(Context*);
+  using Layout_fn = void (*)(Binding_layout*);
 
   Library(char const*);
   ~Library();
@@ -33,9 +35,16 @@ struct Library
   Port_fn port_changed;
 
   Proc_fn proc;
+
+  // The binding slots declared by the application, if it has a
+  // binding_layout function.
+  Binding_layout layout;
 };
 
 
+void* resolve_symbol(void*, char const*);
+
+
 // An application is a user-defined program that executes
 // on a dataplane.
 class Application
@@ -7,14 +7,13 @@
 #include "types.hpp"
 
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 
 
 namespace fp
 {
 
-#define MAX_BINDINGS 4
-
-
 // Represents a field binding within the packet. Each field
 // is described by an offset/length pair. The absolute
 // address of the field is relative to some address within
@@ -43,141 +42,153 @@ struct Binding
 };
 
 
-// A binding list stores the innermost field binding
-// for a particular field name. We allow multiple bindings
-// of the same field to accommodate the decoding of packets
-// with nested structures. Currently, we limit the total
-// number of bindings to 4.
-//
-// FIXME: Support arbitrarily deep or shallow binding lists.
-struct Binding_list
+// The binding slots needed by an application: the number of header
+// and field ids it uses, and the number of nested bindings of any
+// one id (e.g., 2 for the VLAN tags of a Q-in-Q packet, or for the
+// inner and outer headers of a tunnel). An application may declare
+// its layout when it is loaded (see Library); this is the default.
+struct Binding_layout
 {
-  constexpr static int max_length = 4;
+  int headers = 32;
+  int fields = 32;
+  int depth = 4;
+};
 
-  Binding_list()
-    : current(-1)
+
+// A binding environment associates protocol field names
+// with the their location and length within a region
+// of memory.
+//
+// Each protocol field is assigned, by the programmer, a
+// unique integer value in the range [0, n] where n is
+// the number of fields needed by the application. Those
+// values must be "remembered" by the programmer.
+//
+// Each id has a stack of up to depth bindings, so that nested
+// structures can rebind it; the innermost binding is on top. The
+// environment is laid out for the ids and depth it is configured
+// with: one byte per id holding its number of bindings, followed by
+// the bindings of each id in turn. An application with few fields
+// only touches the first cache lines of the environment.
+//
+// FIXME: What's the right query mechanism here?
+struct Environment
+{
+  // The largest number of ids, of bindings of an id, and of
+  // bindings in total.
+  static constexpr int max_ids = 64;
+  static constexpr int max_depth = 16;
+  static constexpr int max_bindings = 256;
+
+  Environment()
+    : Environment(Binding_layout().fields, Binding_layout().depth)
   { }
 
-  bool is_empty() const { return current == -1; }
-  bool is_full() const  { return current == max_length - 1; }
+  Environment(int, int);
 
-  Binding const& top() const;
-  Binding&       top();
-  Binding const& bottom() const;
-  Binding&       bottom();
+  bool is_empty(int n) const { return count[n] == 0; }
+  bool is_full(int n) const  { return count[n] == depth; }
 
-  void push(Binding);
-  void push(std::uint16_t);
-  void pop();
+  Binding const& top(int n) const;
+  Binding&       top(int n);
+  Binding const& bottom(int n) const;
+  Binding&       bottom(int n);
 
-  Binding bindings[max_length];
-  int     current;
+  void push(int n, Binding b);
+  void pop(int n);
+  void clear();
+
+  int          ids;   // The number of ids
+  int          depth; // The number of bindings for each id
+  std::uint8_t count[max_ids];
+  Binding      bindings[max_bindings];
 };
 
 
-// Returns the innermost binding in the list.
-inline Binding const&
-Binding_list::top() const
+// Returns true if an environment can hold n ids with up to d
+// bindings each.
+inline bool
+fits(int n, int d)
 {
-  assert(!is_empty());
-  return bindings[current];
+  return 0 < n && n <= Environment::max_ids
+      && 0 < d && d <= Environment::max_depth
+      && n * d <= Environment::max_bindings;
 }
 
 
-inline Binding&
-Binding_list::top()
+// Initialize an environment for n ids with up to d bindings each.
+// The layout must fit (see above).
+inline
+Environment::Environment(int n, int d)
+  : ids(n), depth(d)
 {
-  assert(!is_empty());
-  return bindings[current];
+  assert(fits(n, d));
+  clear();
 }
 
 
-// Returns the outermost binding in the list.
+// Returns the innermost binding of the id n.
 inline Binding const&
-Binding_list::bottom() const
+Environment::top(int n) const
 {
-  assert(!is_empty());
-  return bindings[0];
+  assert(0 <= n && n < ids && !is_empty(n));
+  return bindings[n * depth + count[n] - 1];
 }
 
 
 inline Binding&
-Binding_list::bottom()
+Environment::top(int n)
 {
-  assert(!is_empty());
-  return bindings[0];
+  assert(0 <= n && n < ids && !is_empty(n));
+  return bindings[n * depth + count[n] - 1];
 }
 
 
-// Push a new field binding onto the binding list. Behavior
-// is undefined if the pushing the entry would exceed the
-// maximum length of the binding list.
-inline void
-Binding_list::push(Binding b)
+// Returns the outermost binding of the id n.
+inline Binding const&
+Environment::bottom(int n) const
 {
-  assert(!is_full());
-  bindings[++current] = b;
+  assert(0 <= n && n < ids && !is_empty(n));
+  return bindings[n * depth];
 }
 
 
-// Push a partial binding into the binding list.
-inline void
-Binding_list::push(std::uint16_t n)
+inline Binding&
+Environment::bottom(int n)
 {
-  assert(!is_full());
-  bindings[++current] = Binding(n);
+  assert(0 <= n && n < ids && !is_empty(n));
+  return bindings[n * depth];
 }
 
 
-// Pop the innermost binding from the binding list.
-// Behavior is undefined if the list.
+// Push a new binding for the id n. Behavior is undefined if that
+// would exceed the depth of the environment.
 inline void
-Binding_list::pop()
+Environment::push(int n, Binding b)
 {
-  assert(!is_empty());
-  --current;
+  assert(0 <= n && n < ids && !is_full(n));
+  bindings[n * depth + count[n]++] = b;
 }
 
 
-// A binding environment associates protocol field names
-// with the their location and length within a region
-// of memory.
-//
-// Each protocol field is assigned, by the programmer, a
-// unique integer value in the range [0, n] where n is
-// the number of fields needed by the application. Those
-// values must be "remembered" by the programmer.
-//
-// FIXME: Make the number of fields configurable.
-//
-// FIXME: What's the right query mechanism here?
-struct Environment
-{
-  static constexpr int max_fields = 32;
-
-  Binding_list const& operator[](int n) const { return fields[n]; }
-  Binding_list&       operator[](int n)       { return fields[n]; }
-
-  void push(int n, Binding b);
-  void pop(int n);
-
-  Binding_list fields[max_fields];
-};
-
-
+// Pop the innermost binding of the id n. Behavior is undefined if
+// the id is not bound.
 inline void
-Environment::push(int n, Binding b)
+Environment::pop(int n)
 {
-  assert(0 <= n && n < max_fields);
-  fields[n].push(b);
+  assert(0 <= n && n < ids && !is_empty(n));
+  --count[n];
 }
 
 
+// Removes every binding. Counts are packed one byte per id, so
+// this clears a few words at most, and bindings are not touched.
 inline void
-Environment::pop(int n)
+Environment::clear()
 {
-  assert(0 <= n && n < max_fields);
-  fields[n].pop();
+  static_assert(max_ids % 8 == 0, "counts are cleared a word at a time");
+  for (int i = 0; i < ids; i += 8)
+    std::memset(count + i, 0, 8);
 }
 
 
@@ -0,0 +1,122 @@
+#ifndef FP_BLOOM_FILTER_HPP
+#define FP_BLOOM_FILTER_HPP
+
+#include "types.hpp"
+#include "memory.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+
+namespace fp
+{
+
+// A blocked Bloom filter over hash values.
+//
+// The filter is an array of 512-bit blocks, each occupying one
+// cache line. A hash value selects a block with its high half, and
+// sets (or tests) one bit in each of the block's 8 words using its
+// low half, so a query touches exactly one line. The filter never
+// misses a value that was inserted. For other values, it reports a
+// false positive with a probability that depends on the number of
+// bits per value: about 3% when the filter is full, at 8 bits per
+// value, and under 0.1% when it is half full.
+//
+// Values cannot be removed. Owners that remove keys should rebuild
+// the filter once enough of them have accumulated.
+class Bloom_filter
+{
+public:
+  static constexpr int words = 8;
+  static constexpr int bits_per_value = 8;
+
+  explicit Bloom_filter(std::size_t);
+  ~Bloom_filter();
+
+  Bloom_filter(Bloom_filter const&) = delete;
+  Bloom_filter& operator=(Bloom_filter const&) = delete;
+
+  void insert(std::uint64_t);
+  bool contains(std::uint64_t) const;
+
+  // Returns the number of values the filter was sized for.
+  std::size_t capacity() const { return capacity_; }
+
+  // Returns the number of values inserted.
+  std::size_t size() const { return size_; }
+
+  // Returns the number of bytes used by the filter.
+  std::size_t bytes() const { return (mask_ + 1) * sizeof(Block); }
+
+private:
+  struct Block
+  {
+    std::uint64_t w[words];
+  };
+
+  // Returns the bit of word i set for the value h.
+  static std::uint64_t bit(std::uint64_t h, int i)
+  {
+    static constexpr std::uint32_t salt[words] = {
+      0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+      0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31
+    };
+    return std::uint64_t(1) << ((std::uint32_t(h) * salt[i]) >> 26);
+  }
+
+  Block const& block(std::uint64_t h) const { return blocks_[(h >> 32) & mask_]; }
+  Block&       block(std::uint64_t h)       { return blocks_[(h >> 32) & mask_]; }
+
+  Block*      blocks_;
+  std::size_t mask_;     // Number of blocks - 1
+  std::size_t capacity_;
+  std::size_t size_;
+};
+
+
+// Creates a filter sized for n values.
+inline
+Bloom_filter::Bloom_filter(std::size_t n)
+  : capacity_(n < 64 ? 64 : n), size_(0)
+{
+  std::size_t nblocks = next_power_of_two(capacity_ * bits_per_value / (8 * sizeof(Block)));
+  blocks_ = static_cast<Block*>(allocate_aligned(nblocks * sizeof(Block)));
+  std::memset(blocks_, 0, nblocks * sizeof(Block));
+  mask_ = nblocks - 1;
+}
+
+
+inline
+Bloom_filter::~Bloom_filter()
+{
+  deallocate_aligned(blocks_);
+}
+
+
+// Adds the hash value h to the filter.
+inline void
+Bloom_filter::insert(std::uint64_t h)
+{
+  Block& b = block(h);
+  for (int i = 0; i < words; ++i)
+    b.w[i] |= bit(h, i);
+  ++size_;
+}
+
+
+// Returns false if the hash value h was never inserted.
+inline bool
+Bloom_filter::contains(std::uint64_t h) const
+{
+  Block const& b = block(h);
+  std::uint64_t miss = 0;
+  for (int i = 0; i < words; ++i)
+    miss |= ~b.w[i] & bit(h, i);
+  return !miss;
+}
+
+
+} // namespace fp
+
+
+#endif
@@ -17,8 +17,8 @@ class Dataplane;
 
 // The flowpath packet buffer. Contains an ID, a packet data
 // store, and the context associated with the packet. There is
-// no dynamic allocation of packet contexts, and the user is
-// expected to initialize the context when it is allocated.
+// no dynamic allocation of packet contexts: the context is reset
+// when its buffer is allocated.
 // After a buffer has been freed, accessing the contents of
 // any field in this structure results in undefined behavior.
 struct Buffer
@@ -105,8 +105,11 @@ Pool::alloc()
   // Unlock the heap.
   mutex_.unlock();
 
-  // Return a reference to the buffer at the index.
-  return data_[id];
+  // Return a reference to the buffer at the index, with its context
+  // ready for a new packet.
+  Buffer& buf = data_[id];
+  buf.context().reset({buf.data_, 2048});
+  return buf;
 }
 
 
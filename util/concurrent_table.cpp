@@ -0,0 +1,246 @@
+#include "concurrent_table.hpp"
+
+#include <new>
+
+
+namespace fp
+{
+
+Concurrent_table::Concurrent_table(int id, int size, int k)
+  : Table(Table::EXACT, id, k), hash_(k), array_(nullptr), size_(0), used_(0)
+{
+  std::size_t n = next_power_of_two(size + size / 3 + 1);
+  array_.store(make_array(n < 16 ? 16 : n));
+}
+
+
+// Releases the nodes and the array. No lookups may be running.
+Concurrent_table::~Concurrent_table()
+{
+  Array* a = array_.load();
+  for (std::size_t i = 0; i <= a->mask; ++i) {
+    std::uint64_t s = a->slots[i].load(std::memory_order_relaxed);
+    if (s != empty_slot && s != deleted_slot)
+      free_node(node(s));
+  }
+  free_array(a);
+}
+
+
+// Returns a new node holding the key k, its hash h, and a copy of
+// the flow f.
+Concurrent_table::Node*
+Concurrent_table::make_node(Key const& k, std::uint64_t h, Flow const& f) const
+{
+  void* p = ::operator new(sizeof(Node) + key_size_ - 1);
+  Node* n = static_cast<Node*>(p);
+  ::new (&n->flow) Flow(f);
+  n->hash = h;
+  std::memcpy(n->key, k.data, key_size_);
+  return n;
+}
+
+
+void
+Concurrent_table::free_node(void* p)
+{
+  static_cast<Node*>(p)->flow.~Flow();
+  ::operator delete(p);
+}
+
+
+// Returns a new array of n empty slots, where n is a power of two.
+Concurrent_table::Array*
+Concurrent_table::make_array(std::size_t n) const
+{
+  void* p = allocate_aligned(sizeof(Array) + (n - 1) * sizeof(std::uint64_t));
+  Array* a = static_cast<Array*>(p);
+  a->mask = n - 1;
+  for (std::size_t i = 0; i < n; ++i)
+    ::new (&a->slots[i]) std::atomic<std::uint64_t>(empty_slot);
+  return a;
+}
+
+
+void
+Concurrent_table::free_array(void* p)
+{
+  deallocate_aligned(p);
+}
+
+
+// Publishes a new array of n slots holding the live nodes, and
+// retires the current one. The caller must hold the lock.
+void
+Concurrent_table::rebuild(std::size_t n)
+{
+  Array* old = array_.load(std::memory_order_relaxed);
+  Array* a = make_array(n);
+  for (std::size_t i = 0; i <= old->mask; ++i) {
+    std::uint64_t s = old->slots[i].load(std::memory_order_relaxed);
+    if (s == empty_slot || s == deleted_slot)
+      continue;
+    std::size_t j = node(s)->hash & a->mask;
+    while (a->slots[j].load(std::memory_order_relaxed) != empty_slot)
+      j = (j + 1) & a->mask;
+    a->slots[j].store(s, std::memory_order_relaxed);
+  }
+  used_ = size_.load(std::memory_order_relaxed);
+  array_.store(a, std::memory_order_release);
+  rcu_retire(old, free_array, sizeof(Array) + old->mask * sizeof(std::uint64_t));
+}
+
+
+// Looks up n keys, storing the matching flows in out. A lookup
+// usually misses the cache twice: once for its slot and once for
+// the node the slot points to. Each group of keys is resolved in
+// three passes, prefetching all of the slots, then all of the
+// nodes, and finally comparing keys, so that the misses of the
+// group overlap.
+void
+Concurrent_table::search_burst(Key const* keys, Flow** out, int n)
+{
+  std::uint64_t h[burst_size];
+  Array const* a = array_.load(std::memory_order_acquire);
+  for (int i = 0; i < n; i += burst_size) {
+    int m = std::min(n - i, burst_size);
+    for (int j = 0; j < m; ++j) {
+      h[j] = hash_(keys[i + j]);
+      __builtin_prefetch(&a->slots[h[j] & a->mask]);
+    }
+    for (int j = 0; j < m; ++j) {
+      std::uint64_t s = a->slots[h[j] & a->mask].load(std::memory_order_acquire);
+      if (s != empty_slot && s != deleted_slot)
+        __builtin_prefetch(node(s)->key);
+    }
+    for (int j = 0; j < m; ++j)
+      out[i + j] = find(a, h[j], keys[i + j]);
+  }
+}
+
+
+// Adds the flow f for the key k, replacing any flow for that key.
+void
+Concurrent_table::add(Key const& k, Flow const& f)
+{
+  std::uint64_t h = hash_(k);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Array* a = array_.load(std::memory_order_relaxed);
+
+  // Look for the key, remembering the first deleted slot.
+  std::size_t i = h & a->mask;
+  std::size_t free = -1;
+  std::uint64_t s;
+  for (; (s = a->slots[i].load(std::memory_order_relaxed)) != empty_slot;
+         i = (i + 1) & a->mask) {
+    if (s == deleted_slot) {
+      if (free == std::size_t(-1))
+        free = i;
+    }
+    else if (matches(s, h, k)) {
+      Node* n = make_node(k, h, f);
+      a->slots[i].store((tag(h) << 48) | reinterpret_cast<std::uint64_t>(n),
+                        std::memory_order_release);
+      rcu_retire(node(s), free_node);
+      ++version_;
+      return;
+    }
+  }
+
+  // Claiming an empty slot must leave a quarter of the slots
+  // empty. Otherwise, grow the table, or purge deleted slots if
+  // most of the used slots hold them.
+  if (free == std::size_t(-1)) {
+    std::size_t cap = a->mask + 1;
+    if (4 * (used_ + 1) > 3 * cap) {
+      std::size_t live = size_.load(std::memory_order_relaxed) + 1;
+      rebuild(4 * live > cap ? 2 * cap : cap);
+      a = array_.load(std::memory_order_relaxed);
+      i = h & a->mask;
+      while (a->slots[i].load(std::memory_order_relaxed) != empty_slot)
+        i = (i + 1) & a->mask;
+    }
+    free = i;
+    ++used_;
+  }
+
+  Node* n = make_node(k, h, f);
+  a->slots[free].store((tag(h) << 48) | reinterpret_cast<std::uint64_t>(n),
+                       std::memory_order_release);
+  size_.fetch_add(1, std::memory_order_relaxed);
+  ++version_;
+}
+
+
+// Removes the flow for the key k, if any.
+void
+Concurrent_table::rmv(Key const& k)
+{
+  std::uint64_t h = hash_(k);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Array* a = array_.load(std::memory_order_relaxed);
+  std::uint64_t s;
+  for (std::size_t i = h & a->mask;
+       (s = a->slots[i].load(std::memory_order_relaxed)) != empty_slot;
+       i = (i + 1) & a->mask) {
+    if (matches(s, h, k)) {
+      a->slots[i].store(deleted_slot, std::memory_order_release);
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      rcu_retire(node(s), free_node);
+      ++version_;
+      return;
+    }
+  }
+}
+
+
+// Resets the miss case to default.
+void
+Concurrent_table::rmv_miss()
+{
+  miss_ = Flow();
+  ++version_;
+}
+
+
+// Appends a record for each flow. Every bit of the key is
+// matched.
+void
+Concurrent_table::dump(std::vector<Flow_record>& v) const
+{
+  Byte ones[fp::key_size];
+  std::fill(ones, ones + key_size_, 0xff);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Array const* a = array_.load(std::memory_order_relaxed);
+  for (std::size_t i = 0; i <= a->mask; ++i) {
+    std::uint64_t s = a->slots[i].load(std::memory_order_relaxed);
+    if (s == empty_slot || s == deleted_slot)
+      continue;
+    Node const* n = node(s);
+    v.push_back({Key(n->key, key_size_), Key(ones, key_size_), n->flow.pri_,
+                 n->flow.cookie_, n->flow.count_.read()});
+  }
+}
+
+
+// Returns the memory used by the current array and the nodes it
+// points to. Arrays and nodes awaiting reclamation are not counted.
+Table_memory
+Concurrent_table::memory() const
+{
+  Table_memory m = Table::memory();
+  std::lock_guard<std::mutex> lock(mutex_);
+  Array const* a = array_.load(std::memory_order_relaxed);
+  m.bytes += sizeof(Array) + a->mask * sizeof(std::uint64_t);
+  for (std::size_t i = 0; i <= a->mask; ++i) {
+    std::uint64_t s = a->slots[i].load(std::memory_order_relaxed);
+    if (s == empty_slot || s == deleted_slot)
+      continue;
+    ++m.flows;
+    m.bytes += sizeof(Node) + key_size_ - 1 + node(s)->flow.count_.bytes();
+  }
+  return m;
+}
+
+
+} // namespace fp
@@ -0,0 +1,142 @@
+#ifndef FP_CONCURRENT_TABLE_HPP
+#define FP_CONCURRENT_TABLE_HPP
+
+#include "table.hpp"
+#include "rcu.hpp"
+
+#include <atomic>
+#include <mutex>
+
+
+namespace fp
+{
+
+// An exact match table that supports lookups from many threads
+// while flows are added and removed.
+//
+// Lookups take no locks and never wait: they probe an open
+// addressing table whose slots are single atomic words, so the
+// cost of a lookup is bounded by the length of its probe sequence.
+// Each slot holds a pointer to a node with the key and flow,
+// packed with 16 bits of the key's hash so that most mismatches
+// are rejected without touching the node.
+//
+// Updates follow RCU: writers serialize on a lock, and publish
+// changes with atomic stores that readers observe either entirely
+// or not at all. A flow is inserted by filling an empty (or
+// deleted) slot with a new node, replaced by swapping in a new
+// node, and removed by marking its slot deleted. Empty slots are
+// never reused in place, so a concurrent probe always terminates.
+// When the table fills, a writer builds a larger table from the
+// live nodes and publishes it with a single store.
+//
+// Unlinked nodes and tables are retired (see rcu.hpp), so a flow
+// returned by search remains valid until the reading thread's next
+// quiescent state.
+//
+// The table-miss flow is not protected, and should only be set
+// while no lookups are running.
+struct Concurrent_table : Table
+{
+  // A key and its flow. The key is stored inline, and occupies
+  // only the bytes matched by the table.
+  struct Node
+  {
+    Flow          flow;
+    std::uint64_t hash;
+    Byte          key[1];
+  };
+
+  // An array of slots. Each slot is empty, deleted, or the address
+  // of a node with the high 16 bits of its hash.
+  struct Array
+  {
+    std::size_t                mask;
+    std::atomic<std::uint64_t> slots[1];
+  };
+
+  static constexpr std::uint64_t empty_slot = 0;
+  static constexpr std::uint64_t deleted_slot = 1;
+  static constexpr std::uint64_t address_mask = (std::uint64_t(1) << 48) - 1;
+
+  Concurrent_table(int id, int size, int k);
+  ~Concurrent_table();
+
+  Flow* search(Key const&);
+  void  search_burst(Key const*, Flow**, int);
+
+  void add(Key const&, Flow const&);
+  void rmv(Key const&);
+  void rmv_miss();
+
+  void dump(std::vector<Flow_record>&) const;
+
+  Table_memory memory() const;
+
+  // Returns the number of flows in the table.
+  std::size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  // Returns the number of slots in the current array.
+  std::size_t capacity() const { return array_.load(std::memory_order_acquire)->mask + 1; }
+
+private:
+  static std::uint64_t tag(std::uint64_t h) { return h >> 48; }
+  static Node*         node(std::uint64_t s) { return reinterpret_cast<Node*>(s & address_mask); }
+
+  bool   matches(std::uint64_t, std::uint64_t, Key const&) const;
+  Flow*  find(Array const*, std::uint64_t, Key const&);
+  Node*  make_node(Key const&, std::uint64_t, Flow const&) const;
+  Array* make_array(std::size_t) const;
+  void   rebuild(std::size_t);
+
+  static void free_node(void*);
+  static void free_array(void*);
+
+  Key_hash           hash_;
+  mutable std::mutex mutex_; // Serializes writers
+  std::atomic<Array*> array_;
+  std::atomic<std::size_t> size_;
+  std::size_t        used_;  // Slots that are not empty
+};
+
+
+// Returns true if the slot s holds the key k with hash h.
+inline bool
+Concurrent_table::matches(std::uint64_t s, std::uint64_t h, Key const& k) const
+{
+  if ((s >> 48) != tag(h) || s == deleted_slot)
+    return false;
+  Node const* n = node(s);
+  return n->hash == h && !std::memcmp(n->key, k.data, key_size_);
+}
+
+
+// Returns the flow in the array a matching k, whose hash is h, or
+// the table-miss flow if no flow matches.
+inline Flow*
+Concurrent_table::find(Array const* a, std::uint64_t h, Key const& k)
+{
+  for (std::size_t i = h & a->mask; ; i = (i + 1) & a->mask) {
+    std::uint64_t s = a->slots[i].load(std::memory_order_acquire);
+    if (s == empty_slot)
+      break;
+    if (matches(s, h, k))
+      return &node(s)->flow;
+  }
+  return &miss_;
+}
+
+
+// Returns the flow matching k, or the table-miss flow if no flow
+// matches.
+inline Flow*
+Concurrent_table::search(Key const& k)
+{
+  return find(array_.load(std::memory_order_acquire), hash_(k), k);
+}
+
+
+} // namespace fp
+
+
+#endif
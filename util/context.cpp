@@ -6,6 +6,16 @@
 namespace fp
 {
 
+// Returns the binding layout of the application of the given data
+// plane, or the default layout if there is none.
+Binding_layout const&
+binding_layout(Dataplane const* dp)
+{
+  static Binding_layout const def;
+  return dp ? dp->app_.library().layout : def;
+}
+
+
 // Sets the input port, physical input port, and tunnel id.
 void
 Context::set_input(Port* in, Port* in_phys, int tunnel)
@@ -59,7 +69,7 @@ namespace
 {
 
 inline void
-apply(Context& cxt, Set_action a)
+apply(Context& cxt, Set_action const& a)
 {
 
 }
@@ -16,6 +16,7 @@ class Table;
 class Flow;
 class Port;
 class Dataplane;
+struct Flow_trace;
 
 
 // Stores information about the ingress of a packet
@@ -39,24 +40,30 @@ struct Control_info
   unsigned int out_port = 0; // The selected output port.
   Table* table;
   Flow*  flow;
+  Flow_trace* trace = nullptr; // Records the outcome for the flow cache
 };
 
 
 // Maintains information about the current decoding
-// of the packet.
-//
-// FIXME: These data structures should be required by
-// the application, since a) not every data application
-// needs full support for rebinding and b) making that
-// assumption will be an unfortunate pessimization.
+// of the packet. The environments are sized by the
+// application's binding layout.
 struct Decoding_info
 {
-  uint16_t pos;
+  Decoding_info() = default;
+
+  explicit Decoding_info(Binding_layout const& l)
+    : hdrs(l.headers, l.depth), flds(l.fields, l.depth)
+  { }
+
+  uint16_t pos = 0;
   Environment hdrs;
   Environment flds;
 };
 
 
+Binding_layout const& binding_layout(Dataplane const*);
+
+
 // Packet metadata. This is an unstructured blob
 // to be used as scratch data by the application.
 //
@@ -107,15 +114,21 @@ struct Header_stack
 class Context
 {
 public:
-  // Iniitalize the context with a packet.
+  // Iniitalize the context with a packet. The binding environments
+  // are laid out as declared by the data plane's application, and
+  // are not zero-filled: only their counts are cleared.
   Context(Dataplane* dp, Packet p)
-    : input_(), ctrl_(), decode_(), packet_(p), dp_(dp)
+    : input_(), ctrl_(), decode_(binding_layout(dp)), packet_(p), metadata_(), dp_(dp)
   { }
 
   Context(Packet p, Dataplane* dp, unsigned int in, unsigned int in_phy, int tunnelid)
-    : input_{in, in_phy, tunnelid}, ctrl_(), decode_(), packet_(p), dp_(dp)
+    : input_{in, in_phy, tunnelid}, ctrl_(), decode_(binding_layout(dp)), packet_(p),
+      metadata_(), dp_(dp)
   { }
 
+  // Prepares the context for another packet.
+  void reset(Packet);
+
   // Sets the input port, physical input port, and tunnel id.
   void set_input(Port*, Port*, int);
 
@@ -188,6 +201,25 @@ public:
 };
 
 
+// Reinitializes the context for the packet p, as if it had just
+// been constructed with the same data plane. Contexts are meant to
+// be reused for each packet a worker receives: only the bindings
+// made for the previous packet are cleared, and the action set
+// keeps its storage.
+inline void
+Context::reset(Packet p)
+{
+  input_ = Ingress_info();
+  ctrl_ = Control_info();
+  decode_.pos = 0;
+  decode_.hdrs.clear();
+  decode_.flds.clear();
+  packet_ = p;
+  metadata_ = Metadata();
+  actions_.clear();
+}
+
+
 // Advance the current header offset by n bytes.
 inline void
 Context::advance(std::uint16_t n)
@@ -283,7 +315,7 @@ Context::clear_actions()
 inline Binding const&
 Context::get_field_binding(int fld) const
 {
-  return decode_.flds[fld].top();
+  return decode_.flds.top(fld);
 }
 
 
@@ -291,7 +323,7 @@ Context::get_field_binding(int fld) const
 inline Binding&
 Context::get_field_binding(int fld)
 {
-  return decode_.flds[fld].top();
+  return decode_.flds.top(fld);
 }
 
 
@@ -0,0 +1,459 @@
+#ifndef FP_CUCKOO_TABLE_HPP
+#define FP_CUCKOO_TABLE_HPP
+
+#include "types.hpp"
+#include "memory.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <utility>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+
+namespace fp
+{
+
+// A bucketized cuckoo hash table.
+//
+// Every key has two candidate buckets of 8 slots, and is stored in
+// one of them, so a lookup examines at most 16 slots in 2 buckets
+// no matter how full the table is. Each slot has a one-byte tag
+// taken from the hash value of its key (0 marks an empty slot).
+// The tags of a bucket are packed into 8 bytes, apart from the
+// entries, and a lookup compares the tags of both buckets against
+// the key's tag with a single SSE2 comparison. Only the keys whose
+// tags match are compared in full.
+//
+// The second bucket of a key is derived from its first bucket and
+// its tag, as in partial-key cuckoo hashing, so an entry can be
+// moved to its other bucket without rehashing its key. When both
+// of a new key's buckets are full, inserting it displaces entries
+// along a random walk until one of them lands in a bucket with a
+// free slot. Tables of this shape typically fill past 95% of their
+// capacity before a walk fails; the table then doubles in size.
+//
+// Pointers to values are stable until the next insertion or
+// erasure.
+template<typename K, typename V, typename H = std::hash<K>, typename E = std::equal_to<K>>
+class Cuckoo_table
+{
+public:
+  struct Entry
+  {
+    K key;
+    V value;
+  };
+
+  // The number of slots in a bucket.
+  static constexpr int bucket_size = 8;
+
+  // The longest displacement walk before the table grows.
+  static constexpr int max_kicks = 256;
+
+  Cuckoo_table(std::size_t n = 0, H const& h = H(), E const& e = E());
+  ~Cuckoo_table();
+
+  Cuckoo_table(Cuckoo_table const&) = delete;
+  Cuckoo_table& operator=(Cuckoo_table const&) = delete;
+
+  V*       find(K const&);
+  V const* find(K const&) const;
+  V*       find(K const&, std::size_t);
+  void     prefetch(std::size_t) const;
+
+  // Returns the first slot examined for the hash value h.
+  std::size_t home(std::size_t h) const { return (h & mask_) * bucket_size; }
+
+  std::pair<V*, bool> insert(K const&, V const&);
+  std::pair<V*, bool> insert(K const&, V const&, std::size_t);
+  bool                erase(K const&);
+  void                clear();
+  void                reserve(std::size_t);
+
+  template<typename F> void for_each(F) const;
+
+  std::size_t size() const     { return size_; }
+  std::size_t capacity() const { return (mask_ + 1) * bucket_size; }
+  bool        empty() const    { return size_ == 0; }
+
+  // Returns the number of bytes of storage used by the table.
+  std::size_t bytes() const { return capacity() * (1 + sizeof(Entry)); }
+
+  H const& hash_function() const { return hash_; }
+  E const& key_eq() const        { return eq_; }
+
+  // Direct access to the slots, used to save a table and restore it
+  // without rehashing (see snapshot.hpp). The layout identifies the
+  // meaning of the tags.
+  static constexpr std::uint32_t layout = 2;
+
+  static bool  occupied(Byte t) { return t != 0; }
+  static bool  adoptable(Byte const*, std::size_t);
+  Byte const*  control() const { return tags_; }
+  Entry const& slot(std::size_t i) const { return slots_[i]; }
+  void         settle() { }
+  void         adopt(Byte*, std::size_t);
+  V*           construct(std::size_t, K const&, V const&);
+
+private:
+  static Byte tag(std::size_t h)
+  {
+    Byte t = h >> 56;
+    return t ? t : 1;
+  }
+
+  // Returns the other bucket of an entry with tag t in bucket b.
+  std::size_t alternate(std::size_t b, Byte t) const
+  {
+    return (b ^ (t * std::size_t(0x5bd1e995))) & mask_;
+  }
+
+  // Returns the number of buckets needed to hold n entries at a
+  // load of at most 15/16.
+  static std::size_t buckets_for(std::size_t n)
+  {
+    std::size_t b = (n + n / 15) / bucket_size + 1;
+    return next_power_of_two(b < 2 ? 2 : b);
+  }
+
+  static unsigned match(Byte const*, Byte const*, Byte);
+
+  std::size_t locate(K const&, std::size_t) const;
+  bool        place(Entry&, std::size_t);
+  void        store(Entry&&);
+  void        allocate(std::size_t);
+  void        rehash(std::size_t);
+
+  Byte*         tags_;  // Slot tags, bucket_size per bucket
+  Entry*        slots_; // Entries
+  std::size_t   mask_;  // Number of buckets - 1
+  std::size_t   size_;  // Number of live entries
+  std::uint32_t seed_;  // State for choosing displaced entries
+  H             hash_;
+  E             eq_;
+};
+
+
+// Construct a table able to hold at least n entries without
+// rehashing.
+template<typename K, typename V, typename H, typename E>
+Cuckoo_table<K, V, H, E>::Cuckoo_table(std::size_t n, H const& h, E const& e)
+  : tags_(nullptr), slots_(nullptr), mask_(0), size_(0), seed_(0x9e3779b9),
+    hash_(h), eq_(e)
+{
+  allocate(buckets_for(n));
+}
+
+
+template<typename K, typename V, typename H, typename E>
+Cuckoo_table<K, V, H, E>::~Cuckoo_table()
+{
+  clear();
+  deallocate_zeroed(tags_, capacity());
+  deallocate_zeroed(slots_, capacity() * sizeof(Entry));
+}
+
+
+// Allocate empty storage for n buckets, where n is a power of two.
+template<typename K, typename V, typename H, typename E>
+void
+Cuckoo_table<K, V, H, E>::allocate(std::size_t n)
+{
+  tags_ = static_cast<Byte*>(allocate_zeroed(n * bucket_size));
+  slots_ = static_cast<Entry*>(allocate_zeroed(n * bucket_size * sizeof(Entry)));
+  mask_ = n - 1;
+  size_ = 0;
+}
+
+
+// Returns a bit mask of the slots whose tags equal t: bits 0-7 for
+// the bucket whose tags are at a, and bits 8-15 for the bucket
+// whose tags are at b.
+template<typename K, typename V, typename H, typename E>
+inline unsigned
+Cuckoo_table<K, V, H, E>::match(Byte const* a, Byte const* b, Byte t)
+{
+#ifdef __SSE2__
+  __m128i lo = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(a));
+  __m128i hi = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(b));
+  __m128i tags = _mm_unpacklo_epi64(lo, hi);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8(t)));
+#else
+  unsigned m = 0;
+  for (int i = 0; i < bucket_size; ++i) {
+    m |= unsigned(a[i] == t) << i;
+    m |= unsigned(b[i] == t) << (i + bucket_size);
+  }
+  return m;
+#endif
+}
+
+
+// Returns the index of the slot holding k, whose hash value is h,
+// or the capacity of the table if k is not present.
+template<typename K, typename V, typename H, typename E>
+inline std::size_t
+Cuckoo_table<K, V, H, E>::locate(K const& k, std::size_t h) const
+{
+  Byte t = tag(h);
+  std::size_t b1 = h & mask_;
+  std::size_t b2 = alternate(b1, t);
+  unsigned m = match(&tags_[b1 * bucket_size], &tags_[b2 * bucket_size], t);
+  while (m) {
+    int j = __builtin_ctz(m);
+    std::size_t i = j < bucket_size ? b1 * bucket_size + j
+                                    : b2 * bucket_size + j - bucket_size;
+    if (eq_(slots_[i].key, k))
+      return i;
+    m &= m - 1;
+  }
+  return capacity();
+}
+
+
+// Returns a pointer to the value associated with k, or nullptr
+// if there is no such value.
+template<typename K, typename V, typename H, typename E>
+inline V*
+Cuckoo_table<K, V, H, E>::find(K const& k)
+{
+  std::size_t i = locate(k, hash_(k));
+  return i < capacity() ? &slots_[i].value : nullptr;
+}
+
+
+template<typename K, typename V, typename H, typename E>
+inline V const*
+Cuckoo_table<K, V, H, E>::find(K const& k) const
+{
+  std::size_t i = locate(k, hash_(k));
+  return i < capacity() ? &slots_[i].value : nullptr;
+}
+
+
+// Returns a pointer to the value associated with k, whose hash
+// value h has already been computed, or nullptr if there is no
+// such value.
+template<typename K, typename V, typename H, typename E>
+inline V*
+Cuckoo_table<K, V, H, E>::find(K const& k, std::size_t h)
+{
+  std::size_t i = locate(k, h);
+  return i < capacity() ? &slots_[i].value : nullptr;
+}
+
+
+// Starts loading the tags of both buckets for the hash value h.
+template<typename K, typename V, typename H, typename E>
+inline void
+Cuckoo_table<K, V, H, E>::prefetch(std::size_t h) const
+{
+  std::size_t b1 = h & mask_;
+  __builtin_prefetch(&tags_[b1 * bucket_size]);
+  __builtin_prefetch(&tags_[alternate(b1, tag(h)) * bucket_size]);
+}
+
+
+// Insert the entry (k, v) if no entry with key k exists. Returns
+// a pointer to the value associated with k and true if the entry
+// was inserted.
+template<typename K, typename V, typename H, typename E>
+inline std::pair<V*, bool>
+Cuckoo_table<K, V, H, E>::insert(K const& k, V const& v)
+{
+  return insert(k, v, hash_(k));
+}
+
+
+// Insert the entry (k, v), where h is the hash value of k, if no
+// entry with key k exists.
+template<typename K, typename V, typename H, typename E>
+std::pair<V*, bool>
+Cuckoo_table<K, V, H, E>::insert(K const& k, V const& v, std::size_t h)
+{
+  std::size_t i = locate(k, h);
+  if (i < capacity())
+    return {&slots_[i].value, false};
+
+  // The new entry may be displaced by later moves, so find it again
+  // once it has been stored.
+  store(Entry{k, v});
+  return {find(k, h), true};
+}
+
+
+// Stores the entry e, whose hash value is h, in one of its buckets,
+// displacing other entries if both are full. Returns false if the
+// walk fails, leaving e holding the entry that is still homeless.
+template<typename K, typename V, typename H, typename E>
+bool
+Cuckoo_table<K, V, H, E>::place(Entry& e, std::size_t h)
+{
+  Byte t = tag(h);
+  std::size_t b = h & mask_;
+  for (int n = 0; n <= max_kicks; ++n) {
+    // Use a free slot in either bucket.
+    std::size_t alt = alternate(b, t);
+    unsigned m = match(&tags_[b * bucket_size], &tags_[alt * bucket_size], 0);
+    if (m) {
+      int j = __builtin_ctz(m);
+      std::size_t i = j < bucket_size ? b * bucket_size + j
+                                      : alt * bucket_size + j - bucket_size;
+      ::new (&slots_[i]) Entry(std::move(e));
+      tags_[i] = t;
+      ++size_;
+      return true;
+    }
+
+    // Swap e with a random entry in its first bucket, and move the
+    // displaced entry towards its other bucket.
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    std::size_t i = b * bucket_size + seed_ % bucket_size;
+    std::swap(e, slots_[i]);
+    std::swap(t, tags_[i]);
+    b = alternate(b, t);
+  }
+  return false;
+}
+
+
+// Stores the entry e, growing the table until it fits.
+template<typename K, typename V, typename H, typename E>
+void
+Cuckoo_table<K, V, H, E>::store(Entry&& e)
+{
+  while (!place(e, hash_(e.key)))
+    rehash(2 * (mask_ + 1));
+}
+
+
+// Remove the entry with key k. Returns false if no such entry
+// exists.
+template<typename K, typename V, typename H, typename E>
+bool
+Cuckoo_table<K, V, H, E>::erase(K const& k)
+{
+  std::size_t i = locate(k, hash_(k));
+  if (i >= capacity())
+    return false;
+  slots_[i].~Entry();
+  tags_[i] = 0;
+  --size_;
+  return true;
+}
+
+
+// Remove all entries from the table.
+template<typename K, typename V, typename H, typename E>
+void
+Cuckoo_table<K, V, H, E>::clear()
+{
+  for (std::size_t i = 0; i < capacity(); ++i) {
+    if (tags_[i])
+      slots_[i].~Entry();
+  }
+  std::memset(tags_, 0, capacity());
+  size_ = 0;
+}
+
+
+// Ensure that the table can hold n entries without rehashing.
+template<typename K, typename V, typename H, typename E>
+void
+Cuckoo_table<K, V, H, E>::reserve(std::size_t n)
+{
+  std::size_t b = buckets_for(n);
+  if (b > mask_ + 1)
+    rehash(b);
+}
+
+
+// Move all entries into a new table with n buckets. If an entry
+// does not fit, the new table grows again.
+template<typename K, typename V, typename H, typename E>
+void
+Cuckoo_table<K, V, H, E>::rehash(std::size_t n)
+{
+  Byte* tags = tags_;
+  Entry* slots = slots_;
+  std::size_t cap = capacity();
+
+  allocate(n);
+  for (std::size_t i = 0; i < cap; ++i) {
+    if (!tags[i])
+      continue;
+    Entry e(std::move(slots[i]));
+    slots[i].~Entry();
+    store(std::move(e));
+  }
+
+  deallocate_zeroed(tags, cap);
+  deallocate_zeroed(slots, cap * sizeof(Entry));
+}
+
+
+// Returns true if the n tags at tags can be adopted: they fill a
+// power of two number of buckets, and at least two.
+template<typename K, typename V, typename H, typename E>
+bool
+Cuckoo_table<K, V, H, E>::adoptable(Byte const*, std::size_t n)
+{
+  std::size_t b = n / bucket_size;
+  return n % bucket_size == 0 && b >= 2 && !(b & (b - 1));
+}
+
+
+// Replace the contents of the table with n slots whose tags are
+// tags. The table takes ownership of tags, which must have been
+// acquired by allocate_zeroed and accepted by adoptable. The entry
+// of every occupied slot must then be supplied by construct before
+// the table is used.
+template<typename K, typename V, typename H, typename E>
+void
+Cuckoo_table<K, V, H, E>::adopt(Byte* tags, std::size_t n)
+{
+  Entry* slots = static_cast<Entry*>(allocate_zeroed(n * sizeof(Entry)));
+  clear();
+  deallocate_zeroed(tags_, capacity());
+  deallocate_zeroed(slots_, capacity() * sizeof(Entry));
+  tags_ = tags;
+  slots_ = slots;
+  mask_ = n / bucket_size - 1;
+}
+
+
+// Stores the entry (k, v) in the i-th slot of an adopted table.
+template<typename K, typename V, typename H, typename E>
+inline V*
+Cuckoo_table<K, V, H, E>::construct(std::size_t i, K const& k, V const& v)
+{
+  ::new (&slots_[i]) Entry{k, v};
+  ++size_;
+  return &slots_[i].value;
+}
+
+
+// Call f(key, value) for each entry in the table.
+template<typename K, typename V, typename H, typename E>
+template<typename F>
+void
+Cuckoo_table<K, V, H, E>::for_each(F f) const
+{
+  for (std::size_t i = 0; i < capacity(); ++i) {
+    if (tags_[i])
+      f(slots_[i].key, slots_[i].value);
+  }
+}
+
+
+} // namespace fp
+
+
+#endif
@@ -4,6 +4,8 @@
 #include "context.hpp"
 #include "timer.hpp"
 #include "system.hpp"
+#include "rcu.hpp"
+#include "dispatch.hpp"
 
 #include <iostream>
 #include <cassert>
@@ -105,18 +107,78 @@ Dataplane::up()
 
 
 // For manually passing in packets to the data plane.
+//
+// Flow timeouts are advanced by the packet's time stamp. Packets
+// read from a capture carry the capture time. Packets that are not
+// time stamped by their port are stamped with the current time.
+//
+// The calling thread passes through a quiescent state before the
+// packet, so flows found by the previous packet may be reclaimed
+// (see rcu.hpp).
 void
 Dataplane::process(Context& cxt)
 {
+  rcu_quiescent();
+
+  std::uint64_t& now = cxt.packet().timestamp_;
+  if (!now)
+    now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+
+  // Replay the outcome of an earlier packet of the same flow, or
+  // record this one's.
+  Flow_cache* c = cache();
+  Flow_trace trace;
+  if (c && c->replay(cxt, trace)) {
+    expire(now);
+    return;
+  }
+
   try
   {
     app_.process(cxt);
+    if (c)
+      c->record(cxt, trace);
   }
   catch (std::exception& e)
   {
     // Drop the packet.
     // Do nothing.
+    cxt.ctrl_.trace = nullptr;
   }
+
+  expire(now);
+}
+
+
+// Enables a flow cache with n entries for each worker. The key
+// mask, if any, holds Flow_cache::header_size bytes. Caches must be
+// enabled after the number of workers is set, and while they are
+// idle.
+void
+Dataplane::enable_cache(std::size_t n, Byte const* mask)
+{
+  caches_.clear();
+  for (int i = 0; i < workers_; ++i)
+    caches_.emplace_back(new Flow_cache(tables_, n, mask));
+}
+
+
+// Disables the flow caches. The workers must be idle.
+void
+Dataplane::disable_cache()
+{
+  caches_.clear();
+}
+
+
+// Removes the flows whose timeouts have passed at the given time,
+// in nanoseconds.
+void
+Dataplane::expire(std::uint64_t now)
+{
+  for (Table* t : tables_)
+    t->expire(now);
 }
 
 
@@ -137,6 +199,7 @@ Dataplane::down()
 void
 Dataplane::configure()
 {
+  Flow_counters::set_shards(workers_);
   app_.load(*this);
 }
 
@@ -188,4 +251,28 @@ Dataplane::buf_pool() const
 }
 
 
+// Returns the calling worker's flow cache, or nullptr if caching
+// is disabled.
+Flow_cache*
+Dataplane::cache() const
+{
+  if (caches_.empty())
+    return nullptr;
+  return caches_[this_worker() % caches_.size()].get();
+}
+
+
+// Returns the counters of the flow caches, summed over the workers.
+// The counters are read without synchronization, so the result is
+// only exact while the workers are idle.
+Flow_cache_stats
+Dataplane::cache_stats() const
+{
+  Flow_cache_stats s;
+  for (auto const& c : caches_)
+    s += c->stats();
+  return s;
+}
+
+
 } // end namespace fp
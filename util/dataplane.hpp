@@ -2,6 +2,7 @@
 #define FP_DATAPLANE_HPP
 
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -9,6 +10,9 @@
 
 #include "port.hpp"
 #include "application.hpp"
+#include "table.hpp"
+#include "flow_cache.hpp"
+#include "gather.hpp"
 
 // #include "thread.hpp"
 
@@ -55,7 +59,10 @@ struct Dataplane
   void down();
   void configure();
   void process(Context&);
+  void expire(std::uint64_t);
   void set_pool(Pool*);
+  void enable_cache(std::size_t = Flow_cache::default_entries, Byte const* = nullptr);
+  void disable_cache();
 
   // Accessors.
   Application const&  app() const;
@@ -63,6 +70,8 @@ struct Dataplane
   std::vector<Table*> tables() const;
   Table*              table(int);
   Pool*               buf_pool() const;
+  Flow_cache*         cache() const;
+  Flow_cache_stats    cache_stats() const;
 
   Port_list ports_;
   Port_map  portmap_;
@@ -72,6 +81,23 @@ struct Dataplane
   Port*     reflow_;
   Pool*     buf_pool_;
 
+  // The structures used for exact and wildcard tables created
+  // without an explicit algorithm.
+  Table::Algorithm exact_algorithm_ = Table::DEFAULT;
+  Table::Algorithm wildcard_algorithm_ = Table::DEFAULT;
+
+  // The number of workers processing packets. When there are
+  // several, exact tables are sharded so that each worker has its
+  // own (see sharded_table.hpp). Flow counters are split among the
+  // workers when the data plane is configured (see flow.hpp).
+  int workers_ = 1;
+
+  // The flow caches of the workers, if enabled (see flow_cache.hpp).
+  std::vector<std::unique_ptr<Flow_cache>> caches_;
+
+  // The gather plans created by the application (see gather.hpp).
+  std::vector<std::unique_ptr<Gather_plan>> plans_;
+
   std::uint64_t throughput = 0;
   std::uint64_t throughput_bytes = 0;
 };
@@ -0,0 +1,433 @@
+#include "decision_tree.hpp"
+
+#include <algorithm>
+#include <memory>
+
+
+namespace fp
+{
+
+namespace
+{
+
+// The maximum depth of a tree. Cuts always shrink the rule set of
+// a node, so this is only a safeguard.
+constexpr int max_depth = 64;
+
+
+// Returns the y-th byte of the value (which = 0) or mask
+// (which = 1) of rule r in the tree t, whose keys are n words
+// wide.
+inline Byte
+rule_byte(Decision_tree_table::Tree const& t, int n, std::uint32_t r, int y, int which)
+{
+  std::uint64_t const& w = t.words[2 * (r * n + y / 8) + which];
+  return reinterpret_cast<Byte const*>(&w)[y % 8];
+}
+
+
+// Returns the b-th bit of the value or mask of rule r.
+inline int
+rule_bit(Decision_tree_table::Tree const& t, int n, std::uint32_t r, int b, int which)
+{
+  return (rule_byte(t, n, r, b / 8, which) >> (b % 8)) & 1;
+}
+
+
+// Returns the number of bytes used by the tree t, excluding the
+// counters of its flows.
+std::size_t
+tree_bytes(Decision_tree_table::Tree const& t)
+{
+  using Tree = Decision_tree_table::Tree;
+  using Node = Decision_tree_table::Node;
+  return sizeof(Tree)
+       + t.nodes.capacity() * sizeof(Node)
+       + t.leaves.capacity() * sizeof(std::uint32_t)
+       + t.words.capacity() * sizeof(std::uint64_t)
+       + t.flows.capacity() * sizeof(Flow);
+}
+
+} // namespace
+
+
+Decision_tree_table::Decision_tree_table(int id, int size, int k)
+  : Classifier(id, k), words_((k + 7) / 8),
+    rules_(size, Rule_hash(k), Rule_equal(k)),
+    requested_(0), built_(0), stop_(false), tree_(nullptr)
+{
+  tree_.store(snapshot());
+  grow(*tree_.load());
+  builder_ = std::thread(&Decision_tree_table::run, this);
+}
+
+
+Decision_tree_table::~Decision_tree_table()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  builder_.join();
+  delete tree_.load();
+}
+
+
+// Returns the rule for the value k under the mask m.
+Decision_tree_table::Rule
+Decision_tree_table::make_rule(Key const& k, Key const& m) const
+{
+  Rule r {Key(m.data, key_size_), Key(m.data, key_size_)};
+  for (int i = 0; i < key_size_; ++i)
+    r.value.data[i] = k.data[i] & m.data[i];
+  return r;
+}
+
+
+// Adds a flow matching all bits of k.
+void
+Decision_tree_table::add(Key const& k, Flow const& f)
+{
+  Byte buf[fp::key_size];
+  std::fill(buf, buf + key_size_, 0xff);
+  add(k, Key(buf, key_size_), f);
+}
+
+
+// Adds a flow matching the bits of k selected by the mask m. The
+// flow is visible to lookups once the tree has been rebuilt.
+void
+Decision_tree_table::add(Key const& k, Key const& m, Flow const& f)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto ins = rules_.insert(make_rule(k, m), f);
+    if (!ins.second)
+      *ins.first = f;
+  }
+  ++version_;
+  update();
+}
+
+
+// Removes the flow matching all bits of k.
+void
+Decision_tree_table::rmv(Key const& k)
+{
+  Byte buf[fp::key_size];
+  std::fill(buf, buf + key_size_, 0xff);
+  rmv(k, Key(buf, key_size_));
+}
+
+
+// Removes the flow with the value k under the mask m. If no such
+// flow exists, no action is taken.
+void
+Decision_tree_table::rmv(Key const& k, Key const& m)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!rules_.erase(make_rule(k, m)))
+      return;
+  }
+  ++version_;
+  update();
+}
+
+
+// Returns the flow in the rule set with the value k under the mask
+// m and the given priority, or nullptr if there is no such flow.
+// Counters are shared with the trees, so the flow's last hit is
+// that of its copies.
+Flow*
+Decision_tree_table::find_flow(Key const& k, Key const& m, std::size_t pri)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  Flow* f = rules_.find(make_rule(k, m));
+  return f && f->pri_ == pri ? f : nullptr;
+}
+
+
+// Removes the flow with the value k under the mask m and the given
+// priority, if any.
+void
+Decision_tree_table::rmv_flow(Key const& k, Key const& m, std::size_t pri)
+{
+  if (find_flow(k, m, pri))
+    rmv(k, m);
+}
+
+
+// Resets the miss case to default.
+void
+Decision_tree_table::rmv_miss()
+{
+  miss_ = Flow();
+  ++version_;
+}
+
+
+// Appends a record for each flow in the rule set.
+void
+Decision_tree_table::dump(std::vector<Flow_record>& v) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  rules_.for_each([&](Rule const& r, Flow const& f) {
+    v.push_back({r.value, r.mask, f.pri_, f.cookie_, f.count_.read()});
+  });
+}
+
+
+// Returns the memory used by the rule set and the current tree.
+// Flows are counted once, although the tree holds a copy of each.
+Table_memory
+Decision_tree_table::memory() const
+{
+  Table_memory m = Table::memory();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    m.flows += rules_.size();
+    m.bytes += rules_.bytes();
+    rules_.for_each([&](Rule const&, Flow const& f) {
+      m.bytes += f.count_.bytes();
+    });
+  }
+  Tree const* t = tree_.load(std::memory_order_acquire);
+  m.bytes += tree_bytes(*t);
+  for (Flow const& f : t->flows)
+    m.bytes += f.count_.bytes();
+  return m;
+}
+
+
+std::size_t
+Decision_tree_table::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return rules_.size();
+}
+
+
+// Request a rebuild of the tree.
+void
+Decision_tree_table::update()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++requested_;
+  }
+  cv_.notify_all();
+}
+
+
+// Wait until all changes to the rule set made before the call
+// are visible to lookups.
+void
+Decision_tree_table::sync()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::uint64_t v = requested_;
+  cv_.wait(lock, [this, v] { return built_ >= v; });
+}
+
+
+// The builder thread. Changes made while a tree is being built
+// are coalesced into the next rebuild.
+void
+Decision_tree_table::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] { return stop_ || requested_ != built_; });
+    if (stop_)
+      return;
+
+    std::uint64_t v = requested_;
+    std::unique_ptr<Tree> t(snapshot());
+    lock.unlock();
+
+    grow(*t);
+    Tree* old = tree_.exchange(t.release(), std::memory_order_acq_rel);
+    rcu_retire(old, tree_bytes(*old));
+
+    // Flows found before the swap belong to the retired tree, so
+    // anything that recorded them (e.g., a flow cache) must see a
+    // new version.
+    ++version_;
+
+    lock.lock();
+    built_ = v;
+    cv_.notify_all();
+  }
+}
+
+
+// Returns a new tree holding the rules of the rule set in order of
+// decreasing priority, but no nodes. The caller must hold the lock
+// on the rule set.
+Decision_tree_table::Tree*
+Decision_tree_table::snapshot() const
+{
+  struct Item
+  {
+    Rule const* rule;
+    Flow const* flow;
+  };
+
+  std::vector<Item> items;
+  items.reserve(rules_.size());
+  rules_.for_each([&items](Rule const& r, Flow const& f) {
+    items.push_back({&r, &f});
+  });
+  std::stable_sort(items.begin(), items.end(), [](Item const& a, Item const& b) {
+    return a.flow->pri_ > b.flow->pri_;
+  });
+
+  Tree* t = new Tree();
+  t->words.reserve(2 * items.size() * words_);
+  t->flows.reserve(items.size());
+  for (Item const& i : items) {
+    for (int w = 0; w < words_; ++w) {
+      t->words.push_back(load_word(i.rule->value.data + 8 * w));
+      t->words.push_back(load_word(i.rule->mask.data + 8 * w));
+    }
+    // Share counters with the rule set, so that counts survive
+    // rebuilds of the tree.
+    i.flow->count_.share();
+    t->flows.push_back(*i.flow);
+  }
+  return t;
+}
+
+
+// Build the nodes of the tree t for its rules.
+void
+Decision_tree_table::grow(Tree& t) const
+{
+  std::vector<std::uint32_t> rules(t.flows.size());
+  for (std::uint32_t i = 0; i < rules.size(); ++i)
+    rules[i] = i;
+  std::vector<Byte> path(key_size_, 0);
+  std::size_t budget = max_replication * rules.size();
+  t.nodes.push_back(Node());
+  split(t, 0, rules, path, budget, 0);
+}
+
+
+// Build the subtree rooted at node n for the given rules, which
+// are in priority order. The path has a bit set for each bit that
+// has been cut on above n. The budget bounds the number of rules
+// stored in the leaves of the subtree.
+void
+Decision_tree_table::split(Tree& t, std::uint32_t n, std::vector<std::uint32_t>& rules,
+                           std::vector<Byte> const& path, std::size_t budget,
+                           int depth) const
+{
+  // Rules that follow a rule caring only about bits on the path
+  // can never be reached from this node.
+  for (std::size_t i = 0; i < rules.size(); ++i) {
+    bool covers = true;
+    for (int y = 0; y < key_size_ && covers; ++y)
+      covers = !(rule_byte(t, words_, rules[i], y, 1) & ~path[y]);
+    if (covers) {
+      rules.resize(i + 1);
+      break;
+    }
+  }
+
+  // Count the rules that require each bit to be 0 or 1.
+  int nbits = 8 * key_size_;
+  std::vector<std::uint32_t> zeros(nbits), ones(nbits);
+  if (rules.size() > leaf_size && depth < max_depth) {
+    for (std::uint32_t r : rules) {
+      for (int b = 0; b < nbits; ++b) {
+        if (rule_bit(t, words_, r, b, 1)) {
+          if (rule_bit(t, words_, r, b, 0))
+            ++ones[b];
+          else
+            ++zeros[b];
+        }
+      }
+    }
+  }
+
+  // A bit is worth cutting on if it separates some rules. Prefer
+  // the bits that remove the most rules from the larger child.
+  std::vector<int> bits;
+  for (int b = 0; b < nbits; ++b) {
+    if (zeros[b] && ones[b])
+      bits.push_back(b);
+  }
+  std::stable_sort(bits.begin(), bits.end(), [&](int a, int b) {
+    return std::min(zeros[a], ones[a]) > std::min(zeros[b], ones[b]);
+  });
+
+  // Make a leaf when no cut helps.
+  if (bits.empty()) {
+    t.nodes[n].first = t.leaves.size();
+    t.nodes[n].count = rules.size();
+    t.nodes[n].ncuts = 0;
+    t.leaves.insert(t.leaves.end(), rules.begin(), rules.end());
+    return;
+  }
+
+  // Use as many cuts as possible within the budget.
+  int k = bits.size() < max_cuts ? bits.size() : max_cuts;
+  std::vector<std::vector<std::uint32_t>> children;
+  std::size_t total;
+  while (true) {
+    children.assign(1 << k, std::vector<std::uint32_t>());
+    total = 0;
+    for (std::uint32_t r : rules) {
+      std::uint32_t care = 0;
+      std::uint32_t val = 0;
+      for (int i = 0; i < k; ++i) {
+        care |= rule_bit(t, words_, r, bits[i], 1) << i;
+        val |= rule_bit(t, words_, r, bits[i], 0) << i;
+      }
+      for (std::uint32_t c = 0; c < children.size(); ++c) {
+        if (!((c ^ val) & care)) {
+          children[c].push_back(r);
+          ++total;
+        }
+      }
+    }
+    if (total <= budget || k == 1)
+      break;
+    --k;
+  }
+
+  // Make a leaf when even a single cut is too costly.
+  if (total > budget) {
+    t.nodes[n].first = t.leaves.size();
+    t.nodes[n].count = rules.size();
+    t.nodes[n].ncuts = 0;
+    t.leaves.insert(t.leaves.end(), rules.begin(), rules.end());
+    return;
+  }
+
+  std::vector<Byte> sub = path;
+  std::uint32_t first = t.nodes.size();
+  t.nodes[n].first = first;
+  t.nodes[n].count = 0;
+  t.nodes[n].ncuts = k;
+  for (int i = 0; i < k; ++i) {
+    t.nodes[n].cuts[i] = bits[i];
+    sub[bits[i] / 8] |= 1 << (bits[i] % 8);
+  }
+  t.nodes.resize(first + children.size());
+
+  // Release the parent's rules before descending. Each child gets
+  // a share of the budget in proportion to its rules, so that the
+  // replication allowed below a node shrinks as rules are copied.
+  rules.clear();
+  rules.shrink_to_fit();
+  for (std::uint32_t c = 0; c < children.size(); ++c) {
+    std::size_t share = budget * children[c].size() / total;
+    split(t, first + c, children[c], sub, share, depth + 1);
+  }
+}
+
+
+} // namespace fp
@@ -0,0 +1,202 @@
+#ifndef FP_DECISION_TREE_HPP
+#define FP_DECISION_TREE_HPP
+
+#include "wildcard_table.hpp"
+#include "rcu.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace fp
+{
+
+// A wildcard match table implemented with a decision tree in the
+// style of HyperCuts.
+//
+// Each interior node of the tree cuts the key space on up to
+// max_cuts bits at once, giving up to 16 children. Rules that do
+// not care about a cut bit are replicated into both halves. Bits
+// are chosen to minimize the largest child, subject to a bound
+// on the replication of rules. A node with at most leaf_size rules
+// becomes a leaf, whose rules are searched linearly in priority
+// order. Unlike tuple space search, the lookup cost depends on
+// the depth of the tree and not on the number of distinct masks.
+//
+// The tree is built offline from a snapshot of the rule set and
+// is never modified. Adding or removing a flow updates the rule
+// set and wakes a background thread, which builds a new tree and
+// swaps it in atomically. Lookups see the previous tree until
+// the swap, so updates become visible after a short delay; use
+// sync() to wait for them.
+//
+// A replaced tree is retired (see rcu.hpp), so flows returned by
+// search remain valid until the reading thread's next quiescent
+// state. Retiring a tree counts its bytes towards the next
+// collection, so that large trees are freed by the next swap after
+// every reader has passed a quiescent state instead of
+// accumulating. Those flows belong to the tree, so changes made to them
+// are lost when the tree is rebuilt, except for counters, which
+// each tree shares with the rule set.
+struct Decision_tree_table : Classifier
+{
+  static constexpr int max_cuts = 4;
+  static constexpr int leaf_size = 8;
+
+  // The maximum ratio of rules stored in the leaves of the tree
+  // to the rules in the rule set.
+  static constexpr int max_replication = 8;
+
+  // A node in the tree. For an interior node, first is the index
+  // of the first of its 2^ncuts children. For a leaf, it is the
+  // index of the first of its count rules in the leaf list.
+  struct Node
+  {
+    std::uint32_t first;
+    std::uint32_t count;
+    std::uint16_t ncuts;
+    std::uint16_t cuts[max_cuts];
+  };
+
+  // An immutable classifier. Rules are sorted by decreasing
+  // priority, and the value and mask of rule i are interleaved
+  // word by word starting at words[2 * i * n], where n is the key
+  // width in words.
+  struct Tree
+  {
+    std::vector<Node>          nodes;
+    std::vector<std::uint32_t> leaves;
+    std::vector<std::uint64_t> words;
+    std::vector<Flow>          flows;
+  };
+
+  // A rule in the rule set.
+  struct Rule
+  {
+    Key value;
+    Key mask;
+  };
+
+  struct Rule_hash
+  {
+    Rule_hash(int k) : hash(k) { }
+
+    std::size_t operator()(Rule const& r) const
+    {
+      return hash_mix(hash(r.value), hash(r.mask));
+    }
+
+    Key_hash hash;
+  };
+
+  struct Rule_equal
+  {
+    Rule_equal(int k) : eq(k) { }
+
+    bool operator()(Rule const& a, Rule const& b) const
+    {
+      return eq(a.value, b.value) && eq(a.mask, b.mask);
+    }
+
+    Key_equal eq;
+  };
+
+  using Rule_map = Open_table<Rule, Flow, Rule_hash, Rule_equal>;
+
+  Decision_tree_table(int id, int size, int k);
+  ~Decision_tree_table();
+
+  Flow* search(Key const&);
+
+  void add(Key const&, Flow const&);
+  void add(Key const&, Key const&, Flow const&);
+  void rmv(Key const&);
+  void rmv(Key const&, Key const&);
+  void rmv_miss();
+
+  using Classifier::find_flow;
+  using Classifier::rmv_flow;
+  Flow* find_flow(Key const&, Key const&, std::size_t);
+  void  rmv_flow(Key const&, Key const&, std::size_t);
+
+  void dump(std::vector<Flow_record>&) const;
+
+  Table_memory memory() const;
+
+  void sync();
+
+  // Returns the number of flows in the rule set.
+  std::size_t size() const;
+
+  // Returns the number of nodes in the current tree.
+  std::size_t nodes() const { return tree_.load()->nodes.size(); }
+
+  // Returns the number of rules stored in leaves of the current
+  // tree, including replicas.
+  std::size_t replicas() const { return tree_.load()->leaves.size(); }
+
+private:
+  Rule  make_rule(Key const&, Key const&) const;
+  void  update();
+  void  run();
+  Tree* snapshot() const;
+  void  grow(Tree&) const;
+  void  split(Tree&, std::uint32_t, std::vector<std::uint32_t>&,
+              std::vector<Byte> const&, std::size_t, int) const;
+
+  int words_; // Key width in 64-bit words
+
+  // The rule set and the state of the builder.
+  mutable std::mutex      mutex_;
+  std::condition_variable cv_;
+  Rule_map                rules_;
+  std::uint64_t           requested_; // Rule set version
+  std::uint64_t           built_;     // Version of the current tree
+  bool                    stop_;
+
+  std::atomic<Tree*> tree_;
+  std::thread        builder_;
+};
+
+
+// Returns the highest priority flow matching k, or the table-miss
+// flow if no flow matches.
+inline Flow*
+Decision_tree_table::search(Key const& k)
+{
+  Tree* t = tree_.load(std::memory_order_acquire);
+  ++stats_.lookups;
+
+  // Descend to a leaf.
+  Node const* n = &t->nodes[0];
+  while (n->ncuts) {
+    ++stats_.probes;
+    std::uint32_t c = 0;
+    for (int i = 0; i < n->ncuts; ++i)
+      c |= ((k.data[n->cuts[i] >> 3] >> (n->cuts[i] & 7)) & 1) << i;
+    n = &t->nodes[n->first + c];
+  }
+
+  // Return the first matching rule.
+  std::uint32_t const* first = t->leaves.data() + n->first;
+  std::uint32_t const* last = first + n->count;
+  for (; first != last; ++first) {
+    ++stats_.probes;
+    std::uint64_t const* r = &t->words[2 * *first * words_];
+    std::uint64_t d = 0;
+    for (int i = 0; i < words_; ++i)
+      d |= (load_word(k.data + 8 * i) & r[2 * i + 1]) ^ r[2 * i];
+    if (!d)
+      return &t->flows[*first];
+  }
+  return &miss_;
+}
+
+
+} // namespace fp
+
+
+#endif
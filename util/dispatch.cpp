@@ -0,0 +1,160 @@
+#include "dispatch.hpp"
+#include "packet.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace fp
+{
+
+namespace
+{
+
+thread_local int worker = 0;
+
+constexpr int ethernet_size = 14;
+
+constexpr std::uint16_t ethertype_ipv4 = 0x0800;
+constexpr std::uint16_t ethertype_ipv6 = 0x86dd;
+constexpr std::uint16_t ethertype_vlan = 0x8100;
+constexpr std::uint16_t ethertype_qinq = 0x88a8;
+
+constexpr Byte proto_tcp  = 6;
+constexpr Byte proto_udp  = 17;
+constexpr Byte proto_sctp = 132;
+
+
+// Returns the big-endian 16-bit value at p.
+inline std::uint16_t
+load16(Byte const* p)
+{
+  return std::uint16_t(p[0] << 8 | p[1]);
+}
+
+
+// Returns a mixed version of x (the finalizer of MurmurHash3).
+inline std::uint64_t
+mix(std::uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccd;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53;
+  return x ^ (x >> 33);
+}
+
+
+// Returns the hash of an endpoint: an address of n bytes at p and
+// a port.
+inline std::uint64_t
+endpoint(Byte const* p, int n, std::uint16_t port)
+{
+  std::uint64_t h = port;
+  for (int i = 0; i < n; i += 4) {
+    std::uint32_t w;
+    std::memcpy(&w, p + i, 4);
+    h = mix(h ^ w);
+  }
+  return h;
+}
+
+
+// Returns true if the protocol carries ports at the start of its
+// header.
+inline bool
+has_ports(Byte proto)
+{
+  return proto == proto_tcp || proto == proto_udp || proto == proto_sctp;
+}
+
+} // namespace
+
+
+// Returns the worker index of the calling thread.
+int
+this_worker()
+{
+  return worker;
+}
+
+
+// Sets the worker index of the calling thread.
+void
+set_worker(int n)
+{
+  worker = n;
+}
+
+
+// Returns the hash of the 5-tuple of the Ethernet frame of n bytes
+// at p. The hash is symmetric: swapping the source and destination
+// addresses and ports gives the same value. VLAN tags are skipped.
+// Fragments and protocols without ports are hashed on addresses
+// alone, and frames that are not IP hash to 0.
+std::uint32_t
+flow_hash(Byte const* p, int n)
+{
+  if (n < ethernet_size)
+    return 0;
+  int off = 12;
+  std::uint16_t type = load16(p + off);
+  while ((type == ethertype_vlan || type == ethertype_qinq) && off + 6 <= n) {
+    off += 4;
+    type = load16(p + off);
+  }
+  off += 2;
+
+  Byte proto;
+  Byte const* src;
+  Byte const* dst;
+  int len;
+  int ports;
+  if (type == ethertype_ipv4) {
+    if (n < off + 20)
+      return 0;
+    Byte const* ip = p + off;
+    proto = ip[9];
+    src = ip + 12;
+    dst = ip + 16;
+    len = 4;
+    bool fragment = load16(ip + 6) & 0x1fff;
+    ports = fragment ? n : off + (ip[0] & 0xf) * 4;
+  } else if (type == ethertype_ipv6) {
+    if (n < off + 40)
+      return 0;
+    Byte const* ip = p + off;
+    proto = ip[6];
+    src = ip + 8;
+    dst = ip + 24;
+    len = 16;
+    ports = off + 40;
+  } else {
+    return 0;
+  }
+
+  std::uint16_t sport = 0;
+  std::uint16_t dport = 0;
+  if (has_ports(proto) && ports + 4 <= n) {
+    sport = load16(p + ports);
+    dport = load16(p + ports + 2);
+  }
+
+  // Combine the endpoints in a fixed order, so that both directions
+  // of a flow agree.
+  std::uint64_t a = endpoint(src, len, sport);
+  std::uint64_t b = endpoint(dst, len, dport);
+  std::uint64_t h = mix(std::min(a, b) ^ mix(std::max(a, b) + proto));
+  return h >> 32;
+}
+
+
+// Returns the worker, out of n, that processes the packet.
+int
+dispatch(Packet const& p, int n)
+{
+  return steer(flow_hash(p.data(), p.size()), n);
+}
+
+
+} // namespace fp
@@ -0,0 +1,46 @@
+#ifndef FP_DISPATCH_HPP
+#define FP_DISPATCH_HPP
+
+#include "types.hpp"
+
+#include <cstdint>
+
+
+namespace fp
+{
+
+struct Packet;
+
+// Flow-affine dispatch.
+//
+// A data plane with several workers, each on its own core, steers
+// every packet to a worker chosen by hashing its 5-tuple, as
+// receive side scaling (RSS) does in a NIC. All the packets of a
+// flow, in both directions, reach the same worker, so the state
+// learned for a flow can be kept where that worker alone uses it
+// (see sharded_table.hpp).
+//
+// Each thread has a worker index, which is 0 until it is set.
+
+int  this_worker();
+void set_worker(int);
+
+std::uint32_t flow_hash(Byte const*, int);
+
+
+// Returns the worker, out of n, for a packet whose flow has the
+// hash value h.
+inline int
+steer(std::uint32_t h, int n)
+{
+  return (std::uint64_t(h) * n) >> 32;
+}
+
+
+int dispatch(Packet const&, int);
+
+
+} // namespace fp
+
+
+#endif
@@ -1,8 +1,17 @@
+#ifndef FP_ENDIAN_HPP
+#define FP_ENDIAN_HPP
+
 // Module for detecting native order endianess and converting to the
 // appropriate order.
 
 #include <boost/endian/conversion.hpp>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSSE3__)
+#  include <tmmintrin.h>
+#endif
 
 #include "types.hpp"
 
@@ -10,6 +19,164 @@
 namespace fp
 {
 
+namespace endian_detail
+{
+
+// Byte swap kernels. Each reverses a block of 2, 4 or 8 bytes at p
+// and stores it at q, which may be p.
+
+inline void
+reverse_2(Byte const* p, Byte* q)
+{
+  std::uint16_t v;
+  std::memcpy(&v, p, 2);
+  v = boost::endian::endian_reverse(v);
+  std::memcpy(q, &v, 2);
+}
+
+
+inline void
+reverse_4(Byte const* p, Byte* q)
+{
+  std::uint32_t v;
+  std::memcpy(&v, p, 4);
+  v = boost::endian::endian_reverse(v);
+  std::memcpy(q, &v, 4);
+}
+
+
+inline void
+reverse_8(Byte const* p, Byte* q)
+{
+  std::uint64_t v;
+  std::memcpy(&v, p, 8);
+  v = boost::endian::endian_reverse(v);
+  std::memcpy(q, &v, 8);
+}
+
+
+// Reverses 6 bytes (e.g., a MAC address) as a 4-byte and a 2-byte
+// swap.
+inline void
+reverse_6(Byte* p)
+{
+  std::uint32_t hi;
+  std::uint16_t lo;
+  std::memcpy(&lo, p, 2);
+  std::memcpy(&hi, p + 2, 4);
+  hi = boost::endian::endian_reverse(hi);
+  lo = boost::endian::endian_reverse(lo);
+  std::memcpy(p, &hi, 4);
+  std::memcpy(p + 4, &lo, 2);
+}
+
+
+#if defined(__SSSE3__)
+
+// Returns the 16 bytes at p in reverse order (PSHUFB).
+inline __m128i
+load_reversed_16(Byte const* p)
+{
+  __m128i const mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(p)), mask);
+}
+
+#endif
+
+
+// Reverses the first and last 16 bytes of the range [lo, hi) and
+// swaps them. The blocks may overlap: both are loaded before either
+// is stored, and the bytes they share receive the same value from
+// each.
+inline void
+swap_reversed_16(Byte* lo, Byte* hi)
+{
+#if defined(__SSSE3__)
+  __m128i a = load_reversed_16(lo);
+  __m128i b = load_reversed_16(hi - 16);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lo), b);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(hi - 16), a);
+#else
+  Byte a[16], b[16];
+  reverse_8(lo, a + 8);
+  reverse_8(lo + 8, a);
+  reverse_8(hi - 16, b + 8);
+  reverse_8(hi - 8, b);
+  std::memcpy(lo, b, 16);
+  std::memcpy(hi - 16, a, 16);
+#endif
+}
+
+
+// As above, for blocks of N bytes, where N is 4 or 8.
+template<int N>
+inline void
+swap_reversed(Byte* lo, Byte* hi)
+{
+  Byte a[N], b[N];
+  if (N == 8) {
+    reverse_8(lo, a);
+    reverse_8(hi - N, b);
+  }
+  else {
+    reverse_4(lo, a);
+    reverse_4(hi - N, b);
+  }
+  std::memcpy(lo, b, N);
+  std::memcpy(hi - N, a, N);
+}
+
+
+// Reverses the bytes in [lo, hi), a block at a time from both ends,
+// so that every byte is loaded and stored once. The innermost
+// blocks may overlap.
+inline void
+reverse_range(Byte* lo, Byte* hi)
+{
+  for (; hi - lo >= 32; lo += 16, hi -= 16)
+    swap_reversed_16(lo, hi);
+
+  std::ptrdiff_t n = hi - lo;
+  if (n >= 16)
+    swap_reversed_16(lo, hi);
+  else if (n >= 8)
+    swap_reversed<8>(lo, hi);
+  else if (n >= 4)
+    swap_reversed<4>(lo, hi);
+  else if (n >= 2)
+    std::swap(lo[0], hi[-1]);
+}
+
+
+} // namespace endian_detail
+
+
+// Reverses the len bytes at buf. Common field widths use a single
+// byte swap; others (e.g., 6-byte MAC addresses, 16-byte IPv6
+// addresses) are reversed a block at a time, with PSHUFB when the
+// target supports SSSE3.
+inline void
+reverse_bytes(fp::Byte* buf, int len)
+{
+  using namespace endian_detail;
+  switch (len) {
+    case 0:
+    case 1:
+      return;
+    case 2:
+      return reverse_2(buf, buf);
+    case 4:
+      return reverse_4(buf, buf);
+    case 6:
+      return reverse_6(buf);
+    case 8:
+      return reverse_8(buf, buf);
+    default:
+      return reverse_range(buf, buf + len);
+  }
+}
+
+
 #if BOOST_BIG_ENDIAN
 
 // Big endian is network byte order so no reverse is necessary
@@ -26,20 +193,23 @@ native_to_network_order(fp::Byte* buf, int len)
 
 #else
 
-// Big endian is network byte order so no reverse is necessary
+// Little endian hosts reverse the bytes of each field.
 inline void
 network_to_native_order(fp::Byte* buf, int len)
 {
-  std::reverse(buf, buf + len);
+  reverse_bytes(buf, len);
 }
 
 
 inline void
 native_to_network_order(fp::Byte* buf, int len)
 {
-  std::reverse(buf, buf + len);
+  reverse_bytes(buf, len);
 }
 
 #endif
 
 } // namespace fp
+
+
+#endif
@@ -1,7 +1,9 @@
-
 #include "flow.hpp"
 #include "system.hpp"
 
+#include <algorithm>
+#include <new>
+
 namespace fp
 {
 
@@ -10,4 +12,160 @@ void Drop_miss(Flow*, Table*, Context* c)
   fp_drop(c);
 }
 
+
+std::atomic<std::uint32_t> Flow_counters::mask_(max_shards - 1);
+
+
+// Initialize the counters with the given counts, e.g., those of a
+// flow restored from a snapshot.
+Flow_counters::Flow_counters(Flow_stats const& s)
+  : block_(nullptr)
+{
+  if (!s.packets && !s.bytes && !s.last_hit)
+    return;
+  Shard& sh = allocate()->shard(0);
+  sh.packets.store(s.packets, std::memory_order_relaxed);
+  sh.bytes.store(s.bytes, std::memory_order_relaxed);
+  sh.last_hit.store(s.last_hit, std::memory_order_relaxed);
+}
+
+
+Flow_counters::Flow_counters(Flow_counters const& c)
+  : block_(c.block_.load(std::memory_order_acquire))
+{
+  if (Block* b = block_.load(std::memory_order_relaxed))
+    b->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+Flow_counters::Flow_counters(Flow_counters&& c) noexcept
+  : block_(c.block_.exchange(nullptr, std::memory_order_acq_rel))
+{ }
+
+
+Flow_counters::~Flow_counters()
+{
+  release();
+}
+
+
+Flow_counters&
+Flow_counters::operator=(Flow_counters const& c)
+{
+  Block* b = c.block_.load(std::memory_order_acquire);
+  if (b)
+    b->refs.fetch_add(1, std::memory_order_relaxed);
+  release();
+  block_.store(b, std::memory_order_release);
+  return *this;
+}
+
+
+Flow_counters&
+Flow_counters::operator=(Flow_counters&& c) noexcept
+{
+  if (this != &c) {
+    release();
+    block_.store(c.block_.exchange(nullptr, std::memory_order_acq_rel),
+                 std::memory_order_release);
+  }
+  return *this;
+}
+
+
+// Returns the sum of the counts in all shards.
+Flow_stats
+Flow_counters::read() const
+{
+  Flow_stats s;
+  Block* b = block_.load(std::memory_order_acquire);
+  if (!b)
+    return s;
+  for (std::uint32_t i = 0; i <= b->mask; ++i) {
+    Shard const& sh = b->shard(i);
+    s.packets += sh.packets.load(std::memory_order_relaxed);
+    s.bytes += sh.bytes.load(std::memory_order_relaxed);
+    s.last_hit = std::max(s.last_hit, sh.last_hit.load(std::memory_order_relaxed));
+  }
+  return s;
+}
+
+
+// Allocate the shards now, so that copies made from here on share
+// them.
+void
+Flow_counters::share() const
+{
+  if (!block_.load(std::memory_order_acquire))
+    allocate();
+}
+
+
+// Returns the flow's share of its counters: the size of the shards,
+// divided among the flows sharing them. Shards are only allocated
+// once a flow is hit.
+std::size_t
+Flow_counters::bytes() const
+{
+  Block* b = block_.load(std::memory_order_acquire);
+  return b ? block_size(b->mask) / b->refs.load(std::memory_order_relaxed) : 0;
+}
+
+
+// Sizes the counters allocated from now on for the given number
+// of workers. Counters that are already allocated keep their
+// shards. The data plane calls this when it is configured.
+void
+Flow_counters::set_shards(int workers)
+{
+  std::uint32_t n = next_power_of_two(std::min(std::max(workers, 1), max_shards));
+  mask_.store(n - 1, std::memory_order_relaxed);
+}
+
+
+// Returns the size of counters with the given number of shards,
+// less 1.
+std::size_t
+Flow_counters::block_size(std::uint32_t mask)
+{
+  if (!mask)
+    return sizeof(Block) + sizeof(Shard);
+  return (mask + 2) * cache_line_size;
+}
+
+
+// Allocate zeroed shards, unless another thread does so first.
+// Returns the installed shards.
+Flow_counters::Block*
+Flow_counters::allocate() const
+{
+  std::uint32_t mask = mask_.load(std::memory_order_relaxed);
+  std::size_t align = mask ? cache_line_size : alignof(Shard);
+  Block* b = ::new (allocate_aligned(block_size(mask), align)) Block;
+  b->refs.store(1, std::memory_order_relaxed);
+  b->mask = mask;
+  for (std::uint32_t i = 0; i <= mask; ++i) {
+    Shard& sh = *::new (&b->shard(i)) Shard;
+    sh.packets.store(0, std::memory_order_relaxed);
+    sh.bytes.store(0, std::memory_order_relaxed);
+    sh.last_hit.store(0, std::memory_order_relaxed);
+  }
+
+  Block* cur = nullptr;
+  if (block_.compare_exchange_strong(cur, b, std::memory_order_acq_rel))
+    return b;
+  deallocate_aligned(b);
+  return cur;
+}
+
+
+// Drop this reference to the shards.
+void
+Flow_counters::release()
+{
+  Block* b = block_.load(std::memory_order_relaxed);
+  if (b && b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    deallocate_aligned(b);
+}
+
 }
@@ -3,6 +3,10 @@
 #define FP_FLOW_HPP
 
 #include "types.hpp"
+#include "memory.hpp"
+
+#include <atomic>
+#include <cstdint>
 
 namespace fp
 {
@@ -14,57 +18,196 @@ struct Flow;
 
 // Flow instructions are a pointer to a function to
 // be executed on match.
+//
+// The flow passed to the instructions is stored in the
+// table, and is only valid until the table is next
+// modified. Instructions that add or remove flows in
+// that table (e.g., to learn a flow) must read what they
+// need from the flow before doing so.
 using Flow_instructions = void (*)(Flow*, Table*, Context*);
 
 // Default miss case.
 void Drop_miss(Flow*, Table*, Context*);
 
 
+// A snapshot of the counters of a flow.
+struct Flow_stats
+{
+  std::uint64_t packets  = 0;
+  std::uint64_t bytes    = 0;
+  std::uint64_t last_hit = 0; // Time stamp of the last matching packet
+};
+
+
 // The flow counters mantain counts on matches.
 //
-// TODO: Implement me.
+// Counts are split into per-thread shards, each on its own cache
+// line, so that threads matching the same flow do not contend for
+// it. Reading the counters merges the shards. Threads are assigned
+// shards round robin; with more threads than shards, some threads
+// share a shard, whose updates are atomic.
+//
+// There is one shard per worker of the data plane, up to
+// max_shards, rounded up to a power of two (see set_shards). With
+// a single worker, the counters are a single unpadded shard.
+//
+// Shards are allocated on the first match, so flows that never
+// match cost only a pointer. Once allocated, shards are shared by
+// every copy of the flow, and freed with the last copy. This lets
+// a table that copies its flows (e.g., when rebuilding) keep a
+// single set of counts.
 struct Flow_counters
 {
+  static constexpr int max_shards = 8;
+
+  struct Shard
+  {
+    std::atomic<std::uint64_t> packets;
+    std::atomic<std::uint64_t> bytes;
+    std::atomic<std::uint64_t> last_hit;
+  };
+
+  // The header of the shards. Several shards start on the next
+  // cache line and are a cache line apart; a single shard follows
+  // the header directly.
+  struct Block
+  {
+    std::atomic<std::uint32_t> refs;
+    std::uint32_t              mask; // The number of shards, less 1
+
+    Shard& shard(int i);
+  };
+
+  Flow_counters()
+    : block_(nullptr)
+  { }
+
+  explicit Flow_counters(Flow_stats const&);
+  Flow_counters(Flow_counters const&);
+  Flow_counters(Flow_counters&&) noexcept;
+  ~Flow_counters();
+
+  Flow_counters& operator=(Flow_counters const&);
+  Flow_counters& operator=(Flow_counters&&) noexcept;
+
+  void       hit(std::uint64_t, std::uint64_t);
+  Flow_stats read() const;
+  void       share() const;
+
+  std::size_t bytes() const;
+
+  static void set_shards(int);
+
+private:
+  Block* allocate() const;
+  void   release();
+
+  static std::size_t block_size(std::uint32_t);
+
+  // The number of shards, less 1, of newly allocated counters.
+  static std::atomic<std::uint32_t> mask_;
+
+  mutable std::atomic<Block*> block_;
 };
 
 
-// TODO: Implement me.
+// The timeouts of a flow, in seconds. A flow expires when it has
+// not matched a packet for the idle timeout, or when the hard
+// timeout has passed since it was installed, whichever comes
+// first. A timeout of 0 never expires.
 struct Flow_timeouts
 {
+  Flow_timeouts(std::uint32_t idle = 0, std::uint32_t hard = 0)
+    : idle(idle), hard(hard), created(0), timer(0)
+  { }
+
+  bool expires() const { return idle || hard; }
+
+  std::uint32_t idle;
+  std::uint32_t hard;
+  std::uint64_t created; // Time of installation, or 0 if unknown
+  std::uint64_t timer;   // Identifies the flow's pending timer
 };
 
 
 // A flow is an entry in a flow table.
+//
+// Flows are stored inline in exact tables, so their layout matters
+// for memory use and lookups. The fields used when a packet matches
+// come first, next to the key, and the fields only used to manage
+// the flow come after them. Priorities and flags are 32 bits wide,
+// as in OpenFlow, so that a flow fits in one cache line.
 struct Flow
 {
   Flow()
-    : pri_(0), count_(), instr_(Drop_miss), time_(), cookie_(0), flags_(0),
-      egress_(0)
+    : count_(), instr_(Drop_miss), egress_(0), pri_(0), time_(), cookie_(0),
+      flags_(0)
   { }
 
   Flow(std::size_t pri, Flow_counters count, Flow_instructions instr,
        Flow_timeouts time, std::size_t cookie, std::size_t flags)
-    : pri_(pri), count_(count), instr_(instr), time_(time), cookie_(cookie),
-      flags_(flags), egress_(0)
+    : count_(count), instr_(instr), egress_(0), pri_(pri), time_(time),
+      cookie_(cookie), flags_(flags)
   { }
 
   Flow(std::size_t pri, Flow_counters count, Flow_instructions instr,
        Flow_timeouts time, std::size_t cookie, std::size_t flags, unsigned int egress)
-    : pri_(pri), count_(count), instr_(instr), time_(time), cookie_(cookie),
-      flags_(flags), egress_(egress)
+    : count_(count), instr_(instr), egress_(egress), pri_(pri), time_(time),
+      cookie_(cookie), flags_(flags)
   { }
 
-  std::size_t       pri_;
+  // Used on every match.
   Flow_counters     count_;
   Flow_instructions instr_;
-  Flow_timeouts     time_;
-  std::size_t       cookie_;
-  std::size_t       flags_;
   // Maintain the port of the packet which caused this flow to be installed.
   // 0 if this was a default initialized flow.
   unsigned int      egress_;
+
+  // Used to manage the flow.
+  std::uint32_t     pri_;
+  Flow_timeouts     time_;
+  std::uint64_t     cookie_;
+  std::uint32_t     flags_;
 };
 
+static_assert(sizeof(Flow) <= cache_line_size, "flows should fit in a cache line");
+
+
+// Returns the shard used by the calling thread in counters with
+// max_shards shards. Counters with fewer shards map it onto theirs.
+inline int
+this_shard()
+{
+  static std::atomic<int> next(0);
+  thread_local int shard = next.fetch_add(1, std::memory_order_relaxed) % Flow_counters::max_shards;
+  return shard;
+}
+
+
+inline Flow_counters::Shard&
+Flow_counters::Block::shard(int i)
+{
+  Byte* p = reinterpret_cast<Byte*>(this);
+  if (!mask)
+    return *reinterpret_cast<Shard*>(p + sizeof(Block));
+  return *reinterpret_cast<Shard*>(p + (1 + i) * cache_line_size);
+}
+
+
+// Count a match of a packet of the given size at the given time.
+inline void
+Flow_counters::hit(std::uint64_t bytes, std::uint64_t time)
+{
+  Block* b = block_.load(std::memory_order_acquire);
+  if (!b)
+    b = allocate();
+  Shard& s = b->shard(this_shard() & b->mask);
+  s.packets.fetch_add(1, std::memory_order_relaxed);
+  s.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  if (s.last_hit.load(std::memory_order_relaxed) < time)
+    s.last_hit.store(time, std::memory_order_relaxed);
+}
+
 
 } // namespace fp
 
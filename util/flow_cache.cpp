@@ -0,0 +1,216 @@
+#include "flow_cache.hpp"
+#include "context.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace fp
+{
+
+constexpr int Flow_trace::max_hits;
+constexpr int Flow_trace::max_packet_size;
+constexpr int Flow_trace::header_size;
+constexpr int Flow_cache::header_size;
+constexpr int Flow_cache::bucket_size;
+
+
+Flow_cache_stats&
+Flow_cache_stats::operator+=(Flow_cache_stats const& s)
+{
+  lookups += s.lookups;
+  hits += s.hits;
+  invalidations += s.invalidations;
+  uncacheable += s.uncacheable;
+  return *this;
+}
+
+
+// Creates a cache for a pipeline with the given tables, with room
+// for n entries, rounded up to a power of 2 and at least a bucket. If mask is not null,
+// it holds header_size bytes, and only the bits set in it are part
+// of a packet's key.
+Flow_cache::Flow_cache(std::vector<Table*> const& tables, std::size_t n, Byte const* mask)
+  : tables_(tables)
+{
+  std::size_t size = bucket_size;
+  while (size < n)
+    size *= 2;
+  entries_.resize(size);
+  mask_ = size - bucket_size;
+  if (mask)
+    std::memcpy(key_mask_, mask, header_size);
+  else
+    std::memset(key_mask_, 0xff, header_size);
+}
+
+
+// Returns the sum of the versions of the pipeline's tables, which
+// changes whenever any of them is modified.
+std::uint64_t
+Flow_cache::tables_version() const
+{
+  std::uint64_t v = 0;
+  for (Table* t : tables_)
+    v += t->version();
+  return v;
+}
+
+
+// Stores the key of the packet of n bytes at p, received by the
+// context, in buf, and returns its hash. The hash covers the full
+// length of the packet.
+std::uint64_t
+Flow_cache::key(Context const& cxt, Byte const* p, int n, Byte* buf) const
+{
+  std::memset(buf, 0, header_size);
+  std::memcpy(buf, p, std::min(n, header_size));
+  for (int i = 0; i < header_size; i += 8) {
+    std::uint64_t w = load_word(buf + i) & load_word(key_mask_ + i);
+    std::memcpy(buf + i, &w, 8);
+  }
+  std::uint64_t h = hash_words<header_size / 8>(buf);
+  return hash_finish(hash_mix(h, std::uint64_t(cxt.input_port_id()) << 32 | std::uint32_t(n)));
+}
+
+
+bool
+Flow_cache::matches(Entry const& e, std::uint64_t h, unsigned int in_port, int n, Byte const* buf) const
+{
+  return e.valid && e.hash == h && e.in_port == in_port
+      && e.size == n
+      && equal_words<header_size / 8>(e.header, buf);
+}
+
+
+// Replays the outcome recorded for the context's packet, if there
+// is a valid entry for it. Returns true if the packet was
+// processed. Otherwise, starts recording the packet's outcome in
+// the trace t, and returns false; the packet must then go through
+// the pipeline.
+bool
+Flow_cache::replay(Context& cxt, Flow_trace& t)
+{
+  ++stats_.lookups;
+  Packet& pkt = cxt.packet();
+  t.hash = key(cxt, pkt.data(), pkt.size(), t.key);
+  Entry* b = &entries_[t.hash & mask_];
+  Entry* p = std::find_if(b, b + bucket_size, [&](Entry const& e) {
+    return matches(e, t.hash, cxt.input_port_id(), pkt.size(), t.key);
+  });
+  if (p == b + bucket_size) {
+    trace(cxt, t);
+    return false;
+  }
+  Entry& e = *p;
+
+  // The flows that were hit are only valid if their tables have
+  // not changed since.
+  for (int i = 0; i < e.nhits; ++i) {
+    if (e.hits[i].table->version() != e.hits[i].version) {
+      e.valid = false;
+      ++stats_.invalidations;
+      trace(cxt, t);
+      return false;
+    }
+  }
+
+  for (int i = 0; i < e.nhits; ++i)
+    e.hits[i].flow->count_.hit(pkt.size(), pkt.timestamp_);
+  for (Edit const& d : e.edits)
+    pkt.data()[d.offset] = d.value;
+  cxt.set_output_port(e.out_port);
+  cxt.actions_ = e.actions;
+  ++stats_.hits;
+  return true;
+}
+
+
+// Starts recording the outcome of the context's packet in the
+// trace t.
+void
+Flow_cache::trace(Context& cxt, Flow_trace& t)
+{
+  Packet const& pkt = cxt.packet();
+  t.tables_version = tables_version();
+  t.size = pkt.size();
+  if (t.size <= Flow_trace::max_packet_size)
+    std::memcpy(t.packet, pkt.data(), t.size);
+  else
+    t.forbid();
+  cxt.ctrl_.trace = &t;
+}
+
+
+// Records the outcome of the context's packet, traced by t, after
+// it has been processed by the pipeline.
+void
+Flow_cache::record(Context& cxt, Flow_trace& t)
+{
+  cxt.ctrl_.trace = nullptr;
+  Packet const& pkt = cxt.packet();
+  bool ok = t.cacheable && pkt.size() == t.size;
+
+  // Only rewrites of the keyed bytes can be replayed, since the
+  // rest of the packet may differ between packets sharing an entry.
+  int n = std::min(t.size, header_size);
+  if (ok)
+    ok = !std::memcmp(pkt.data() + n, t.packet + n, t.size - n);
+
+  // If the pipeline modified a table, e.g., by learning a flow,
+  // replaying the outcome would not repeat the modification.
+  if (!ok || tables_version() != t.tables_version) {
+    ++stats_.uncacheable;
+    return;
+  }
+
+  Entry& e = victim(t.hash);
+  e.hash = t.hash;
+  e.valid = true;
+  e.in_port = cxt.input_port_id();
+  e.size = t.size;
+  std::memcpy(e.header, t.key, header_size);
+
+  e.out_port = cxt.output_port_id();
+  e.actions = cxt.actions_;
+  e.edits.clear();
+  for (int i = 0; i < n; i += 8) {
+    int m = std::min(8, n - i);
+    if (!std::memcmp(pkt.data() + i, t.packet + i, m))
+      continue;
+    for (int j = i; j < i + m; ++j) {
+      if (pkt.data()[j] != t.packet[j])
+        e.edits.push_back({std::uint16_t(j), pkt.data()[j]});
+    }
+  }
+  e.nhits = t.nhits;
+  std::copy(t.hits, t.hits + t.nhits, e.hits);
+}
+
+
+// Returns the entry to replace with the one for the key with the
+// hash value h: a free entry in its bucket if there is one, or
+// else one chosen by the hash.
+Flow_cache::Entry&
+Flow_cache::victim(std::uint64_t h)
+{
+  Entry* b = &entries_[h & mask_];
+  for (int i = 0; i < bucket_size; ++i) {
+    if (!b[i].valid)
+      return b[i];
+  }
+  return b[(h >> 32) % bucket_size];
+}
+
+
+// Removes every entry.
+void
+Flow_cache::clear()
+{
+  for (Entry& e : entries_)
+    e.valid = false;
+}
+
+
+} // namespace fp
@@ -0,0 +1,173 @@
+#ifndef FP_FLOW_CACHE_HPP
+#define FP_FLOW_CACHE_HPP
+
+#include "table.hpp"
+#include "action.hpp"
+
+#include <cstdint>
+#include <vector>
+
+
+namespace fp
+{
+
+class Context;
+
+// A microflow cache in front of the pipeline.
+//
+// Most packets belong to a few long-lived flows, and every packet
+// of a flow takes the same path through the pipeline. The cache
+// records the outcome of processing the first packet of a flow:
+// the flows it hit, its output port, its action set and the bytes
+// of the packet it rewrote. Later packets with the same headers
+// replay that outcome without running the application.
+//
+// Entries are keyed on the ingress port, the length of the packet
+// and its first header_size bytes, under an optional mask. The
+// cache assumes that the outcome of a packet depends only on those
+// bytes, so bytes that vary within a flow but that the application
+// ignores (e.g., TCP sequence numbers and checksums) may be masked
+// out to improve the hit rate.
+//
+// Packets whose processing rewrites bytes past the first
+// header_size are not cached, since those bytes are not part of
+// the key.
+//
+// An entry is valid while the tables whose flows it hit are
+// unchanged (see Table::version). Packets whose processing modifies
+// a table, sends copies of the packet, or raises events are never
+// cached, since those effects cannot be replayed.
+//
+// A cache is used by a single worker.
+
+
+// Hit rate counters of a flow cache.
+struct Flow_cache_stats
+{
+  std::uint64_t lookups = 0;
+  std::uint64_t hits = 0;
+  std::uint64_t invalidations = 0; // Entries found to be stale
+  std::uint64_t uncacheable = 0;   // Packets that could not be cached
+
+  Flow_cache_stats& operator+=(Flow_cache_stats const&);
+
+  double hit_rate() const { return lookups ? (double)hits / lookups : 0; }
+};
+
+
+// Records the path of a packet through the pipeline.
+struct Flow_trace
+{
+  // The number of flow hits recorded for a packet. Packets that
+  // hit more flows are not cached.
+  static constexpr int max_hits = 8;
+
+  // The largest packet that can be cached.
+  static constexpr int max_packet_size = 2048;
+
+  // The number of packet bytes in a key.
+  static constexpr int header_size = 64;
+
+  struct Hit
+  {
+    Table*        table;
+    Flow*         flow;
+    std::uint64_t version;
+  };
+
+  void hit(Table*, Flow*);
+
+  // Marks the packet as having effects that cannot be replayed.
+  void forbid() { cacheable = false; }
+
+  Hit  hits[max_hits];
+  int  nhits = 0;
+  bool cacheable = true;
+
+  // The packet's key in the cache.
+  std::uint64_t hash;
+  Byte          key[header_size];
+
+  // The sum of the versions of the pipeline's tables.
+  std::uint64_t tables_version;
+
+  // The packet as it was before processing.
+  int  size;
+  Byte packet[max_packet_size];
+};
+
+
+// Records a hit on the flow f in the table t.
+inline void
+Flow_trace::hit(Table* t, Flow* f)
+{
+  if (nhits == max_hits) {
+    cacheable = false;
+    return;
+  }
+  hits[nhits++] = {t, f, t->version()};
+}
+
+
+class Flow_cache
+{
+public:
+  static constexpr int header_size = Flow_trace::header_size;
+
+  // The number of entries in a cache by default, and in each of
+  // its buckets. A packet's entry may be anywhere in the bucket
+  // selected by its key.
+  static constexpr std::size_t default_entries = 8192;
+  static constexpr int         bucket_size = 4;
+
+  explicit Flow_cache(std::vector<Table*> const&, std::size_t = default_entries, Byte const* = nullptr);
+
+  bool replay(Context&, Flow_trace&);
+  void record(Context&, Flow_trace&);
+  void clear();
+
+  Flow_cache_stats stats() const { return stats_; }
+
+private:
+  // A byte of the packet rewritten by the pipeline.
+  struct Edit
+  {
+    std::uint16_t offset;
+    Byte          value;
+  };
+
+  struct Entry
+  {
+    // The key.
+    std::uint64_t hash = 0;
+    bool          valid = false;
+    unsigned int  in_port;
+    int           size;
+    Byte          header[header_size];
+
+    // The outcome.
+    unsigned int      out_port;
+    Action_set        actions;
+    std::vector<Edit> edits;
+    int               nhits;
+    Flow_trace::Hit   hits[Flow_trace::max_hits];
+  };
+
+  void          trace(Context&, Flow_trace&);
+  Entry&        victim(std::uint64_t);
+  std::uint64_t tables_version() const;
+  std::uint64_t key(Context const&, Byte const*, int, Byte*) const;
+  bool          matches(Entry const&, std::uint64_t, unsigned int, int, Byte const*) const;
+
+  std::vector<Table*> const& tables_;
+  std::vector<Entry>         entries_;
+  std::size_t                mask_;
+  Byte                       key_mask_[header_size];
+  Flow_cache_stats           stats_;
+};
+
+
+} // namespace fp
+
+
+#endif
@@ -0,0 +1,56 @@
+#include "gather.hpp"
+
+#include <stdexcept>
+
+
+namespace fp
+{
+
+constexpr int Gather_plan::in_port;
+constexpr int Gather_plan::in_phy_port;
+
+
+namespace
+{
+
+// Returns the number of bytes of a key of width n that a table may
+// read: the width of the fixed key storing it, or the full key.
+int
+key_span(int n)
+{
+  if (n <= 8)
+    return 8;
+  if (n <= 40)
+    return (n + 7) & ~7;
+  if (n <= 64)
+    return 64;
+  return key_size;
+}
+
+
+} // namespace
+
+
+// Creates a plan for keys of the given width made of the given
+// fields, in order. Throws an exception if the fields do not fit in
+// the key.
+Gather_plan::Gather_plan(int key_width, std::vector<Gather_field> const& fields)
+  : width_(key_width), used_(0), span_(key_span(key_width))
+{
+  if (key_width <= 0 || key_width > (int)key_size)
+    throw std::runtime_error("invalid key width");
+  for (Gather_field const& f : fields) {
+    int n = f.width;
+    if (f.id == in_port || f.id == in_phy_port)
+      n = sizeof(unsigned int);
+    if (n <= 0)
+      throw std::runtime_error("invalid field width");
+    if (used_ + n > width_)
+      throw std::runtime_error("fields exceed the key width");
+    steps_.push_back({f.id, std::uint16_t(used_), std::uint16_t(n)});
+    used_ += n;
+  }
+}
+
+
+} // namespace fp
@@ -0,0 +1,129 @@
+#ifndef FP_GATHER_HPP
+#define FP_GATHER_HPP
+
+#include "table.hpp"
+#include "context.hpp"
+#include "endian.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace fp
+{
+
+// Gather plans.
+//
+// A key is built by concatenating the values of a list of fields,
+// each converted to native byte order (see fp_gather). The list of
+// fields is fixed at each call site, so a plan resolves it once:
+// the position of each field in the key, its width, and whether it
+// is a special field. Gathering a key then only looks up the
+// bindings of the fields, and copies each with fixed-size moves and
+// byte swaps (see endian.hpp) when its width is 1, 2, 4, 8 or 16
+// bytes.
+//
+// Only the bytes of the key that a table may read are initialized.
+// Those are the key width rounded up to the stored key width (see
+// create_exact_table).
+
+
+// A field of a gather plan and its width in bytes. The width of the
+// special fields is that of a port id.
+struct Gather_field
+{
+  int id;
+  int width;
+};
+
+
+class Gather_plan
+{
+public:
+  // Special fields: the logical and physical ingress ports.
+  static constexpr int in_port = 255;
+  static constexpr int in_phy_port = 256;
+
+  Gather_plan(int, std::vector<Gather_field> const&);
+
+  void gather(Context const&, Key&) const;
+
+  int key_width() const { return width_; }
+
+private:
+  struct Step
+  {
+    int           id;
+    std::uint16_t pos;   // Offset in the key
+    std::uint16_t width;
+  };
+
+  static void copy(Byte const*, Byte*, int);
+
+  std::vector<Step> steps_;
+  int               width_; // Key width
+  int               used_;  // Bytes written by the fields
+  int               span_;  // Bytes of the key that tables may read
+};
+
+
+// Copies the field of n bytes at p to out, in native byte order.
+inline void
+Gather_plan::copy(Byte const* p, Byte* out, int n)
+{
+  // Copy common widths with fixed-size moves.
+  switch (n) {
+    case 1:
+      *out = *p;
+      return;
+    case 2:
+      std::memcpy(out, p, 2);
+      break;
+    case 4:
+      std::memcpy(out, p, 4);
+      break;
+    case 8:
+      std::memcpy(out, p, 8);
+      break;
+    case 16:
+      std::memcpy(out, p, 16);
+      break;
+    default:
+      std::memcpy(out, p, n);
+      break;
+  }
+  network_to_native_order(out, n);
+}
+
+
+// Stores the key of the context's packet in k.
+inline void
+Gather_plan::gather(Context const& cxt, Key& k) const
+{
+  // The fields cover the first used_ bytes of the key, so only the
+  // words past them need to be cleared.
+  for (int i = used_ & ~7; i < span_; i += 8)
+    std::memset(k.data + i, 0, 8);
+
+  for (Step const& s : steps_) {
+    Byte* out = k.data + s.pos;
+    if (s.id == in_port) {
+      unsigned int p = cxt.input_port_id();
+      std::memcpy(out, &p, sizeof(p));
+    }
+    else if (s.id == in_phy_port) {
+      unsigned int p = cxt.input_physical_port_id();
+      std::memcpy(out, &p, sizeof(p));
+    }
+    else {
+      copy(cxt.get_field(cxt.get_field_binding(s.id).offset), out, s.width);
+    }
+  }
+}
+
+
+} // namespace fp
+
+
+#endif
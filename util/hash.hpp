@@ -0,0 +1,109 @@
+#ifndef FP_HASH_HPP
+#define FP_HASH_HPP
+
+// Hashing and comparison of short, fixed-width byte sequences.
+//
+// These functions operate on whole 64-bit words, so the compiler
+// can fully unroll them when the width is known. Callers are
+// responsible for ensuring that the bytes past the end of a
+// sequence that is not a multiple of 8 bytes are readable and
+// zero-filled (as they are in a Key).
+
+#include "types.hpp"
+
+#include <cstring>
+
+
+namespace fp
+{
+
+// Returns the 64-bit word at p.
+inline std::uint64_t
+load_word(Byte const* p)
+{
+  std::uint64_t w;
+  std::memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+
+// Returns the 32-bit word at p.
+inline std::uint32_t
+load_half_word(Byte const* p)
+{
+  std::uint32_t w;
+  std::memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+
+inline std::uint64_t
+rotate_left(std::uint64_t x, int n)
+{
+  return (x << n) | (x >> (64 - n));
+}
+
+
+// Mix the word w into the hash state h. This is the block step
+// of MurmurHash3.
+inline std::uint64_t
+hash_mix(std::uint64_t h, std::uint64_t w)
+{
+  w *= 0x87c37b91114253d5;
+  w = rotate_left(w, 31);
+  w *= 0x4cf5ad432745937f;
+  h ^= w;
+  return rotate_left(h, 27) * 5 + 0x52dce729;
+}
+
+
+// Finalize the hash state h so that every input bit affects
+// every output bit.
+inline std::uint64_t
+hash_finish(std::uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53;
+  h ^= h >> 33;
+  return h;
+}
+
+
+// Returns the hash of the first 4 bytes of p.
+inline std::uint64_t
+hash_half_word(Byte const* p)
+{
+  return hash_finish(hash_mix(4, load_half_word(p)));
+}
+
+
+// Returns the hash of the first N words of p.
+template<int N>
+inline std::uint64_t
+hash_words(Byte const* p)
+{
+  std::uint64_t h = N;
+  for (int i = 0; i < N; ++i)
+    h = hash_mix(h, load_word(p + 8 * i));
+  return hash_finish(h);
+}
+
+
+// Returns true when the first N words of a and b are equal.
+template<int N>
+inline bool
+equal_words(Byte const* a, Byte const* b)
+{
+  std::uint64_t d = 0;
+  for (int i = 0; i < N; ++i)
+    d |= load_word(a + 8 * i) ^ load_word(b + 8 * i);
+  return d == 0;
+}
+
+
+} // namespace fp
+
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef FP_MEMORY_HPP
+#define FP_MEMORY_HPP
+
+// Helpers for allocating memory with a specific alignment. The
+// data structures in the runtime align their storage to cache
+// lines so that a probe touches as few lines as possible.
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+
+
+namespace fp
+{
+
+// The assumed size of a cache line.
+constexpr std::size_t cache_line_size = 64;
+
+
+// Allocate n bytes aligned to the given boundary. Throws
+// bad_alloc if the memory cannot be allocated.
+inline void*
+allocate_aligned(std::size_t n, std::size_t align = cache_line_size)
+{
+  void* p = nullptr;
+  if (::posix_memalign(&p, align, n ? n : align))
+    throw std::bad_alloc();
+  return p;
+}
+
+
+// Release memory acquired by allocate_aligned.
+inline void
+deallocate_aligned(void* p)
+{
+  std::free(p);
+}
+
+
+// Blocks of at least this many bytes are mapped directly by
+// allocate_zeroed.
+constexpr std::size_t large_block_size = 1 << 20;
+
+// The assumed size of a page.
+constexpr std::size_t page_size = 4096;
+
+
+// Allocate n zero-filled bytes aligned to a cache line. Large
+// blocks are mapped directly from the operating system, which
+// zero-fills their pages as they are first touched, so the cost of
+// clearing them is spread over their use instead of being paid up
+// front. Throws bad_alloc if the memory cannot be allocated.
+inline void*
+allocate_zeroed(std::size_t n)
+{
+  if (n < large_block_size) {
+    void* p = allocate_aligned(n);
+    std::memset(p, 0, n);
+    return p;
+  }
+  void* p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    throw std::bad_alloc();
+  return p;
+}
+
+
+// Release the n bytes acquired by allocate_zeroed.
+inline void
+deallocate_zeroed(void* p, std::size_t n)
+{
+  if (n < large_block_size)
+    deallocate_aligned(p);
+  else
+    ::munmap(p, n);
+}
+
+
+// Return the whole pages of bytes [first, last) of the n bytes at p,
+// acquired by allocate_zeroed, to the operating system. Releasing a
+// large block that is no longer needed a piece at a time avoids
+// paying to unmap all of it at once. The pages read as zeros if
+// they are touched again. Small blocks are not affected.
+inline void
+release_pages(void* p, std::size_t n, std::size_t first, std::size_t last)
+{
+  if (n < large_block_size)
+    return;
+  first = (first + page_size - 1) & ~(page_size - 1);
+  last &= ~(page_size - 1);
+  if (first < last)
+    ::madvise(static_cast<char*>(p) + first, last - first, MADV_DONTNEED);
+}
+
+
+// Returns the smallest power of two not less than n.
+inline std::size_t
+next_power_of_two(std::size_t n)
+{
+  std::size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+
+} // namespace fp
+
+
+#endif
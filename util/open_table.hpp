@@ -0,0 +1,577 @@
+#ifndef FP_OPEN_TABLE_HPP
+#define FP_OPEN_TABLE_HPP
+
+#include "types.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <utility>
+
+
+namespace fp
+{
+
+// An open addressing hash table with linear probing.
+//
+// The table is split into two parallel arrays: a control array
+// holding one byte per slot and an array of entries. A control
+// byte is either empty, deleted (a tombstone), or the 7-bit
+// fingerprint of the hash value of the key stored in the slot
+// with the high bit set. Probing scans the control bytes, which
+// are packed 64 to a cache line, and only compares keys whose
+// fingerprints match. A typical hit touches one line of control
+// bytes and the line(s) holding the matching entry.
+//
+// Both arrays are aligned to cache lines. The capacity is always
+// a power of two, and the table is rehashed when the number of
+// occupied slots (including tombstones) would exceed 3/4 of the
+// capacity.
+//
+// Rehashing is incremental, so that no single insertion pays for
+// moving every entry. The insertion that triggers it allocates the
+// new arrays and keeps the old ones. Each later insertion or
+// erasure then moves the entries of a few old slots into the new
+// arrays, leaving tombstones behind so that the remaining old
+// entries can still be found. Until the old arrays are empty,
+// lookups that miss in the new arrays also probe the old ones.
+// The migration always finishes well before the new arrays fill.
+// Large arrays are mapped directly, so that allocating them does
+// not clear them up front, and the old entries are returned to the
+// system as they are migrated, so that freeing them does not stall
+// the final step.
+//
+// Pointers to values are stable until the next insertion or
+// erasure.
+template<typename K, typename V, typename H = std::hash<K>, typename E = std::equal_to<K>>
+class Open_table
+{
+public:
+  struct Entry
+  {
+    K key;
+    V value;
+  };
+
+  // Control byte values.
+  static constexpr Byte empty_slot   = 0x00;
+  static constexpr Byte deleted_slot = 0x01;
+
+  // The minimum number of slots in a table.
+  static constexpr std::size_t min_capacity = 16;
+
+  // The number of old slots migrated by each update during an
+  // incremental rehash.
+  static constexpr std::size_t migrate_step = 16;
+
+  // The number of bytes of migrated entries to accumulate before
+  // returning them to the system.
+  static constexpr std::size_t release_step = 64 * page_size;
+
+  Open_table(std::size_t n = 0, H const& h = H(), E const& e = E());
+  ~Open_table();
+
+  Open_table(Open_table const&) = delete;
+  Open_table& operator=(Open_table const&) = delete;
+
+  V*       find(K const&);
+  V const* find(K const&) const;
+  V*       find(K const&, std::size_t);
+  void     prefetch(std::size_t) const;
+
+  // Returns the first slot examined for the hash value h.
+  std::size_t home(std::size_t h) const { return h & mask_; }
+
+  std::pair<V*, bool> insert(K const&, V const&);
+  std::pair<V*, bool> insert(K const&, V const&, std::size_t);
+  bool                erase(K const&);
+  void                clear();
+  void                reserve(std::size_t);
+
+  template<typename F> void for_each(F) const;
+
+  std::size_t size() const     { return size_; }
+  std::size_t capacity() const { return mask_ + 1; }
+  bool        empty() const    { return size_ == 0; }
+  std::size_t bytes() const;
+
+  // Returns true if entries remain to be moved by a rehash.
+  bool migrating() const { return old_ctrl_ != nullptr; }
+
+  H const& hash_function() const { return hash_; }
+  E const& key_eq() const        { return eq_; }
+
+  // Direct access to the slots, used to save a table and restore it
+  // without rehashing (see snapshot.hpp). The layout identifies the
+  // meaning of the control bytes.
+  static constexpr std::uint32_t layout = 1;
+
+  static bool  occupied(Byte c) { return is_full(c); }
+  static bool  adoptable(Byte const*, std::size_t);
+  Byte const*  control() const { return ctrl_; }
+  Entry const& slot(std::size_t i) const { return slots_[i]; }
+  void         settle() { migrate(old_mask_ + 1); }
+  void         adopt(Byte*, std::size_t);
+  V*           construct(std::size_t, K const&, V const&);
+
+private:
+  static Byte fingerprint(std::size_t h) { return 0x80 | (h >> 57); }
+  static bool is_full(Byte c)            { return c & 0x80; }
+
+  // Returns the number of slots needed to hold n entries.
+  static std::size_t slots_for(std::size_t n)
+  {
+    return next_power_of_two(n + n / 3 + 1 < min_capacity ? min_capacity : n + n / 3 + 1);
+  }
+
+  static std::size_t probe(Byte const*, Entry const*, std::size_t,
+                           K const&, std::size_t, E const&);
+
+  Entry*      locate(K const&, std::size_t) const;
+  std::size_t place(std::size_t);
+  void        allocate(std::size_t);
+  void        release(Byte*, Entry*, std::size_t);
+  void        rehash(std::size_t);
+  void        start_rehash(std::size_t);
+  void        migrate(std::size_t);
+
+  Byte*       ctrl_;    // Control bytes
+  Entry*      slots_;   // Entries
+  std::size_t mask_;    // Capacity - 1
+  std::size_t size_;    // Number of live entries, old and new
+  std::size_t deleted_; // Number of tombstones
+  H           hash_;
+  E           eq_;
+
+  // The arrays being migrated by an incremental rehash.
+  Byte*       old_ctrl_;
+  Entry*      old_slots_;
+  std::size_t old_mask_;
+  std::size_t old_size_; // Number of live entries in the old arrays
+  std::size_t next_;     // The next old slot to migrate
+  std::size_t released_; // Bytes of old entries returned to the system
+};
+
+
+// Construct a table able to hold at least n entries without
+// rehashing.
+template<typename K, typename V, typename H, typename E>
+Open_table<K, V, H, E>::Open_table(std::size_t n, H const& h, E const& e)
+  : ctrl_(nullptr), slots_(nullptr), mask_(0), size_(0), deleted_(0),
+    hash_(h), eq_(e), old_ctrl_(nullptr), old_slots_(nullptr), old_mask_(0),
+    old_size_(0), next_(0), released_(0)
+{
+  allocate(slots_for(n));
+}
+
+
+template<typename K, typename V, typename H, typename E>
+Open_table<K, V, H, E>::~Open_table()
+{
+  clear();
+  release(ctrl_, slots_, mask_ + 1);
+}
+
+
+// Allocate empty storage for n slots, where n is a power of two.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::allocate(std::size_t n)
+{
+  static_assert(empty_slot == 0, "control bytes are zero-filled");
+  ctrl_ = static_cast<Byte*>(allocate_zeroed(n));
+  slots_ = static_cast<Entry*>(allocate_zeroed(n * sizeof(Entry)));
+  mask_ = n - 1;
+  deleted_ = 0;
+}
+
+
+// Release the storage of n slots.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::release(Byte* ctrl, Entry* slots, std::size_t n)
+{
+  deallocate_zeroed(ctrl, n);
+  deallocate_zeroed(slots, n * sizeof(Entry));
+}
+
+
+// Returns the index of the slot holding k, whose hash value is h,
+// in the arrays ctrl and slots with the given mask, or mask + 1 if
+// k is not present.
+template<typename K, typename V, typename H, typename E>
+inline std::size_t
+Open_table<K, V, H, E>::probe(Byte const* ctrl, Entry const* slots, std::size_t mask,
+                              K const& k, std::size_t h, E const& eq)
+{
+  Byte fp = fingerprint(h);
+  std::size_t i = h & mask;
+  while (true) {
+    Byte c = ctrl[i];
+    if (c == fp && eq(slots[i].key, k))
+      return i;
+    if (c == empty_slot)
+      return mask + 1;
+    i = (i + 1) & mask;
+  }
+}
+
+
+// Returns the entry holding k, whose hash value is h, or nullptr if
+// k is not present. During a rehash, the old arrays are searched
+// when k is not in the new ones.
+template<typename K, typename V, typename H, typename E>
+inline typename Open_table<K, V, H, E>::Entry*
+Open_table<K, V, H, E>::locate(K const& k, std::size_t h) const
+{
+  std::size_t i = probe(ctrl_, slots_, mask_, k, h, eq_);
+  if (i <= mask_)
+    return &slots_[i];
+  if (__builtin_expect(old_ctrl_ != nullptr, 0)) {
+    i = probe(old_ctrl_, old_slots_, old_mask_, k, h, eq_);
+    if (i <= old_mask_)
+      return &old_slots_[i];
+  }
+  return nullptr;
+}
+
+
+// Returns a pointer to the value associated with k, or nullptr
+// if there is no such value.
+template<typename K, typename V, typename H, typename E>
+inline V*
+Open_table<K, V, H, E>::find(K const& k)
+{
+  Entry* e = locate(k, hash_(k));
+  return e ? &e->value : nullptr;
+}
+
+
+template<typename K, typename V, typename H, typename E>
+inline V const*
+Open_table<K, V, H, E>::find(K const& k) const
+{
+  Entry const* e = locate(k, hash_(k));
+  return e ? &e->value : nullptr;
+}
+
+
+// Returns a pointer to the value associated with k, whose hash
+// value h has already been computed, or nullptr if there is no
+// such value.
+template<typename K, typename V, typename H, typename E>
+inline V*
+Open_table<K, V, H, E>::find(K const& k, std::size_t h)
+{
+  Entry* e = locate(k, h);
+  return e ? &e->value : nullptr;
+}
+
+
+// Starts loading the control bytes and the entry at the start of
+// the probe sequence for the hash value h. Looking up a batch of
+// keys by first prefetching each of them overlaps their cache
+// misses.
+template<typename K, typename V, typename H, typename E>
+inline void
+Open_table<K, V, H, E>::prefetch(std::size_t h) const
+{
+  std::size_t i = h & mask_;
+  __builtin_prefetch(&ctrl_[i]);
+  __builtin_prefetch(&slots_[i]);
+}
+
+
+// Insert the entry (k, v) if no entry with key k exists. Returns
+// a pointer to the value associated with k and true if the entry
+// was inserted.
+template<typename K, typename V, typename H, typename E>
+inline std::pair<V*, bool>
+Open_table<K, V, H, E>::insert(K const& k, V const& v)
+{
+  return insert(k, v, hash_(k));
+}
+
+
+// Insert the entry (k, v), where h is the hash value of k, if no
+// entry with key k exists.
+template<typename K, typename V, typename H, typename E>
+std::pair<V*, bool>
+Open_table<K, V, H, E>::insert(K const& k, V const& v, std::size_t h)
+{
+  Byte fp = fingerprint(h);
+
+  // Search for k, remembering the first free slot along the way.
+  std::size_t i = h & mask_;
+  std::size_t slot = mask_ + 1;
+  while (true) {
+    Byte c = ctrl_[i];
+    if (c == fp && eq_(slots_[i].key, k))
+      return {&slots_[i].value, false};
+    if (!is_full(c) && slot > mask_)
+      slot = i;
+    if (c == empty_slot)
+      break;
+    i = (i + 1) & mask_;
+  }
+  if (old_ctrl_) {
+    i = probe(old_ctrl_, old_slots_, old_mask_, k, h, eq_);
+    if (i <= old_mask_)
+      return {&old_slots_[i].value, false};
+  }
+
+  // Grow the table, or purge tombstones, when the load is too high.
+  std::size_t cap = mask_ + 1;
+  if (ctrl_[slot] == empty_slot && 4 * (size_ + deleted_ + 1) > 3 * cap) {
+    start_rehash(4 * (size_ + 1) > 2 * cap ? 2 * cap : cap);
+    slot = place(h);
+  }
+
+  if (ctrl_[slot] == deleted_slot)
+    --deleted_;
+  ::new (&slots_[slot]) Entry{k, v};
+  ctrl_[slot] = fp;
+  ++size_;
+
+  // Migration only fills free slots, so the new entry stays put.
+  if (old_ctrl_)
+    migrate(migrate_step);
+  return {&slots_[slot].value, true};
+}
+
+
+// Returns the first free slot in the probe sequence for the hash
+// value h.
+template<typename K, typename V, typename H, typename E>
+inline std::size_t
+Open_table<K, V, H, E>::place(std::size_t h)
+{
+  std::size_t i = h & mask_;
+  while (is_full(ctrl_[i]))
+    i = (i + 1) & mask_;
+  return i;
+}
+
+
+// Remove the entry with key k. Returns false if no such entry
+// exists.
+//
+// When the following slot is empty, no probe sequence can pass
+// through the erased slot, so it is marked empty instead of
+// leaving a tombstone.
+template<typename K, typename V, typename H, typename E>
+bool
+Open_table<K, V, H, E>::erase(K const& k)
+{
+  std::size_t h = hash_(k);
+  std::size_t i = probe(ctrl_, slots_, mask_, k, h, eq_);
+  if (i <= mask_) {
+    slots_[i].~Entry();
+    if (ctrl_[(i + 1) & mask_] == empty_slot) {
+      ctrl_[i] = empty_slot;
+    } else {
+      ctrl_[i] = deleted_slot;
+      ++deleted_;
+    }
+  } else {
+    if (!old_ctrl_)
+      return false;
+    i = probe(old_ctrl_, old_slots_, old_mask_, k, h, eq_);
+    if (i > old_mask_)
+      return false;
+    old_slots_[i].~Entry();
+    old_ctrl_[i] = deleted_slot;
+    --old_size_;
+  }
+  --size_;
+  if (old_ctrl_)
+    migrate(migrate_step);
+  return true;
+}
+
+
+// Remove all entries from the table.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::clear()
+{
+  migrate(old_mask_ + 1);
+  for (std::size_t i = 0; i <= mask_; ++i) {
+    if (is_full(ctrl_[i]))
+      slots_[i].~Entry();
+  }
+  std::memset(ctrl_, empty_slot, mask_ + 1);
+  size_ = 0;
+  deleted_ = 0;
+}
+
+
+// Returns the number of bytes of storage used by the table. During
+// a rehash, this includes the old arrays, less the pages of
+// migrated entries already returned to the system.
+template<typename K, typename V, typename H, typename E>
+std::size_t
+Open_table<K, V, H, E>::bytes() const
+{
+  std::size_t n = capacity() * (1 + sizeof(Entry));
+  if (old_ctrl_)
+    n += (old_mask_ + 1) * (1 + sizeof(Entry)) - released_;
+  return n;
+}
+
+
+// Ensure that the table can hold n entries without rehashing.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::reserve(std::size_t n)
+{
+  std::size_t cap = slots_for(n);
+  if (cap > mask_ + 1)
+    rehash(cap);
+}
+
+
+// Move all entries into a new table with n slots at once.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::rehash(std::size_t n)
+{
+  start_rehash(n);
+  migrate(old_mask_ + 1);
+}
+
+
+// Begin moving the entries into a new table with n slots. Any
+// rehash already in progress is finished first.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::start_rehash(std::size_t n)
+{
+  migrate(old_mask_ + 1);
+  old_ctrl_ = ctrl_;
+  old_slots_ = slots_;
+  old_mask_ = mask_;
+  old_size_ = size_;
+  next_ = 0;
+  released_ = 0;
+  allocate(n);
+}
+
+
+// Move the entries of up to n old slots into the new arrays. The
+// old slots are marked deleted so that the entries beyond them in
+// a probe sequence can still be found. The old arrays are released
+// once they are empty.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::migrate(std::size_t n)
+{
+  if (!old_ctrl_)
+    return;
+  for (std::size_t end = std::min(next_ + n, old_mask_ + 1); next_ < end; ++next_) {
+    if (!is_full(old_ctrl_[next_]))
+      continue;
+    Entry& e = old_slots_[next_];
+    std::size_t h = hash_(e.key);
+    std::size_t j = place(h);
+    if (ctrl_[j] == deleted_slot)
+      --deleted_;
+    ::new (&slots_[j]) Entry(std::move(e));
+    ctrl_[j] = fingerprint(h);
+    e.~Entry();
+    old_ctrl_[next_] = deleted_slot;
+    --old_size_;
+  }
+
+  std::size_t bytes = (old_mask_ + 1) * sizeof(Entry);
+  std::size_t done = next_ * sizeof(Entry);
+  if (done - released_ >= release_step) {
+    release_pages(old_slots_, bytes, released_, done);
+    released_ = done & ~(page_size - 1);
+  }
+
+  if (!old_size_ || next_ > old_mask_) {
+    release(old_ctrl_, old_slots_, old_mask_ + 1);
+    old_ctrl_ = nullptr;
+    old_slots_ = nullptr;
+    old_mask_ = 0;
+  }
+}
+
+
+// Returns true if the n control bytes at ctrl can be adopted: n is
+// a power of two, every byte is a valid control byte, and at least
+// one slot is empty, so that every probe sequence ends.
+template<typename K, typename V, typename H, typename E>
+bool
+Open_table<K, V, H, E>::adoptable(Byte const* ctrl, std::size_t n)
+{
+  if (!n || n & (n - 1))
+    return false;
+  bool empty = false;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (ctrl[i] == empty_slot)
+      empty = true;
+    else if (ctrl[i] != deleted_slot && !is_full(ctrl[i]))
+      return false;
+  }
+  return empty;
+}
+
+
+// Replace the contents of the table with n slots whose control
+// bytes are ctrl. The table takes ownership of ctrl, which must
+// have been acquired by allocate_zeroed and accepted by adoptable.
+// The entry of every full slot must then be supplied by construct
+// before the table is used.
+template<typename K, typename V, typename H, typename E>
+void
+Open_table<K, V, H, E>::adopt(Byte* ctrl, std::size_t n)
+{
+  Entry* slots = static_cast<Entry*>(allocate_zeroed(n * sizeof(Entry)));
+  clear();
+  release(ctrl_, slots_, mask_ + 1);
+  ctrl_ = ctrl;
+  slots_ = slots;
+  mask_ = n - 1;
+  deleted_ = std::count(ctrl, ctrl + n, Byte(deleted_slot));
+}
+
+
+// Stores the entry (k, v) in the i-th slot of an adopted table.
+template<typename K, typename V, typename H, typename E>
+inline V*
+Open_table<K, V, H, E>::construct(std::size_t i, K const& k, V const& v)
+{
+  ::new (&slots_[i]) Entry{k, v};
+  ++size_;
+  return &slots_[i].value;
+}
+
+
+// Call f(key, value) for each entry in the table.
+template<typename K, typename V, typename H, typename E>
+template<typename F>
+void
+Open_table<K, V, H, E>::for_each(F f) const
+{
+  for (std::size_t i = 0; i <= mask_; ++i) {
+    if (is_full(ctrl_[i]))
+      f(slots_[i].key, slots_[i].value);
+  }
+  if (old_ctrl_) {
+    for (std::size_t i = 0; i <= old_mask_; ++i) {
+      if (is_full(old_ctrl_[i]))
+        f(old_slots_[i].key, old_slots_[i].value);
+    }
+  }
+}
+
+
+} // namespace fp
+
+
+#endif
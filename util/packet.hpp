@@ -50,7 +50,7 @@ struct Packet
   Byte*     buf_;        // Packet buffer.
   int       size_;       // Total buffer size.
   int       bytes_;      // Total bytes in the packet.
-  uint64_t  timestamp_;  // Time of packet arrival.
+  uint64_t  timestamp_;  // Time of packet arrival in nanoseconds.
 
   // TODO: What is this used for?
   void*     buf_handle_; // [optional] port-specific buffer handle.
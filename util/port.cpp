@@ -155,6 +155,7 @@ Port_pcap::recv_offline(Context& cxt)
 
     cxt.set_input(this, this, 0);
     cxt.packet().size_ = p.captured_size();
+    cxt.packet().timestamp_ = p.timestamp().tv_sec * 1000000000ull + p.timestamp().tv_usec * 1000ull;
     std::memcpy(&cxt.packet().data()[0], p.data(), p.captured_size());
     return true;
   }
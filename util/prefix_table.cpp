@@ -0,0 +1,426 @@
+#include "prefix_table.hpp"
+
+#include <stdexcept>
+
+
+namespace fp
+{
+
+namespace
+{
+
+// Returns true when two trie entries are identical.
+inline bool
+same(Prefix_table::Entry a, Prefix_table::Entry b)
+{
+  return a.value == b.value && a.depth == b.depth && a.ext == b.ext;
+}
+
+
+// The entry for an address that is not covered by any prefix.
+constexpr Prefix_table::Entry no_entry {0, 0, 0};
+
+
+// A sentinel group index denoting the first level.
+constexpr std::uint32_t root_level = -1;
+
+} // namespace
+
+
+Prefix_table::Prefix_table(int id, int size, int k)
+  : Table(Table::PREFIX, id, k), width_(k), stride_(k < 3 ? 8 * k : 24),
+    root_(nullptr), rules_(size)
+{
+  if (k < 1 || k > max_width)
+    throw std::runtime_error("Unsupported prefix table key width");
+
+  std::size_t n = std::size_t(1) << stride_;
+  root_ = static_cast<Entry*>(allocate_aligned(n * sizeof(Entry)));
+  std::fill(root_, root_ + n, no_entry);
+  flows_.reserve(size);
+}
+
+
+Prefix_table::~Prefix_table()
+{
+  deallocate_aligned(root_);
+}
+
+
+// Returns the first len bits of the key k as a prefix.
+Prefix_table::Prefix
+Prefix_table::make_prefix(Key const& k, int len) const
+{
+  Prefix p {{0}, len};
+  for (int i = 0; i < width_; ++i)
+    p.addr[i] = byte(k, i);
+
+  // Clear the host bits.
+  int n = len / 8;
+  if (len % 8)
+    p.addr[n++] &= 0xff << (8 - len % 8);
+  std::fill(p.addr + n, p.addr + max_width, 0);
+  return p;
+}
+
+
+// Returns the entry for the longest rule that is strictly shorter
+// than p and covers it.
+Prefix_table::Entry
+Prefix_table::covering(Prefix const& p) const
+{
+  Prefix q = p;
+  while (q.len > 0) {
+    --q.len;
+    q.addr[q.len / 8] &= 0xff << (8 - q.len % 8);
+    if (std::uint32_t const* i = rules_.find(q))
+      return Entry{*i + 1, std::uint32_t(q.len), 0};
+  }
+  return no_entry;
+}
+
+
+// Returns the entries at the given level.
+inline Prefix_table::Entry*
+Prefix_table::level(std::uint32_t g)
+{
+  return g == root_level ? root_ : &groups_[g * 256];
+}
+
+
+// Allocates a group of entries, each initialized to e. Throws an
+// exception if the index of the group would not fit in an entry.
+std::uint32_t
+Prefix_table::alloc_group(Entry e)
+{
+  std::uint32_t g;
+  if (free_groups_.empty()) {
+    if (groups_.size() / 256 > max_value)
+      throw std::runtime_error("Too many groups in prefix table");
+    g = groups_.size() / 256;
+    groups_.resize(groups_.size() + 256);
+  } else {
+    g = free_groups_.back();
+    free_groups_.pop_back();
+  }
+  std::fill(level(g), level(g) + 256, e);
+  return g;
+}
+
+
+// Stores a copy of the flow f, returning its index. Throws an
+// exception if the index would not fit in an entry.
+std::uint32_t
+Prefix_table::alloc_flow(Flow const& f)
+{
+  if (free_flows_.empty()) {
+    if (flows_.size() >= max_value)
+      throw std::runtime_error("Too many flows in prefix table");
+    flows_.push_back(f);
+    return flows_.size() - 1;
+  }
+  std::uint32_t i = free_flows_.back();
+  free_flows_.pop_back();
+  flows_[i] = f;
+  return i;
+}
+
+
+// Sets the entries covered by the prefix p in level g, which
+// starts at the given bit, to e. Entries produced by longer
+// prefixes are preserved.
+void
+Prefix_table::assign(std::uint32_t g, int bit, Prefix const& p, Entry e)
+{
+  int stride = g == root_level ? stride_ : 8;
+  std::uint32_t idx = 0;
+  for (int b = bit / 8; b < (bit + stride) / 8; ++b)
+    idx = (idx << 8) | p.addr[b];
+
+  // The prefix ends in this level and covers a range of entries.
+  if (p.len <= bit + stride) {
+    std::uint32_t n = std::uint32_t(1) << (bit + stride - p.len);
+    idx &= ~(n - 1);
+    Entry* t = level(g);
+    for (std::uint32_t i = idx; i < idx + n; ++i) {
+      if (t[i].ext)
+        fill(t[i].value, p.len, e);
+      else if (t[i].depth <= p.len)
+        t[i] = e;
+    }
+    return;
+  }
+
+  // Otherwise, descend, extending the entry if needed. Note that
+  // allocating a group may invalidate pointers to groups.
+  Entry cur = level(g)[idx];
+  if (!cur.ext) {
+    std::uint32_t child = alloc_group(cur);
+    cur = Entry{child, 0, 1};
+    level(g)[idx] = cur;
+  }
+  assign(cur.value, bit + stride, p, e);
+}
+
+
+// Sets every entry in group g and its descendants produced by a
+// prefix no longer than len to e.
+void
+Prefix_table::fill(std::uint32_t g, int len, Entry e)
+{
+  Entry* t = level(g);
+  for (int i = 0; i < 256; ++i) {
+    if (t[i].ext)
+      fill(t[i].value, len, e);
+    else if (t[i].depth <= len)
+      t[i] = e;
+  }
+}
+
+
+// Replaces the entries produced by the prefix p in level g, which
+// starts at the given bit, with r.
+void
+Prefix_table::erase(std::uint32_t g, int bit, Prefix const& p, Entry r)
+{
+  int stride = g == root_level ? stride_ : 8;
+  std::uint32_t idx = 0;
+  for (int b = bit / 8; b < (bit + stride) / 8; ++b)
+    idx = (idx << 8) | p.addr[b];
+
+  if (p.len <= bit + stride) {
+    std::uint32_t n = std::uint32_t(1) << (bit + stride - p.len);
+    idx &= ~(n - 1);
+    Entry* t = level(g);
+    for (std::uint32_t i = idx; i < idx + n; ++i) {
+      if (t[i].ext) {
+        unfill(t[i].value, p.len, r);
+        collapse(g, i);
+      }
+      else if (t[i].depth == p.len) {
+        t[i] = r;
+      }
+    }
+    return;
+  }
+
+  Entry cur = level(g)[idx];
+  if (cur.ext) {
+    erase(cur.value, bit + stride, p, r);
+    collapse(g, idx);
+  }
+}
+
+
+// Replaces every entry in group g and its descendants produced by
+// a prefix of length len with r.
+void
+Prefix_table::unfill(std::uint32_t g, int len, Entry r)
+{
+  Entry* t = level(g);
+  for (int i = 0; i < 256; ++i) {
+    if (t[i].ext) {
+      unfill(t[i].value, len, r);
+      collapse(g, i);
+    }
+    else if (t[i].depth == len) {
+      t[i] = r;
+    }
+  }
+}
+
+
+// If the i-th entry of level g refers to a group whose entries
+// are all identical, replace the reference with that entry and
+// release the group.
+void
+Prefix_table::collapse(std::uint32_t g, std::uint32_t i)
+{
+  Entry& e = level(g)[i];
+  if (!e.ext)
+    return;
+  Entry* t = level(e.value);
+  for (int j = 0; j < 256; ++j) {
+    if (t[j].ext || !same(t[j], t[0]))
+      return;
+  }
+  free_groups_.push_back(e.value);
+  e = t[0];
+}
+
+
+// Adds a flow matching all bits of k.
+void
+Prefix_table::add(Key const& k, Flow const& f)
+{
+  add(k, width_ * 8, f);
+}
+
+
+// Adds a flow matching the first len bits of k, with a priority
+// of len. If the prefix is already in the table, its flow is
+// replaced. Throws an exception if the table cannot hold the
+// prefix; the table is then unchanged.
+void
+Prefix_table::add(Key const& k, int len, Flow const& f)
+{
+  assert(0 <= len && len <= width_ * 8);
+  Prefix p = make_prefix(k, len);
+  Flow g = f;
+  g.pri_ = len;
+  if (std::uint32_t* i = rules_.find(p)) {
+    flows_[*i] = g;
+    ++version_;
+    return;
+  }
+
+  // The prefix may need a new group in each level below the first.
+  std::size_t levels = len > stride_ ? (len - stride_ + 7) / 8 : 0;
+  std::size_t spare = free_groups_.size();
+  if (levels > spare && groups_.size() / 256 + (levels - spare) > std::size_t(max_value) + 1)
+    throw std::runtime_error("Too many groups in prefix table");
+
+  std::uint32_t i = alloc_flow(g);
+  rules_.insert(p, i);
+  assign(root_level, 0, p, Entry{i + 1, std::uint32_t(len), 0});
+  ++version_;
+}
+
+
+// Adds a flow matching all bits of k. This is the path taken by
+// flows that are learned or added in bulk.
+void
+Prefix_table::install(Key const& k, Flow f)
+{
+  install(k, width_ * 8, f);
+}
+
+
+// Adds a flow matching the first len bits of k. If the flow has
+// timeouts, a timer is scheduled for its expiry.
+void
+Prefix_table::install(Key const& k, int len, Flow f)
+{
+  if (!f.time_.expires()) {
+    add(k, len, f);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(timer_mutex_);
+  f.time_.created = now_.load(std::memory_order_relaxed);
+  f.time_.timer = ++last_timer_;
+  f.pri_ = len;
+  add(k, len, f);
+  schedule(k, f);
+}
+
+
+// Returns the flow for the prefix of k whose length is pri, or
+// nullptr if there is no such prefix.
+Flow*
+Prefix_table::find_flow(Key const& k, std::size_t pri)
+{
+  if (pri > std::size_t(width_ * 8))
+    return nullptr;
+  std::uint32_t const* i = rules_.find(make_prefix(k, pri));
+  return i ? &flows_[*i] : nullptr;
+}
+
+
+// Removes the flow for the prefix of k whose length is pri, if
+// any.
+void
+Prefix_table::rmv_flow(Key const& k, std::size_t pri)
+{
+  if (pri <= std::size_t(width_ * 8))
+    rmv(k, pri);
+}
+
+
+// Removes the flow matching all bits of k.
+void
+Prefix_table::rmv(Key const& k)
+{
+  rmv(k, width_ * 8);
+}
+
+
+// Removes the flow for the first len bits of k. If no such
+// prefix exists, no action is taken.
+void
+Prefix_table::rmv(Key const& k, int len)
+{
+  assert(0 <= len && len <= width_ * 8);
+  Prefix p = make_prefix(k, len);
+  std::uint32_t const* i = rules_.find(p);
+  if (!i)
+    return;
+  std::uint32_t idx = *i;
+  rules_.erase(p);
+  erase(root_level, 0, p, covering(p));
+  flows_[idx] = Flow();
+  free_flows_.push_back(idx);
+  ++version_;
+}
+
+
+// Resets the miss case to default.
+void
+Prefix_table::rmv_miss()
+{
+  miss_ = Flow();
+  ++version_;
+}
+
+
+// Appends a record for each prefix. The mask selects the bits of
+// the prefix.
+void
+Prefix_table::dump(std::vector<Flow_record>& v) const
+{
+  rules_.for_each([&](Prefix const& p, std::uint32_t i) {
+    // Prefixes are stored most significant byte first. Undo the
+    // reordering done by byte().
+    Byte value[max_width];
+    Byte mask[max_width];
+    for (int j = 0; j < width_; ++j) {
+#if BOOST_BIG_ENDIAN
+      int pos = j;
+#else
+      int pos = width_ - 1 - j;
+#endif
+      int n = p.len - 8 * j;
+      value[pos] = p.addr[j];
+      mask[pos] = n >= 8 ? 0xff : n <= 0 ? 0 : 0xff << (8 - n);
+    }
+    Flow const& f = flows_[i];
+    v.push_back({Key(value, width_), Key(mask, width_), f.pri_, f.cookie_, f.count_.read()});
+  });
+}
+
+
+// Returns the number of bytes used by the trie and its flows.
+std::size_t
+Prefix_table::bytes() const
+{
+  return (std::size_t(1) << stride_) * sizeof(Entry)
+       + groups_.capacity() * sizeof(Entry)
+       + flows_.capacity() * sizeof(Flow);
+}
+
+
+// Returns the memory used by the trie, the flows and the map of
+// prefixes to flows.
+Table_memory
+Prefix_table::memory() const
+{
+  Table_memory m = Table::memory();
+  m.flows += rules_.size();
+  m.bytes += bytes() + rules_.bytes();
+  for (Flow const& f : flows_)
+    m.bytes += f.count_.bytes();
+  return m;
+}
+
+
+} // namespace fp
@@ -0,0 +1,193 @@
+#ifndef FP_PREFIX_TABLE_HPP
+#define FP_PREFIX_TABLE_HPP
+
+#include "table.hpp"
+
+#include <boost/endian/conversion.hpp>
+
+#include <vector>
+
+
+namespace fp
+{
+
+// A longest prefix match table.
+//
+// The table is a multibit trie in the style of DIR-24-8. The
+// first level is indexed by the 24 most significant bits of the
+// key and each subsequent level by the next 8 bits. An IPv4
+// lookup therefore takes at most two memory accesses, and an IPv6
+// lookup at most 14. Every entry records the length of the prefix
+// that produced it so that longer prefixes are never overwritten
+// by shorter ones.
+//
+// Keys are treated as unsigned integers in native byte order, as
+// produced by fp_gather. Prefixes are taken from the most
+// significant bits of that integer. Keys may be up to 16 bytes
+// wide (an IPv6 address).
+//
+// The trie is derived from a set of rules (prefix, length) that
+// is kept alongside it. Removing a prefix restores the entries it
+// covered to the next longest rule that covers them. The priority
+// of a flow is the length of its prefix, which identifies the flow
+// together with its key (see find_flow).
+struct Prefix_table : Table
+{
+  // The maximum key width in bytes.
+  static constexpr int max_width = 16;
+
+  // The largest value of an entry, which bounds the number of
+  // groups and flows in the table.
+  static constexpr std::uint32_t max_value = (1u << 23) - 1;
+
+  // An entry in the trie. If ext is set, value is the index of a
+  // group of 256 entries in the next level. Otherwise value is
+  // one plus the index of the matched flow, or 0 when no prefix
+  // covers the entry, and depth is the length of that prefix.
+  struct Entry
+  {
+    std::uint32_t value : 23;
+    std::uint32_t depth : 8;
+    std::uint32_t ext   : 1;
+  };
+
+  // A prefix of an address. The address is stored with its most
+  // significant byte first and the bits past len cleared.
+  struct Prefix
+  {
+    Byte addr[max_width];
+    int  len;
+  };
+
+  struct Prefix_hash
+  {
+    std::size_t operator()(Prefix const& p) const
+    {
+      return hash_finish(hash_mix(hash_words<2>(p.addr), p.len));
+    }
+  };
+
+  struct Prefix_equal
+  {
+    bool operator()(Prefix const& a, Prefix const& b) const
+    {
+      return a.len == b.len && equal_words<2>(a.addr, b.addr);
+    }
+  };
+
+  using Rule_map = Open_table<Prefix, std::uint32_t, Prefix_hash, Prefix_equal>;
+
+  Prefix_table(int id, int size, int k);
+  ~Prefix_table();
+
+  Flow* search(Key const&);
+
+  void add(Key const&, Flow const&);
+  void add(Key const&, int, Flow const&);
+  void rmv(Key const&);
+  void rmv(Key const&, int);
+  void rmv_miss();
+
+  using Table::find_flow;
+  using Table::rmv_flow;
+  Flow* find_flow(Key const&, std::size_t);
+  void  rmv_flow(Key const&, std::size_t);
+
+  void install(Key const&, Flow);
+  void install(Key const&, int, Flow);
+
+  void dump(std::vector<Flow_record>&) const;
+
+  Table_memory memory() const;
+
+  // Returns the number of prefixes in the table.
+  std::size_t size() const { return rules_.size(); }
+
+  // Returns the number of groups allocated below the first level.
+  std::size_t groups() const { return groups_.size() / 256 - free_groups_.size(); }
+
+  // Returns the number of bytes used by the trie.
+  std::size_t bytes() const;
+
+private:
+  std::uint32_t lookup(Key const&) const;
+  Byte          byte(Key const&, int) const;
+
+  Prefix make_prefix(Key const&, int) const;
+  Entry  covering(Prefix const&) const;
+
+  Entry* level(std::uint32_t);
+  void   assign(std::uint32_t, int, Prefix const&, Entry);
+  void   fill(std::uint32_t, int, Entry);
+  void   erase(std::uint32_t, int, Prefix const&, Entry);
+  void   unfill(std::uint32_t, int, Entry);
+  void   collapse(std::uint32_t, std::uint32_t);
+
+  std::uint32_t alloc_group(Entry);
+  std::uint32_t alloc_flow(Flow const&);
+
+  int    width_;  // Key width in bytes
+  int    stride_; // Bits in the first level
+  Entry* root_;   // The first level
+
+  std::vector<Entry>         groups_;      // Groups of 256 entries
+  std::vector<std::uint32_t> free_groups_;
+  std::vector<Flow>          flows_;
+  std::vector<std::uint32_t> free_flows_;
+  Rule_map                   rules_;       // Maps prefixes to flows
+};
+
+
+// Returns the i-th most significant byte of the key k.
+inline Byte
+Prefix_table::byte(Key const& k, int i) const
+{
+#if BOOST_BIG_ENDIAN
+  return k.data[i];
+#else
+  return k.data[width_ - 1 - i];
+#endif
+}
+
+
+// Returns one plus the index of the flow matching k, or 0 if no
+// prefix matches.
+inline std::uint32_t
+Prefix_table::lookup(Key const& k) const
+{
+  // Fast path for IPv4.
+  if (width_ == 4) {
+    std::uint32_t a = load_half_word(k.data);
+    Entry e = root_[a >> 8];
+    if (e.ext)
+      e = groups_[e.value * 256 + (a & 0xff)];
+    return e.value;
+  }
+
+  std::uint32_t i = 0;
+  int n = stride_ / 8;
+  for (int b = 0; b < n; ++b)
+    i = (i << 8) | byte(k, b);
+  Entry e = root_[i];
+  while (e.ext)
+    e = groups_[e.value * 256 + byte(k, n++)];
+  return e.value;
+}
+
+
+// Returns the flow with the longest prefix matching k, or the
+// table-miss flow if no prefix matches.
+inline Flow*
+Prefix_table::search(Key const& k)
+{
+  if (std::uint32_t i = lookup(k))
+    return &flows_[i - 1];
+  else
+    return &miss_;
+}
+
+
+} // namespace fp
+
+
+#endif
@@ -0,0 +1,195 @@
+#include "rcu.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <vector>
+
+
+namespace fp
+{
+
+namespace
+{
+
+// The epoch last observed by a reader thread.
+struct alignas(cache_line_size) Reader
+{
+  std::atomic<std::uint64_t> seen;
+};
+
+
+// Memory waiting for readers to pass a quiescent state. It may be
+// freed once every reader has seen a later epoch.
+struct Retired
+{
+  void*         ptr;
+  void        (*free)(void*);
+  std::uint64_t epoch;
+};
+
+
+// Reclaim memory after this many retirements, or once this many
+// bytes have been retired since the last collection.
+constexpr std::size_t reclaim_interval = 64;
+constexpr std::size_t reclaim_bytes = 1 << 20;
+
+
+// The global state. Readers and retired memory are guarded by the
+// mutex.
+struct Domain
+{
+  std::atomic<std::uint64_t> epoch {1};
+  std::mutex                 mutex;
+  std::vector<Reader*>       readers;
+  std::vector<Retired>       retired;
+  std::size_t                bytes = 0; // Retired since the last collection
+};
+
+
+Domain&
+domain()
+{
+  static Domain d;
+  return d;
+}
+
+
+// Removes the memory that can be freed from the retired list and
+// returns it. The caller must hold the lock.
+std::vector<Retired>
+collect(Domain& d)
+{
+  std::uint64_t min = std::numeric_limits<std::uint64_t>::max();
+  for (Reader* r : d.readers)
+    min = std::min(min, r->seen.load());
+
+  auto mid = std::partition(d.retired.begin(), d.retired.end(),
+                            [min](Retired const& r) { return r.epoch >= min; });
+  std::vector<Retired> done(mid, d.retired.end());
+  d.retired.erase(mid, d.retired.end());
+  d.bytes = 0;
+  return done;
+}
+
+
+void
+release(std::vector<Retired> const& done)
+{
+  for (Retired const& r : done)
+    r.free(r.ptr);
+}
+
+
+// The registration of the calling thread.
+struct Registration
+{
+  ~Registration()
+  {
+    if (reader)
+      rcu_leave();
+  }
+
+  Reader* reader = nullptr;
+};
+
+thread_local Registration self;
+
+} // namespace
+
+
+// Registers the calling thread as a reader.
+void
+rcu_enter()
+{
+  if (self.reader)
+    return;
+  Domain& d = domain();
+  Reader* r = ::new (allocate_aligned(sizeof(Reader))) Reader;
+  r->seen.store(d.epoch.load());
+  std::lock_guard<std::mutex> lock(d.mutex);
+  d.readers.push_back(r);
+  self.reader = r;
+}
+
+
+// Unregisters the calling thread. It must not hold pointers into
+// concurrent data structures.
+void
+rcu_leave()
+{
+  if (!self.reader)
+    return;
+  Domain& d = domain();
+  std::vector<Retired> done;
+  {
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.readers.erase(std::find(d.readers.begin(), d.readers.end(), self.reader));
+    done = collect(d);
+  }
+  self.reader->~Reader();
+  deallocate_aligned(self.reader);
+  self.reader = nullptr;
+  release(done);
+}
+
+
+// Announces that the calling thread holds no pointers into
+// concurrent data structures. Registers the thread if needed.
+void
+rcu_quiescent()
+{
+  if (self.reader)
+    self.reader->seen.store(domain().epoch.load());
+  else
+    rcu_enter();
+}
+
+
+// Retires the object p, which owns n bytes and will be released by
+// calling free(p) once no reader can refer to it.
+void
+rcu_retire(void* p, void (*free)(void*), std::size_t n)
+{
+  Domain& d = domain();
+  std::vector<Retired> done;
+  {
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.retired.push_back({p, free, d.epoch.fetch_add(1)});
+    d.bytes += n;
+    if (d.retired.size() % reclaim_interval == 0 || d.bytes >= reclaim_bytes)
+      done = collect(d);
+  }
+  release(done);
+}
+
+
+// Releases all retired objects that are no longer referenced.
+void
+rcu_reclaim()
+{
+  Domain& d = domain();
+  std::vector<Retired> done;
+  {
+    std::lock_guard<std::mutex> lock(d.mutex);
+    done = collect(d);
+  }
+  release(done);
+}
+
+
+// Returns the number of retired objects not yet released.
+std::size_t
+rcu_pending()
+{
+  Domain& d = domain();
+  std::lock_guard<std::mutex> lock(d.mutex);
+  return d.retired.size();
+}
+
+
+} // namespace fp
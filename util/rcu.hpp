@@ -0,0 +1,53 @@
+#ifndef FP_RCU_HPP
+#define FP_RCU_HPP
+
+// Quiescent state based reclamation, in the style of RCU.
+//
+// Concurrent data structures publish new versions of their state
+// with atomic stores, and readers access them without locks. Memory
+// that writers unlink cannot be freed immediately, since readers
+// may still hold pointers into it. Instead, it is retired, and
+// freed once every reader thread has passed through a quiescent
+// state: a point at which it holds no such pointers.
+//
+// A thread becomes a reader by calling rcu_enter(). It must then
+// call rcu_quiescent() regularly. The data plane does so before
+// each packet, entering if needed, so that flows returned by a
+// lookup remain valid while the packet is processed. A thread
+// that stops reading for a long time should call rcu_leave(), or
+// it will hold back the reclamation of memory. Threads leave
+// automatically on exit.
+//
+// Retired memory is collected every reclaim_interval retirements,
+// or sooner once reclaim_bytes have been retired since the last
+// collection, so that large objects (e.g., a decision tree) do not
+// accumulate.
+
+#include <cstddef>
+
+
+namespace fp
+{
+
+void rcu_enter();
+void rcu_leave();
+void rcu_quiescent();
+
+void rcu_retire(void*, void (*)(void*), std::size_t = 0);
+void rcu_reclaim();
+std::size_t rcu_pending();
+
+
+// Retires an object allocated with new, which owns n bytes.
+template<typename T>
+inline void
+rcu_retire(T* p, std::size_t n = sizeof(T))
+{
+  rcu_retire(p, [](void* q) { delete static_cast<T*>(q); }, n);
+}
+
+
+} // namespace fp
+
+
+#endif
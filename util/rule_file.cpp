@@ -0,0 +1,230 @@
+#include "rule_file.hpp"
+#include "table.hpp"
+#include "application.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace fp
+{
+
+namespace
+{
+
+// The values of hex digits, indexed by character, or -1 for
+// characters that are not hex digits.
+struct Hex_digits
+{
+  Hex_digits()
+  {
+    for (int c = 0; c < 256; ++c)
+      value[c] = -1;
+    for (int c = 0; c < 10; ++c)
+      value['0' + c] = c;
+    for (int c = 0; c < 6; ++c)
+      value['a' + c] = value['A' + c] = 10 + c;
+  }
+
+  signed char value[256];
+};
+
+Hex_digits const hex_digits;
+
+
+// Returns the value of the hex digit c, or -1 if c is not one.
+inline int
+hex_digit(char c)
+{
+  return hex_digits.value[static_cast<unsigned char>(c)];
+}
+
+
+inline bool
+is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+// Parses rule files, resolving instructions by name.
+struct Rule_parser
+{
+  Rule_parser(int n, void* lib)
+    : key_size(n), lib(lib), line(0)
+  { }
+
+  bool parse(char const*, char const*, Byte*, Flow&);
+
+  [[noreturn]] void error(char const*) const;
+
+  // Returns the next field of the line at or after p, and advances
+  // p past it. Returns an empty field at the end of the line.
+  std::pair<char const*, char const*> field(char const*& p, char const* end) const
+  {
+    while (p != end && is_space(*p))
+      ++p;
+    char const* first = p;
+    while (p != end && !is_space(*p))
+      ++p;
+    return {first, p};
+  }
+
+  std::uint32_t number(std::pair<char const*, char const*>) const;
+  Flow_instructions instructions(std::pair<char const*, char const*>);
+
+  int         key_size;
+  void*       lib;
+  std::size_t line;
+
+  // Resolved instructions, and the most recent ones, since rules
+  // for the same instructions tend to be listed together.
+  std::unordered_map<std::string, Flow_instructions> instrs;
+  std::string       last_name;
+  Flow_instructions last_instr = nullptr;
+};
+
+
+[[noreturn]] void
+Rule_parser::error(char const* msg) const
+{
+  throw std::runtime_error("rule file:" + std::to_string(line) + ": " + msg);
+}
+
+
+// Returns the value of a decimal field, or 0 if the field is
+// empty. Every numeric field is stored in 32 bits, so larger
+// values are rejected before they can wrap.
+std::uint32_t
+Rule_parser::number(std::pair<char const*, char const*> f) const
+{
+  std::uint64_t n = 0;
+  for (char const* p = f.first; p != f.second; ++p) {
+    if (*p < '0' || *p > '9')
+      error("invalid number");
+    n = n * 10 + (*p - '0');
+    if (n > UINT32_MAX)
+      error("number out of range");
+  }
+  return n;
+}
+
+
+// Returns the instructions named by the field f.
+Flow_instructions
+Rule_parser::instructions(std::pair<char const*, char const*> f)
+{
+  if (last_instr && last_name.compare(0, std::string::npos, f.first, f.second - f.first) == 0)
+    return last_instr;
+
+  last_name.assign(f.first, f.second);
+  auto iter = instrs.find(last_name);
+  if (iter != instrs.end()) {
+    last_instr = iter->second;
+    return last_instr;
+  }
+  void* sym = resolve_symbol(lib, last_name.c_str());
+  if (!sym)
+    error("unknown instructions");
+  last_instr = reinterpret_cast<Flow_instructions>(sym);
+  instrs.emplace(last_name, last_instr);
+  return last_instr;
+}
+
+
+// Parses the line [p, end) of a rule file into the key at k and
+// the flow f. Returns false if the line holds no rule.
+bool
+Rule_parser::parse(char const* p, char const* end, Byte* k, Flow& f)
+{
+  ++line;
+  auto key = field(p, end);
+  if (key.first == key.second || *key.first == '#')
+    return false;
+
+  if (key.second - key.first != 2 * key_size)
+    error("key does not match the table's key width");
+  for (int i = 0; i < key_size; ++i) {
+    int hi = hex_digit(key.first[2 * i]);
+    int lo = hex_digit(key.first[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      error("invalid key");
+    k[i] = hi << 4 | lo;
+  }
+
+  auto name = field(p, end);
+  if (name.first == name.second)
+    error("missing instructions");
+  Flow_instructions instr = instructions(name);
+  std::uint32_t pri = number(field(p, end));
+  std::uint32_t timeout = number(field(p, end));
+  std::uint32_t egress = number(field(p, end));
+  std::uint32_t hard = number(field(p, end));
+  if (field(p, end).first != end)
+    error("too many fields");
+
+  f.pri_ = pri;
+  f.instr_ = instr;
+  f.time_ = Flow_timeouts(timeout, hard);
+  f.egress_ = egress;
+  return true;
+}
+
+} // namespace
+
+
+// Reads the rules in the stream and adds them to the table, in
+// batches of rule_batch_size. Instructions are resolved against
+// the library with the given handle, then the runtime. Returns the
+// number of rules added. Throws an exception at the first invalid
+// rule; the rules of earlier batches remain in the table.
+//
+// The stream is read in large blocks, and lines are parsed in
+// place.
+std::size_t
+load_rules(Table& tbl, std::istream& is, void* lib)
+{
+  constexpr std::size_t block_size = 1 << 20;
+
+  Rule_parser parser(tbl.key_size(), lib);
+  std::vector<Byte> keys(rule_batch_size * tbl.key_size());
+  std::vector<Flow> flows(rule_batch_size);
+  std::size_t total = 0;
+  std::size_t n = 0;
+
+  // Each block holds the partial line left over from the previous
+  // one, followed by newly read bytes.
+  std::vector<char> buf(block_size);
+  std::size_t held = 0;
+  while (is) {
+    if (held == buf.size())
+      buf.resize(2 * buf.size());
+    is.read(buf.data() + held, buf.size() - held);
+    std::size_t len = held + is.gcount();
+    if (!is && len < buf.size())
+      buf[len++] = '\n';
+
+    char const* p = buf.data();
+    char const* end = p + len;
+    while (char const* eol = static_cast<char const*>(std::memchr(p, '\n', end - p))) {
+      if (parser.parse(p, eol, &keys[n * tbl.key_size()], flows[n]) && ++n == rule_batch_size) {
+        tbl.add_bulk(keys.data(), flows.data(), n);
+        total += n;
+        n = 0;
+      }
+      p = eol + 1;
+    }
+    held = end - p;
+    std::memmove(buf.data(), p, held);
+  }
+  tbl.add_bulk(keys.data(), flows.data(), n);
+  return total + n;
+}
+
+
+} // namespace fp
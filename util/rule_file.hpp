@@ -0,0 +1,38 @@
+#ifndef FP_RULE_FILE_HPP
+#define FP_RULE_FILE_HPP
+
+#include <cstddef>
+#include <iosfwd>
+
+
+namespace fp
+{
+
+struct Table;
+
+// Rule files.
+//
+// A rule file lists the flows of an exact table, one per line:
+//
+//    <key> <instructions> [ <priority> [ <timeout> [ <egress> [ <hard> ] ] ] ]
+//
+// The key is written in hex, two digits per byte, and must be as
+// wide as the table's key. The instructions are the name of a
+// function in the application or the runtime. The timeout is the
+// idle timeout and hard is the hard timeout, both in seconds.
+// Omitted fields are 0. Blank lines and lines starting with '#' are ignored.
+//
+// Rules are streamed from the file and added to the table in
+// batches, so that large files are loaded without holding every
+// rule in memory and without rehashing the table for every rule.
+
+// The number of rules added to the table at once.
+constexpr std::size_t rule_batch_size = 4096;
+
+std::size_t load_rules(Table&, std::istream&, void*);
+
+
+} // namespace fp
+
+
+#endif
@@ -0,0 +1,258 @@
+#include "sharded_table.hpp"
+
+
+namespace fp
+{
+
+// Creates a table with the given shards, one for each worker, and
+// takes ownership of them.
+Sharded_table::Sharded_table(int id, int key_size, std::vector<Table*> const& tables)
+  : Table(EXACT, id, key_size)
+{
+  shards_.reserve(tables.size());
+  for (Table* t : tables)
+    shards_.emplace_back(new Shard(t));
+}
+
+
+Sharded_table::~Sharded_table()
+{ }
+
+
+// Returns the flow matching the key in the calling worker's shard,
+// or the table-miss flow. Updates posted to the shard are applied
+// first.
+Flow*
+Sharded_table::search(Key const& k)
+{
+  Table& t = sync();
+  Flow* f = t.search(k);
+  return f == &t.miss_ ? &miss_ : f;
+}
+
+
+void
+Sharded_table::search_burst(Key const* keys, Flow** out, int n)
+{
+  Table& t = sync();
+  t.search_burst(keys, out, n);
+  for (int i = 0; i < n; ++i) {
+    if (out[i] == &t.miss_)
+      out[i] = &miss_;
+  }
+}
+
+
+// Adds the flow to every shard.
+void
+Sharded_table::add(Key const& k, Flow const& f)
+{
+  broadcast({Update::ADD, k, f, 0});
+}
+
+
+// Removes the flows for the key from every shard.
+void
+Sharded_table::rmv(Key const& k)
+{
+  broadcast({Update::RMV, k, Flow(), 0});
+}
+
+
+void
+Sharded_table::rmv_miss()
+{
+  miss_ = Flow();
+  ++version_;
+}
+
+
+// Returns the flow for the key with the given priority in the
+// calling worker's shard.
+Flow*
+Sharded_table::find_flow(Key const& k, std::size_t pri)
+{
+  return sync().find_flow(k, pri);
+}
+
+
+void
+Sharded_table::rmv_flow(Key const& k, std::size_t pri)
+{
+  broadcast({Update::RMV_FLOW, k, Flow(), pri});
+}
+
+
+void
+Sharded_table::set_filter(bool on)
+{
+  broadcast({Update::SET_FILTER, Key(), Flow(), on});
+}
+
+
+void
+Sharded_table::rebuild_filter()
+{
+  broadcast({Update::REBUILD_FILTER, Key(), Flow(), 0});
+}
+
+
+// Returns the filter statistics summed over the shards. The shards
+// are read without synchronization, so the result is only exact
+// while the workers are idle.
+Filter_stats
+Sharded_table::filter_stats() const
+{
+  Filter_stats s;
+  for (auto const& shard : shards_) {
+    Filter_stats t = shard->table->filter_stats();
+    s.lookups += t.lookups;
+    s.negatives += t.negatives;
+    s.false_positives += t.false_positives;
+    s.bytes += t.bytes;
+  }
+  return s;
+}
+
+
+// Installs the flow, with its timeouts, in every shard. Each shard
+// expires its copy separately.
+void
+Sharded_table::install(Key const& k, Flow f)
+{
+  broadcast({Update::INSTALL, k, f, 0});
+}
+
+
+// Installs a flow learned by the calling worker in its own shard
+// only. Only packets steered to that worker can match it.
+void
+Sharded_table::learn(Key const& k, Flow f)
+{
+  sync().install(k, f);
+}
+
+
+// Expires the flows of the calling worker's shard.
+void
+Sharded_table::expire(std::uint64_t now)
+{
+  sync().expire(now);
+  Table::expire(now);
+}
+
+
+// Returns the version of the calling worker's shard. This also
+// changes with the table-miss flow, and as soon as an update is
+// broadcast, before the shard applies it.
+std::uint64_t
+Sharded_table::version() const
+{
+  return local().table->version() + Table::version();
+}
+
+
+// Appends the flows of every shard. Flows that were broadcast
+// appear once for each shard. The shards are read without
+// synchronization, so this is only safe while the workers are idle.
+void
+Sharded_table::dump(std::vector<Flow_record>& v) const
+{
+  for (auto const& shard : shards_)
+    shard->table->dump(v);
+}
+
+
+// Returns the memory used by every shard. Flows that were broadcast
+// are counted once for each shard. As with dump, this is only safe
+// while the workers are idle.
+Table_memory
+Sharded_table::memory() const
+{
+  Table_memory m = Table::memory();
+  for (auto const& shard : shards_) {
+    Table_memory t = shard->table->memory();
+    m.flows += t.flows;
+    m.bytes += t.bytes + sizeof(Shard);
+  }
+  return m;
+}
+
+
+// Returns the calling worker's shard, after applying the updates
+// posted to it.
+Table&
+Sharded_table::sync()
+{
+  Shard& s = local();
+  drain(s);
+  return *s.table;
+}
+
+
+// Applies the update to the calling worker's shard, and posts it to
+// the others.
+void
+Sharded_table::broadcast(Update const& u)
+{
+  int self = this_worker();
+  for (int i = 0; i < (int)shards_.size(); ++i) {
+    Shard& s = *shards_[i];
+    if (i == self) {
+      drain(s);
+      apply(*s.table, u);
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.updates.push_back(u);
+    s.pending.store(true, std::memory_order_release);
+  }
+  ++version_;
+}
+
+
+void
+Sharded_table::apply(Table& t, Update const& u)
+{
+  switch (u.op) {
+  case Update::ADD:
+    t.add(u.key, u.flow);
+    break;
+  case Update::INSTALL:
+    t.install(u.key, u.flow);
+    break;
+  case Update::RMV:
+    t.rmv(u.key);
+    break;
+  case Update::RMV_FLOW:
+    t.rmv_flow(u.key, u.pri);
+    break;
+  case Update::SET_FILTER:
+    t.set_filter(u.pri);
+    break;
+  case Update::REBUILD_FILTER:
+    t.rebuild_filter();
+    break;
+  }
+}
+
+
+// Applies the updates posted to the shard, in the order they were
+// posted. This is cheap when there are none.
+void
+Sharded_table::drain(Shard& s)
+{
+  if (!s.pending.load(std::memory_order_acquire))
+    return;
+  std::vector<Update> updates;
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    updates.swap(s.updates);
+    s.pending.store(false, std::memory_order_relaxed);
+  }
+  for (Update const& u : updates)
+    apply(*s.table, u);
+}
+
+
+} // namespace fp
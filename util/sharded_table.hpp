@@ -0,0 +1,117 @@
+#ifndef FP_SHARDED_TABLE_HPP
+#define FP_SHARDED_TABLE_HPP
+
+#include "table.hpp"
+#include "dispatch.hpp"
+#include "memory.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace fp
+{
+
+// An exact match table with a separate shard for each worker.
+//
+// Packets are steered to workers by flow (see dispatch.hpp), so the
+// flows a worker learns are only ever looked up by that worker. Each
+// worker looks up and learns flows in its own shard, an ordinary
+// table that no other thread touches, so neither takes a lock or
+// writes to memory shared with another core.
+//
+// Flows that must be seen by every worker (e.g., those added when
+// the application is loaded, or by the control path) are broadcast.
+// A broadcast update is applied at once to the shard of the calling
+// thread, and posted to the other shards, whose workers apply it
+// before their next lookup. Until then, those workers may still see
+// the old state. A thread
+// that updates tables while the workers run, but is not one of
+// them, should set a worker index of its own (e.g., the number of
+// workers) so that it posts every update.
+//
+// Each shard keeps its own counters and timers, and a worker expires
+// only the flows in its own shard. The table-miss flow is shared.
+struct Sharded_table : Table
+{
+  Sharded_table(int, int, std::vector<Table*> const&);
+  ~Sharded_table();
+
+  Flow* search(Key const&);
+  void  search_burst(Key const*, Flow**, int);
+  void  add(Key const&, Flow const&);
+  void  rmv(Key const&);
+  void  rmv_miss();
+
+  using Table::find_flow;
+  using Table::rmv_flow;
+  Flow* find_flow(Key const&, std::size_t);
+  void  rmv_flow(Key const&, std::size_t);
+
+  void         set_filter(bool);
+  void         rebuild_filter();
+  Filter_stats filter_stats() const;
+
+  void install(Key const&, Flow);
+  void learn(Key const&, Flow);
+  void expire(std::uint64_t);
+
+  std::uint64_t version() const;
+
+  void dump(std::vector<Flow_record>&) const;
+
+  Table_memory memory() const;
+
+  // Returns the number of shards.
+  int shards() const { return shards_.size(); }
+
+  // Returns the shard of the given worker.
+  Table* shard(int n) const { return shards_[n]->table.get(); }
+
+private:
+  // An update broadcast to every shard.
+  struct Update
+  {
+    enum Op { ADD, INSTALL, RMV, RMV_FLOW, SET_FILTER, REBUILD_FILTER };
+
+    Op          op;
+    Key         key;
+    Flow        flow;
+    std::size_t pri;
+  };
+
+  // A shard and the updates posted to it.
+  struct alignas(cache_line_size) Shard
+  {
+    explicit Shard(Table* t)
+      : table(t), pending(false)
+    { }
+
+    // Shards are cache line aligned, so that workers do not share
+    // lines.
+    static void* operator new(std::size_t n) { return allocate_aligned(n); }
+    static void  operator delete(void* p) { deallocate_aligned(p); }
+
+    std::unique_ptr<Table> table;
+    std::mutex             mutex;
+    std::vector<Update>    updates;
+    std::atomic<bool>      pending;
+  };
+
+  Shard& local() const { return *shards_[this_worker() % shards_.size()]; }
+
+  Table& sync();
+  void   broadcast(Update const&);
+  void   apply(Table&, Update const&);
+  void   drain(Shard&);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+
+} // namespace fp
+
+
+#endif
@@ -0,0 +1,269 @@
+#include "snapshot.hpp"
+#include "table.hpp"
+#include "application.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace fp
+{
+
+constexpr std::uint32_t Snapshot_header::current_version;
+constexpr std::uint64_t Snapshot_record::no_slot;
+
+
+namespace
+{
+
+constexpr char snapshot_magic[8] = "FPSNAP";
+
+
+// Returns n rounded up to a multiple of m, a power of two.
+inline std::size_t
+round_up(std::size_t n, std::size_t m)
+{
+  return (n + m - 1) & ~(m - 1);
+}
+
+
+// Returns the number of bytes of a record with a key of the given
+// width.
+inline std::size_t
+record_bytes(int key_size)
+{
+  return sizeof(Snapshot_record) + round_up(key_size, 8);
+}
+
+
+[[noreturn]] void
+corrupt(char const* path)
+{
+  throw std::runtime_error(std::string("Invalid table snapshot: ") + path);
+}
+
+} // namespace
+
+
+// -------------------------------------------------------------------------- //
+// Writing snapshots
+
+// Begins a snapshot of a table whose keys have the given width.
+Snapshot_writer::Snapshot_writer(int key_size)
+  : header_(), flows_(0)
+{
+  std::memcpy(header_.magic, snapshot_magic, sizeof(header_.magic));
+  header_.version = Snapshot_header::current_version;
+  header_.record_size = record_bytes(key_size);
+  header_.key_size = key_size;
+}
+
+
+// Saves the n control bytes of a map with the given layout, whose
+// hash function maps the check key to the given value.
+void
+Snapshot_writer::control(std::uint32_t layout, std::uint64_t check, Byte const* ctrl, std::size_t n)
+{
+  header_.layout = layout;
+  header_.hash_check = check;
+  header_.capacity = n;
+  control_.assign(ctrl, ctrl + n);
+}
+
+
+// Saves the flow f with the given key, stored in the given slot of
+// the map, or no_slot.
+void
+Snapshot_writer::flow(std::uint64_t slot, Byte const* key, Flow const& f)
+{
+  Snapshot_record r;
+  r.slot = slot;
+  r.pri = f.pri_;
+  r.cookie = f.cookie_;
+  r.flags = f.flags_;
+  r.egress = f.egress_;
+  r.instr = symbol(f.instr_);
+  r.idle = f.time_.idle;
+  r.hard = f.time_.hard;
+  r.stats = f.count_.read();
+
+  std::size_t n = records_.size();
+  records_.resize(n + header_.record_size);
+  std::memcpy(&records_[n], &r, sizeof(r));
+  std::memcpy(&records_[n + sizeof(r)], key, header_.key_size);
+  ++flows_;
+}
+
+
+// Returns the index of the symbol name of the given instructions.
+// Throws an exception if they have no symbol.
+std::uint32_t
+Snapshot_writer::symbol(Flow_instructions fn)
+{
+  auto iter = symbols_.find(fn);
+  if (iter != symbols_.end())
+    return iter->second;
+
+  Dl_info info;
+  void* addr = reinterpret_cast<void*>(fn);
+  if (!::dladdr(addr, &info) || !info.dli_sname || info.dli_saddr != addr)
+    throw std::runtime_error("Flow instructions have no symbol to save");
+  std::uint32_t i = symbols_.size();
+  names_.append(info.dli_sname);
+  names_.push_back(0);
+  symbols_.emplace(fn, i);
+  return i;
+}
+
+
+// Writes the snapshot to the given path. The snapshot is written
+// to a temporary file, which replaces the file at the path once it
+// is complete, so that a failure never leaves a partial snapshot.
+void
+Snapshot_writer::write(char const* path) const
+{
+  Snapshot_header h = header_;
+  h.flows = flows_;
+  h.symbols = symbols_.size();
+  h.control = round_up(sizeof(h), page_size);
+  h.records = round_up(h.control + control_.size(), 8);
+  h.names = h.records + records_.size();
+  h.size = h.names + names_.size();
+
+  std::vector<Byte> buf(h.size);
+  std::memcpy(&buf[0], &h, sizeof(h));
+  std::copy(control_.begin(), control_.end(), &buf[h.control]);
+  std::copy(records_.begin(), records_.end(), &buf[h.records]);
+  std::copy(names_.begin(), names_.end(), &buf[h.names]);
+
+  std::string tmp = std::string(path) + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    throw std::runtime_error("Cannot create table snapshot: " + tmp);
+  std::size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t n = ::write(fd, &buf[done], buf.size() - done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  if (::close(fd) || done < buf.size() || ::rename(tmp.c_str(), path)) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error(std::string("Cannot write table snapshot: ") + path);
+  }
+}
+
+
+// -------------------------------------------------------------------------- //
+// Reading snapshots
+
+// Maps the snapshot at the given path, and resolves its symbols in
+// the library with the given handle, or in the runtime.
+Snapshot_reader::Snapshot_reader(char const* path, void* lib)
+  : fd_(-1), base_(nullptr), size_(0), header_(nullptr)
+{
+  fd_ = ::open(path, O_RDONLY);
+  if (fd_ < 0)
+    throw std::runtime_error(std::string("Cannot open table snapshot: ") + path);
+  struct stat st;
+  if (::fstat(fd_, &st) || st.st_size < (off_t)sizeof(Snapshot_header)) {
+    ::close(fd_);
+    corrupt(path);
+  }
+  size_ = st.st_size;
+  void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd_);
+    throw std::runtime_error(std::string("Cannot map table snapshot: ") + path);
+  }
+  base_ = static_cast<Byte*>(p);
+  header_ = reinterpret_cast<Snapshot_header const*>(base_);
+
+  try {
+    // Check that every section lies within the file.
+    Snapshot_header const& h = *header_;
+    if (std::memcmp(h.magic, snapshot_magic, sizeof(h.magic))
+        || h.version != Snapshot_header::current_version
+        || h.key_size > fp::key_size
+        || h.record_size != record_bytes(h.key_size)
+        || h.size != size_
+        || h.control % page_size
+        || h.capacity > size_ || h.control + h.capacity > h.records
+        || h.records % 8
+        || h.flows > size_ / h.record_size || h.records + h.flows * h.record_size != h.names
+        || h.names > size_
+        || (h.symbols && base_[size_ - 1]))
+      corrupt(path);
+
+    // Resolve the symbol names.
+    char const* name = reinterpret_cast<char const*>(base_ + h.names);
+    char const* end = reinterpret_cast<char const*>(base_ + size_);
+    for (std::uint64_t i = 0; i < h.symbols; ++i) {
+      if (name >= end)
+        corrupt(path);
+      void* sym = resolve_symbol(lib, name);
+      if (!sym)
+        throw std::runtime_error(std::string("Cannot resolve flow instructions: ") + name);
+      instrs_.push_back(reinterpret_cast<Flow_instructions>(sym));
+      name += std::strlen(name) + 1;
+    }
+    for (std::size_t i = 0; i < flows(); ++i) {
+      if (record(i).instr >= instrs_.size())
+        corrupt(path);
+    }
+  }
+  catch (...) {
+    ::munmap(base_, size_);
+    ::close(fd_);
+    throw;
+  }
+}
+
+
+Snapshot_reader::~Snapshot_reader()
+{
+  ::munmap(base_, size_);
+  ::close(fd_);
+}
+
+
+// Returns a copy of the control bytes, which the caller releases
+// with deallocate_zeroed. Large arrays are mapped privately from the
+// file rather than read, so their pages are only loaded as lookups
+// touch them.
+Byte*
+Snapshot_reader::copy_control() const
+{
+  std::size_t n = capacity();
+  if (n < large_block_size) {
+    Byte* p = static_cast<Byte*>(allocate_zeroed(n));
+    std::memcpy(p, control(), n);
+    return p;
+  }
+  void* p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, header_->control);
+  if (p == MAP_FAILED)
+    throw std::bad_alloc();
+  return static_cast<Byte*>(p);
+}
+
+
+// Returns the i-th flow. Its instructions are resolved, and its
+// counters hold the saved counts.
+Flow
+Snapshot_reader::flow(std::size_t i) const
+{
+  Snapshot_record const& r = record(i);
+  Flow_stats s = r.stats;
+  s.last_hit = 0;
+  return Flow(r.pri, Flow_counters(s), instrs_[r.instr], Flow_timeouts(r.idle, r.hard),
+              r.cookie, r.flags, r.egress);
+}
+
+
+} // namespace fp
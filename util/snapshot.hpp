@@ -0,0 +1,164 @@
+#ifndef FP_SNAPSHOT_HPP
+#define FP_SNAPSHOT_HPP
+
+#include "flow.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace fp
+{
+
+// Table snapshots.
+//
+// A snapshot holds the flows of a table in a flat file, so that a
+// data plane that restarts can restore the flows it had learned
+// instead of relearning them from the miss path. A snapshot is laid
+// out as follows:
+//
+//    header
+//    control bytes   (one per slot, starting on a page boundary)
+//    flow records    (one per flow, with the flow's key)
+//    symbol names    (nul-terminated)
+//
+// The control bytes and the slot of each flow are those of the
+// table's map when it was saved. When the table that loads the
+// snapshot uses the same map layout and hash function, the control
+// bytes are mapped from the file and each flow is stored back in
+// its own slot, so nothing is rehashed. Otherwise, the flows are
+// added one by one.
+//
+// Flow instructions are function pointers, which do not survive a
+// restart. They are saved as the names of their symbols and
+// resolved again, when the snapshot is loaded, against the
+// application's library and then the runtime. Saving a flow whose
+// instructions have no dynamic symbol fails.
+//
+// Counters are restored, except for the time of the last hit, since
+// times from a previous run are not comparable with the current
+// ones. For the same reason, timeouts restart when a snapshot is
+// loaded.
+//
+// Snapshots are in the byte order of the machine that wrote them,
+// and are only meant to be read back on the same machine.
+
+// The header of a snapshot. Offsets are from the start of the file.
+struct Snapshot_header
+{
+  static constexpr std::uint32_t current_version = 1;
+
+  char          magic[8];
+  std::uint32_t version;
+  std::uint32_t record_size; // Bytes per flow record, including the key
+  std::uint32_t key_size;
+  std::uint32_t layout;      // The layout of the control bytes
+  std::uint64_t hash_check;  // The hash of a known key
+  std::uint64_t capacity;    // Number of slots
+  std::uint64_t flows;       // Number of flow records
+  std::uint64_t symbols;     // Number of symbol names
+  std::uint64_t control;     // Offset of the control bytes
+  std::uint64_t records;     // Offset of the flow records
+  std::uint64_t names;       // Offset of the symbol names
+  std::uint64_t size;        // Size of the file
+};
+
+
+// A saved flow. The key follows the record, padded to a multiple
+// of 8 bytes.
+struct Snapshot_record
+{
+  // The slot of a flow that is not stored in the map, e.g., one
+  // hidden by a flow with a higher priority.
+  static constexpr std::uint64_t no_slot = -1;
+
+  std::uint64_t slot;
+  std::uint64_t pri;
+  std::uint64_t cookie;
+  std::uint64_t flags;
+  std::uint32_t egress;
+  std::uint32_t instr;  // Index of the instructions' symbol name
+  std::uint32_t idle;
+  std::uint32_t hard;
+  Flow_stats    stats;
+};
+
+
+// Collects the contents of a table and writes them to a file.
+class Snapshot_writer
+{
+public:
+  explicit Snapshot_writer(int);
+
+  void control(std::uint32_t, std::uint64_t, Byte const*, std::size_t);
+  void flow(std::uint64_t, Byte const*, Flow const&);
+  void write(char const*) const;
+
+  // Returns the number of flows collected.
+  std::size_t flows() const { return flows_; }
+
+private:
+  std::uint32_t symbol(Flow_instructions);
+
+  Snapshot_header          header_;
+  std::vector<Byte>        control_;
+  std::vector<Byte>        records_;
+  std::string              names_;
+  std::size_t              flows_;
+
+  std::unordered_map<Flow_instructions, std::uint32_t> symbols_;
+};
+
+
+// A snapshot file mapped into memory. Symbol names are resolved
+// against the given library handle when the snapshot is opened.
+// Throws an exception if the file cannot be read, is not a valid
+// snapshot, or names an unknown symbol.
+class Snapshot_reader
+{
+public:
+  Snapshot_reader(char const*, void*);
+  ~Snapshot_reader();
+
+  Snapshot_reader(Snapshot_reader const&) = delete;
+  Snapshot_reader& operator=(Snapshot_reader const&) = delete;
+
+  int           key_size() const   { return header_->key_size; }
+  std::uint32_t layout() const     { return header_->layout; }
+  std::uint64_t hash_check() const { return header_->hash_check; }
+  std::size_t   capacity() const   { return header_->capacity; }
+  std::size_t   flows() const      { return header_->flows; }
+
+  // Returns the control bytes in the file.
+  Byte const* control() const { return base_ + header_->control; }
+
+  Byte* copy_control() const;
+
+  // Returns the i-th flow record and its key.
+  Snapshot_record const& record(std::size_t i) const
+  {
+    return *reinterpret_cast<Snapshot_record const*>(base_ + header_->records + i * header_->record_size);
+  }
+
+  Byte const* key(std::size_t i) const
+  {
+    return reinterpret_cast<Byte const*>(&record(i) + 1);
+  }
+
+  Flow flow(std::size_t) const;
+
+private:
+  int                            fd_;
+  Byte*                          base_;
+  std::size_t                    size_;
+  Snapshot_header const*         header_;
+  std::vector<Flow_instructions> instrs_;
+};
+
+
+} // namespace fp
+
+
+#endif
@@ -1,9 +1,19 @@
 #include <exception>
 #include <unordered_map>
 #include <cstdarg>
+#include <fstream>
+#include <iostream>
 
 
 #include "system.hpp"
+#include "prefix_table.hpp"
+#include "wildcard_table.hpp"
+#include "decision_tree.hpp"
+#include "concurrent_table.hpp"
+#include "sharded_table.hpp"
+#include "flow_cache.hpp"
+#include "gather.hpp"
+#include "rule_file.hpp"
 #include "application.hpp"
 #include "endian.hpp"
 #include "context.hpp"
@@ -52,6 +62,8 @@ fp_flood(fp::Context* cxt)
 void
 fp_output_port(fp::Context* cxt, fp::Port::Id id)
 {
+  if (cxt->ctrl_.trace)
+    cxt->ctrl_.trace->forbid();
   // Allocate a copy.
   fp::Buffer& buf = cxt->dataplane()->buf_pool()->copy(*cxt);
   cxt->dataplane()->get_port(id)->send(buf.context());
@@ -86,9 +98,69 @@ fp_goto_table(fp::Context* cxt, fp::Table* tbl, int n, ...)
   fp::Key key = fp_gather(cxt, tbl->key_size(), n, args);
   va_end(args);
 
-  fp::Flow flow = tbl->search(key);
+  fp::Flow* flow = tbl->search(key);
+  // count the match
+  flow->count_.hit(cxt->size(), cxt->packet().timestamp_);
+  if (cxt->ctrl_.trace)
+    cxt->ctrl_.trace->hit(tbl, flow);
   // execute the flow function
-  flow.instr_(&flow, tbl, cxt);
+  flow->instr_(flow, tbl, cxt);
+}
+
+
+// Dispatches the given context to the given table, building the
+// key with the given gather plan (see fp_create_gather_plan).
+void
+fp_goto_table_plan(fp::Context* cxt, fp::Table* tbl, fp::Gather_plan const* plan)
+{
+  fp::Key key;
+  plan->gather(*cxt, key);
+
+  fp::Flow* flow = tbl->search(key);
+  flow->count_.hit(cxt->size(), cxt->packet().timestamp_);
+  if (cxt->ctrl_.trace)
+    cxt->ctrl_.trace->hit(tbl, flow);
+  flow->instr_(flow, tbl, cxt);
+}
+
+
+// Dispatches each of the n contexts in cxts to the given table.
+// Accepts the same list of fields as fp_goto_table. The keys of a
+// burst of contexts are looked up together (see search_burst),
+// and then the flows' instructions are executed in order. If an
+// instruction modifies the table, the flows found for the rest of
+// the burst are no longer valid, and they are looked up again.
+void
+fp_goto_table_burst(fp::Context** cxts, int n, fp::Table* tbl, int nfields, ...)
+{
+  fp::Key keys[fp::Table::burst_size];
+  fp::Flow* flows[fp::Table::burst_size];
+
+  va_list args;
+  va_start(args, nfields);
+  for (int i = 0; i < n; i += fp::Table::burst_size) {
+    int m = std::min(n - i, fp::Table::burst_size);
+    for (int j = 0; j < m; ++j) {
+      va_list fields;
+      va_copy(fields, args);
+      keys[j] = fp_gather(cxts[i + j], tbl->key_size(), nfields, fields);
+      va_end(fields);
+    }
+
+    std::uint64_t version = tbl->version();
+    tbl->search_burst(keys, flows, m);
+    for (int j = 0; j < m; ++j) {
+      fp::Context* cxt = cxts[i + j];
+      fp::Flow* flow = flows[j];
+      if (tbl->version() != version)
+        flow = tbl->search(keys[j]);
+      flow->count_.hit(cxt->size(), cxt->packet().timestamp_);
+      if (cxt->ctrl_.trace)
+        cxt->ctrl_.trace->hit(tbl, flow);
+      flow->instr_(flow, tbl, cxt);
+    }
+  }
+  va_end(args);
 }
 
 
@@ -213,10 +285,48 @@ fp_gather(fp::Context* cxt, int key_width, int n, va_list args)
 }
 
 
+// Creates a plan gathering keys for the given table from n fields.
+// The variadic list holds the id and the width in bytes of each
+// field, in order, and accepts the same special fields as
+// fp_gather. The plan is owned by the data plane.
+fp::Gather_plan*
+fp_create_gather_plan(fp::Dataplane* dp, fp::Table* tbl, int n, ...)
+{
+  std::vector<fp::Gather_field> fields;
+  va_list args;
+  va_start(args, n);
+  for (int i = 0; i < n; ++i) {
+    int id = va_arg(args, int);
+    int width = va_arg(args, int);
+    fields.push_back({id, width});
+  }
+  va_end(args);
+
+  dp->plans_.emplace_back(new fp::Gather_plan(tbl->key_size(), fields));
+  return dp->plans_.back().get();
+}
+
+
 // Creates a new table in the given data plane with the given size,
-// key width, and table type.
+// key width, and table type. Exact and wildcard tables use the data
+// plane's default algorithm for their type.
 fp::Table*
 fp_create_table(fp::Dataplane* dp, int id, int key_width, int size, fp::Table::Type type)
+{
+  fp::Table::Algorithm algo = fp::Table::DEFAULT;
+  if (type == fp::Table::EXACT)
+    algo = dp->exact_algorithm_;
+  if (type == fp::Table::WILDCARD)
+    algo = dp->wildcard_algorithm_;
+  return fp_create_table_with(dp, id, key_width, size, type, algo);
+}
+
+
+// Creates a new table in the given data plane with the given size,
+// key width, and table type, implemented by the given algorithm.
+fp::Table*
+fp_create_table_with(fp::Dataplane* dp, int id, int key_width, int size,
+                     fp::Table::Type type, fp::Table::Algorithm algo)
 {
   fp::Table* tbl = nullptr;
   std::cout << "Create table\n";
@@ -224,16 +334,50 @@ fp_create_table(fp::Dataplane* dp, int id, int key_width, int size, fp::Table::T
   switch (type)
   {
     case fp::Table::Type::EXACT:
-    // Make a new hash table.
-    tbl = new fp::Hash_table(id, size, key_width);
+    // Make a new hash table sized for the key width, or one that
+    // supports concurrent updates.
+    if (algo == fp::Table::CONCURRENT)
+      tbl = new fp::Concurrent_table(id, size, key_width);
+    else if (algo == fp::Table::CUCKOO)
+      tbl = fp::create_cuckoo_table(id, size, key_width);
+    else if (algo == fp::Table::DEFAULT)
+      tbl = fp::create_exact_table(id, size, key_width);
+    else
+      throw std::string("Unsupported algorithm for exact table");
     assert(tbl);
+    // With several workers, give each its own shard.
+    if (dp->workers_ > 1) {
+      std::vector<fp::Table*> shards {tbl};
+      for (int i = 1; i < dp->workers_; ++i) {
+        if (algo == fp::Table::CONCURRENT)
+          shards.push_back(new fp::Concurrent_table(id, size, key_width));
+        else if (algo == fp::Table::CUCKOO)
+          shards.push_back(fp::create_cuckoo_table(id, size, key_width));
+        else
+          shards.push_back(fp::create_exact_table(id, size, key_width));
+      }
+      tbl = new fp::Sharded_table(id, key_width, shards);
+    }
     dp->tables_.push_back(tbl);
     break;
     case fp::Table::Type::PREFIX:
+    if (algo != fp::Table::DEFAULT)
+      throw std::string("Unsupported algorithm for prefix table");
     // Make a new prefix match table.
+    tbl = new fp::Prefix_table(id, size, key_width);
+    assert(tbl);
+    dp->tables_.push_back(tbl);
     break;
     case fp::Table::Type::WILDCARD:
     // Make a new wildcard match table.
+    if (algo == fp::Table::DECISION_TREE)
+      tbl = new fp::Decision_tree_table(id, size, key_width);
+    else if (algo == fp::Table::DEFAULT || algo == fp::Table::TUPLE_SPACE)
+      tbl = new fp::Wildcard_table(id, size, key_width);
+    else
+      throw std::string("Unsupported algorithm for wildcard table");
+    assert(tbl);
+    dp->tables_.push_back(tbl);
     break;
     default:
     throw std::string("Unknown table type given");
@@ -245,9 +389,8 @@ fp_create_table(fp::Dataplane* dp, int id, int key_width, int size, fp::Table::T
 
 
 // Creates a new flow rule from the given key and function pointer
-// and adds it to the given table.
-//
-// FIXME: Currently ignoring timeout.
+// and adds it to the given table. The flow is removed after it has
+// been idle for timeout seconds, unless the timeout is 0.
 void
 fp_add_init_flow(fp::Table* tbl, void* fn, void* key, unsigned int timeout, unsigned int egress)
 {
@@ -259,13 +402,78 @@ fp_add_init_flow(fp::Table* tbl, void* fn, void* key, unsigned int timeout, unsi
   fp::Key k(buf, key_size);
   // cast the flow into a flow instruction
   fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fn);
-  fp::Flow flow(0, fp::Flow_counters(), instr, fp::Flow_timeouts(), 0, 0, egress);
+  fp::Flow flow(0, fp::Flow_counters(), instr, fp::Flow_timeouts(timeout), 0, 0, egress);
+
+  tbl->install(k, flow);
+}
+
+
+// Adds a flow to the given table as fp_add_init_flow does, with
+// both timeouts. The flow is removed after it has been idle for
+// idle seconds, or hard seconds after it was added, whichever
+// comes first. A timeout of 0 never expires.
+void
+fp_add_flow_with_timeouts(fp::Table* tbl, void* fn, void* key, unsigned int idle, unsigned int hard, unsigned int egress)
+{
+  fp::Key k(reinterpret_cast<fp::Byte*>(key), tbl->key_size());
+  fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fn);
+  fp::Flow flow(0, fp::Flow_counters(), instr, fp::Flow_timeouts(idle, hard), 0, 0, egress);
+
+  tbl->install(k, flow);
+}
+
 
-  tbl->add(k, flow);
+// Adds n flows to the given table at once, as fp_add_init_flow
+// would one at a time. The keys are packed in a single array, each
+// as wide as the table's key, and fns holds the instructions of
+// each flow. All flows share the timeout and egress port. Returns
+// the number of flows added.
+//
+// Exact tables are sized for the whole batch before any flow is
+// added, so this is much faster than adding the flows one by one.
+int
+fp_add_flows_bulk(fp::Table* tbl, void const* keys, void* const* fns, int n, unsigned int timeout, unsigned int egress)
+{
+  std::vector<fp::Flow> flows;
+  flows.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fns[i]);
+    flows.emplace_back(0, fp::Flow_counters(), instr, fp::Flow_timeouts(timeout), 0, 0, egress);
+  }
+  tbl->add_bulk(static_cast<fp::Byte const*>(keys), flows.data(), n);
+  return n;
+}
+
+
+// Adds the rules in the rule file at the given path to the given
+// table (see rule_file.hpp). Instructions are resolved against the
+// data plane's application. Returns the number of rules added, or
+// -1 if the file could not be read or holds an invalid rule.
+int
+fp_load_rules(fp::Dataplane* dp, fp::Table* tbl, char const* path)
+{
+  std::ifstream is(path);
+  if (!is) {
+    std::cerr << "Cannot open rule file: " << path << '\n';
+    return -1;
+  }
+  try {
+    return fp::load_rules(*tbl, is, dp->app_.library().handle);
+  }
+  catch (std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return -1;
+  }
 }
 
 
-// FIXME: Ignoring timeouts.
+// Adds a flow learned from a packet to the given table. The flow
+// is removed after it has been idle for timeout seconds, unless
+// the timeout is 0.
+//
+// In a sharded table, the flow is only added to the shard of the
+// worker processing the packet. Flows that every worker must see
+// are added with fp_add_init_flow.
 void
 fp_add_new_flow(fp::Table* tbl, void* fn, void* key, unsigned int timeout, unsigned int egress)
 {
@@ -276,9 +484,67 @@ fp_add_new_flow(fp::Table* tbl, void* fn, void* key, unsigned int timeout, unsig
   fp::Key k(buf, key_size);
   // cast the flow into a flow instruction
   fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fn);
-  fp::Flow flow(0, fp::Flow_counters(), instr, fp::Flow_timeouts(), 0, 0, egress);
+  fp::Flow flow(0, fp::Flow_counters(), instr, fp::Flow_timeouts(timeout), 0, 0, egress);
+
+  tbl->learn(k, flow);
+}
+
+
+// Adds a flow with the given priority to the given exact table.
+// Flows with other priorities for the same key are kept, and a
+// lookup finds the one with the highest priority. The flow is
+// removed after it has been idle for timeout seconds, unless the
+// timeout is 0.
+void
+fp_add_priority_flow(fp::Table* tbl, void* fn, void* key, unsigned int pri, unsigned int timeout, unsigned int egress)
+{
+  assert(tbl->type() == fp::Table::EXACT);
+  fp::Byte* buf = reinterpret_cast<fp::Byte*>(key);
+  fp::Key k(buf, tbl->key_size());
+  fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fn);
+  fp::Flow flow(pri, fp::Flow_counters(), instr, fp::Flow_timeouts(timeout), 0, 0, egress);
 
-  tbl->add(k, flow);
+  tbl->install(k, flow);
+}
+
+
+// Creates a new flow rule matching the first len bits of the given
+// key and adds it to the given prefix table. The flow is removed
+// after it has been idle for timeout seconds, unless the timeout
+// is 0.
+void
+fp_add_prefix_flow(fp::Table* tbl, void* fn, void* key, unsigned int len, unsigned int timeout, unsigned int egress)
+{
+  assert(tbl->type() == fp::Table::PREFIX);
+  // cast the key to Byte*
+  fp::Byte* buf = reinterpret_cast<fp::Byte*>(key);
+  // construct a key object
+  fp::Key k(buf, tbl->key_size());
+  // cast the flow into a flow instruction
+  fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fn);
+  fp::Flow flow(len, fp::Flow_counters(), instr, fp::Flow_timeouts(timeout), 0, 0, egress);
+
+  static_cast<fp::Prefix_table*>(tbl)->install(k, len, flow);
+}
+
+
+// Creates a new flow rule matching the bits of the given key selected
+// by the given mask and adds it to the given wildcard table. When
+// several flows match a packet, the one with the highest priority
+// is applied. The flow is removed after it has been idle for
+// timeout seconds, unless the timeout is 0.
+void
+fp_add_wildcard_flow(fp::Table* tbl, void* fn, void* key, void* mask, unsigned int pri, unsigned int timeout, unsigned int egress)
+{
+  assert(tbl->type() == fp::Table::WILDCARD);
+  // construct the key and mask objects
+  fp::Key k(reinterpret_cast<fp::Byte*>(key), tbl->key_size());
+  fp::Key m(reinterpret_cast<fp::Byte*>(mask), tbl->key_size());
+  // cast the flow into a flow instruction
+  fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fn);
+  fp::Flow flow(pri, fp::Flow_counters(), instr, fp::Flow_timeouts(timeout), 0, 0, egress);
+
+  static_cast<fp::Classifier*>(tbl)->install(k, m, flow);
 }
 
 
@@ -291,15 +557,15 @@ fp_get_flow_egress(fp::Flow* f)
 }
 
 
-// Adds the miss case for the table.
-//
-// FIXME: Ignoring timeout value.
+// Adds the miss case for the table. The miss case reverts to the
+// default after it has been idle for timeout seconds, unless the
+// timeout is 0.
 void
 fp_add_miss(fp::Table* tbl, void* fn, unsigned int timeout, unsigned int egress)
 {
   // cast the flow into a flow instruction
   fp::Flow_instructions instr = reinterpret_cast<fp::Flow_instructions>(fn);
-  fp::Flow flow(0, fp::Flow_counters(), instr, fp::Flow_timeouts(), 0, 0, egress);
+  fp::Flow flow(0, fp::Flow_counters(), instr, fp::Flow_timeouts(timeout), 0, 0, egress);
   tbl->insert_miss(flow);
 }
 
@@ -318,6 +584,43 @@ fp_del_flow(fp::Table* tbl, void* key)
   tbl->rmv(k);
 }
 
+
+// Removes the flow with the given key and priority from the given
+// table, if it exists. The flow with the next highest priority for
+// the key, if any, takes its place.
+void
+fp_del_priority_flow(fp::Table* tbl, void* key, unsigned int pri)
+{
+  fp::Byte* buf = reinterpret_cast<fp::Byte*>(key);
+  fp::Key k(buf, tbl->key_size());
+  tbl->rmv_flow(k, pri);
+}
+
+// Removes the flow matching the first len bits of the given key
+// from the given prefix table, if it exists.
+void
+fp_del_prefix_flow(fp::Table* tbl, void* key, unsigned int len)
+{
+  assert(tbl->type() == fp::Table::PREFIX);
+  // cast the key to Byte*
+  fp::Byte* buf = reinterpret_cast<fp::Byte*>(key);
+  // construct a key object
+  fp::Key k(buf, tbl->key_size());
+  // delete the prefix
+  static_cast<fp::Prefix_table*>(tbl)->rmv(k, len);
+}
+
+// Removes the flow with the given key and mask from the given
+// wildcard table, if it exists.
+void
+fp_del_wildcard_flow(fp::Table* tbl, void* key, void* mask)
+{
+  assert(tbl->type() == fp::Table::WILDCARD);
+  fp::Key k(reinterpret_cast<fp::Byte*>(key), tbl->key_size());
+  fp::Key m(reinterpret_cast<fp::Byte*>(mask), tbl->key_size());
+  static_cast<fp::Classifier*>(tbl)->rmv(k, m);
+}
+
 // Removes the miss case from the given table and replaces
 // it with the default.
 void
@@ -327,6 +630,105 @@ fp_del_miss(fp::Table* tbl)
 }
 
 
+// Returns the counters of the flow matching the given key. If no
+// flow matches, the counters of the table-miss flow are returned.
+fp::Flow_stats
+fp_get_flow_stats(fp::Table* tbl, void* key)
+{
+  // cast the key to Byte*
+  fp::Byte* buf = reinterpret_cast<fp::Byte*>(key);
+  // construct a key object
+  fp::Key k(buf, tbl->key_size());
+  return tbl->search(k)->count_.read();
+}
+
+
+// Copies the records of up to n flows in the given table into
+// the buffer, and returns the number of flows in the table.
+int
+fp_dump_flow_stats(fp::Table* tbl, fp::Flow_record* out, int n)
+{
+  std::vector<fp::Flow_record> v;
+  tbl->dump(v);
+  std::copy(v.begin(), v.begin() + std::min<std::size_t>(n, v.size()), out);
+  return v.size();
+}
+
+
+// Enables or disables the negative cache of the given table. Only
+// exact tables support it.
+void
+fp_set_table_filter(fp::Table* tbl, bool on)
+{
+  tbl->set_filter(on);
+}
+
+
+// Rebuilds the negative cache of the given table, discarding the
+// keys that have been removed since it was last built.
+void
+fp_rebuild_table_filter(fp::Table* tbl)
+{
+  tbl->rebuild_filter();
+}
+
+
+// Returns the statistics of the negative cache of the given table.
+fp::Filter_stats
+fp_get_filter_stats(fp::Table* tbl)
+{
+  return tbl->filter_stats();
+}
+
+
+// Returns the number of flows in the given table and the bytes
+// used to store them.
+fp::Table_memory
+fp_get_table_memory(fp::Table* tbl)
+{
+  return tbl->memory();
+}
+
+
+// Saves the flows of the given table to a snapshot file at the
+// given path. Returns the number of flows saved, or -1 if the table
+// could not be saved.
+int
+fp_save_table(fp::Table* tbl, char const* path)
+{
+  try {
+    fp::Snapshot_writer w(tbl->key_size());
+    tbl->save(w);
+    w.write(path);
+    return w.flows();
+  }
+  catch (std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return -1;
+  }
+}
+
+
+// Replaces the flows of the given table with those saved in the
+// snapshot file at the given path. Flow instructions are resolved
+// against the data plane's application. Returns the number of flows
+// loaded, or -1 if the snapshot could not be loaded. An invalid
+// snapshot leaves the table unchanged.
+int
+fp_load_table(fp::Dataplane* dp, fp::Table* tbl, char const* path)
+{
+  try {
+    fp::Snapshot_reader r(path, dp->app_.library().handle);
+    tbl->load(r);
+    return r.flows();
+  }
+  catch (std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return -1;
+  }
+}
+
+
 // Raise an event.
 // TODO: Make this asynchronous on another thread.
 void
@@ -336,6 +738,8 @@ fp_raise_event(fp::Context* cxt, void* handler)
   // of void (*)(Context*)
   void (*event)(fp::Context*);
   event = (void (*)(fp::Context*)) (handler);
+  if (cxt->ctrl_.trace)
+    cxt->ctrl_.trace->forbid();
   // Invoke the event.
   // FIXME: This should produce a copy of the context and process it
   // seperately.
@@ -4,21 +4,31 @@
 #include "port.hpp"
 #include "table.hpp"
 #include "action.hpp"
+#include "gather.hpp"
 // #include "thread.hpp"
 
 extern "C"
 {
 
 // Apply actions.
+//
+// The fp_goto_table functions pass the matched flow to its
+// instructions (see Flow_instructions). Exact tables store flows
+// in open addressing tables, so adding a flow to the matched
+// table may move every flow in it. The flow pointer must not be
+// used after such a change, e.g., after fp_add_new_flow.
 void           fp_drop(fp::Context*);
 void           fp_flood(fp::Context*);
 void           fp_goto_table(fp::Context*, fp::Table*, int, ...);
+void           fp_goto_table_burst(fp::Context**, int, fp::Table*, int, ...);
+void           fp_goto_table_plan(fp::Context*, fp::Table*, fp::Gather_plan const*);
 void           fp_output_port(fp::Context*, fp::Port::Id);
 
 // System queries.
 fp::Dataplane* fp_get_dataplane(std::string const&);
 // fp::Port::Id   fp_get_port_by_name(char const*);
 fp::Key        fp_gather(fp::Context*, int, int, va_list);
+fp::Gather_plan* fp_create_gather_plan(fp::Dataplane*, fp::Table*, int, ...);
 fp::Port::Id   fp_get_flow_egress(fp::Flow*);
 fp::Port::Id   fp_get_port_by_id(fp::Dataplane*, unsigned int);
 bool           fp_port_id_is_up(fp::Dataplane*, fp::Port::Id);
@@ -29,13 +39,39 @@ fp::Port::Id   fp_get_flood_port(fp::Dataplane*);
 
 // Flow tables.
 fp::Table*     fp_create_table(fp::Dataplane*, int, int, int, fp::Table::Type);
+fp::Table*     fp_create_table_with(fp::Dataplane*, int, int, int, fp::Table::Type, fp::Table::Algorithm);
 void           fp_delete_table(fp::Dataplane*, fp::Table*);
 void           fp_add_init_flow(fp::Table*, void*, void*, unsigned int, unsigned int);
 void           fp_add_new_flow(fp::Table*, void*, void*, unsigned int, unsigned int);
+void           fp_add_flow_with_timeouts(fp::Table*, void*, void*, unsigned int, unsigned int, unsigned int);
+void           fp_add_priority_flow(fp::Table*, void*, void*, unsigned int, unsigned int, unsigned int);
+void           fp_add_prefix_flow(fp::Table*, void*, void*, unsigned int, unsigned int, unsigned int);
+void           fp_add_wildcard_flow(fp::Table*, void*, void*, void*, unsigned int, unsigned int, unsigned int);
 void           fp_add_miss(fp::Table*, void*, unsigned int, unsigned int);
+int            fp_add_flows_bulk(fp::Table*, void const*, void* const*, int, unsigned int, unsigned int);
+int            fp_load_rules(fp::Dataplane*, fp::Table*, char const*);
 void           fp_del_flow(fp::Table*, void*);
+void           fp_del_priority_flow(fp::Table*, void*, unsigned int);
+void           fp_del_prefix_flow(fp::Table*, void*, unsigned int);
+void           fp_del_wildcard_flow(fp::Table*, void*, void*);
 void           fp_del_miss(fp::Table*);
 
+// Flow statistics.
+fp::Flow_stats fp_get_flow_stats(fp::Table*, void*);
+int            fp_dump_flow_stats(fp::Table*, fp::Flow_record*, int);
+
+// Negative caches.
+void           fp_set_table_filter(fp::Table*, bool);
+void           fp_rebuild_table_filter(fp::Table*);
+fp::Filter_stats fp_get_filter_stats(fp::Table*);
+
+// Table memory accounting.
+fp::Table_memory fp_get_table_memory(fp::Table*);
+
+// Table snapshots.
+int            fp_save_table(fp::Table*, char const*);
+int            fp_load_table(fp::Dataplane*, fp::Table*, char const*);
+
 void           fp_raise_event(fp::Context*, void*);
 
 } // extern "C"
@@ -1,8 +1,42 @@
 #include "table.hpp"
 
+#include <stdexcept>
+
 namespace fp
 {
 
+constexpr int Table::burst_size;
+
+
+namespace
+{
+
+constexpr std::uint64_t nanoseconds_per_second = 1000000000;
+
+// The resolution of flow timeouts, in nanoseconds.
+constexpr std::uint64_t timeout_tick = 1000000;
+
+
+// Returns the time at which the flow f expires. The start time
+// stands in for the installation time of flows installed before
+// the table started keeping time.
+std::uint64_t
+deadline(Flow const& f, std::uint64_t start)
+{
+  std::uint64_t created = f.time_.created ? f.time_.created : start;
+  std::uint64_t d = -1;
+  if (f.time_.hard)
+    d = created + f.time_.hard * nanoseconds_per_second;
+  if (f.time_.idle) {
+    std::uint64_t last = std::max(created, f.count_.read().last_hit);
+    d = std::min(d, last + f.time_.idle * nanoseconds_per_second);
+  }
+  return d;
+}
+
+} // namespace
+
+
 // Initialize the first len bytes of the key with those
 // in the given buffer, and zero-fill the remainder.
 Key::Key(Byte const* buf, int len)
@@ -11,63 +45,265 @@ Key::Key(Byte const* buf, int len)
 }
 
 
-// Returns a reference to a flow. If no flow matches the
-// key, the table-miss flow is returned.
-inline Flow
-Hash_table::search(Key const& k)
-{
-  auto iter = find(k);
-  if (iter == end())
-    return miss_;
-  else
-    return iter->second;
-}
-
-
-// Returns a reference to a flow. If no flow matches the
-// key, the table-miss flow is returned.
-// inline Flow const&
-// Hash_table::search(Key const& k) const
-// {
-//   auto iter = find(k);
-//   if (iter == end())
-//     return miss_;
-//   else
-//     return iter->second;
-// }
-
-// (Openflow standard)
-// If a flow entry with identical match fields and priority already resides in
-// the requested table, then that entry, including its duration,
-// must be cleared from the table, and the new flow entry added.
-inline void
-Hash_table::add(Key const& k, Flow const& f)
-{
-  auto iter = find(k);
-  // If the entry doesn't exist in the table already.
-  if (iter == end())
-    insert({k, f});
-  // If it does exist, erase the existing one and add the new one.
-  else {
-    erase(k);
-    insert({k, f});
+// Creates an exact match table for keys of the given width.
+// Narrow keys are stored in the smallest fixed-width table that
+// can hold them. Wider keys use a table over full-sized keys.
+Table*
+create_exact_table(int id, int size, int width)
+{
+  if (width <= 4)
+    return new Exact_table<4>(id, size, width);
+  if (width <= 8)
+    return new Exact_table<8>(id, size, width);
+  if (width <= 16)
+    return new Exact_table<16>(id, size, width);
+  if (width <= 24)
+    return new Exact_table<24>(id, size, width);
+  if (width <= 32)
+    return new Exact_table<32>(id, size, width);
+  if (width <= 40)
+    return new Exact_table<40>(id, size, width);
+  if (width <= 64)
+    return new Exact_table<64>(id, size, width);
+  return new Hash_table(id, size, width);
+}
+
+
+// Creates an exact match table for keys of the given width whose
+// flows are stored in a cuckoo hash table. Keys are stored as in
+// create_exact_table.
+Table*
+create_cuckoo_table(int id, int size, int width)
+{
+  if (width <= 4)
+    return new Exact_table<4, Cuckoo_table>(id, size, width);
+  if (width <= 8)
+    return new Exact_table<8, Cuckoo_table>(id, size, width);
+  if (width <= 16)
+    return new Exact_table<16, Cuckoo_table>(id, size, width);
+  if (width <= 24)
+    return new Exact_table<24, Cuckoo_table>(id, size, width);
+  if (width <= 32)
+    return new Exact_table<32, Cuckoo_table>(id, size, width);
+  if (width <= 40)
+    return new Exact_table<40, Cuckoo_table>(id, size, width);
+  if (width <= 64)
+    return new Exact_table<64, Cuckoo_table>(id, size, width);
+  return new Cuckoo_hash_table(id, size, width);
+}
+
+
+// Looks up n keys, storing the matching flows in out. Tables that
+// can overlap the memory accesses of several lookups override
+// this.
+void
+Table::search_burst(Key const* keys, Flow** out, int n)
+{
+  for (int i = 0; i < n; ++i)
+    out[i] = search(keys[i]);
+}
+
+
+// Adds n flows whose keys are packed key_size_ bytes apart, as if
+// each were installed in turn. Tables that can build themselves
+// faster from a batch override this.
+void
+Table::add_bulk(Byte const* keys, Flow const* flows, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    install(Key(keys + i * key_size_, key_size_), flows[i]);
+}
+
+
+// Returns the flow for the key with the given priority, or nullptr
+// if there is no such flow. Tables that hold several flows for a
+// key override this; otherwise only the flow found by search can
+// match.
+Flow*
+Table::find_flow(Key const& k, std::size_t pri)
+{
+  Flow* f = search(k);
+  return f != &miss_ && f->pri_ == pri ? f : nullptr;
+}
+
+
+// Removes the flow for the key with the given priority, if any.
+void
+Table::rmv_flow(Key const& k, std::size_t pri)
+{
+  if (find_flow(k, pri))
+    rmv(k);
+}
+
+
+// Sets the table-miss flow.
+void
+Table::insert_miss(Flow const& f)
+{
+  miss_ = f;
+  miss_.time_.created = now_.load(std::memory_order_relaxed);
+  ++version_;
+}
+
+
+// Adds the flow f for the key k. If the flow has timeouts, a timer
+// is scheduled for its expiry. The timer holds the flow's id,
+// priority and key.
+void
+Table::install(Key const& k, Flow f)
+{
+  if (!f.time_.expires()) {
+    add(k, f);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(timer_mutex_);
+  f.time_.created = now_.load(std::memory_order_relaxed);
+  f.time_.timer = ++last_timer_;
+  add(k, f);
+  schedule(k, f);
+}
+
+
+// Schedules a timer for the expiry of the flow f for the key k. The
+// timer mutex must be held. In a wildcard table, the flow matches
+// every bit of the key.
+void
+Table::schedule(Key const& k, Flow const& f)
+{
+  if (type_ == WILDCARD) {
+    Byte ones[fp::key_size];
+    std::fill(ones, ones + key_size_, 0xff);
+    schedule(k, Key(ones, key_size_), f);
+    return;
+  }
+  constexpr int n = 2 * sizeof(std::uint64_t);
+  Byte buf[n + fp::key_size];
+  std::uint64_t pri = f.pri_;
+  std::memcpy(buf, &f.time_.timer, sizeof(std::uint64_t));
+  std::memcpy(buf + sizeof(std::uint64_t), &pri, sizeof(std::uint64_t));
+  std::memcpy(buf + n, k.data, key_size_);
+  timers(n + key_size_).schedule(deadline(f, start_), buf);
+}
+
+
+// Schedules a timer for the expiry of the flow f for the value k
+// under the mask m in a wildcard table. The timer mutex must be
+// held.
+void
+Table::schedule(Key const& k, Key const& m, Flow const& f)
+{
+  constexpr int n = 2 * sizeof(std::uint64_t);
+  Byte buf[n + 2 * fp::key_size];
+  std::uint64_t pri = f.pri_;
+  std::memcpy(buf, &f.time_.timer, sizeof(std::uint64_t));
+  std::memcpy(buf + sizeof(std::uint64_t), &pri, sizeof(std::uint64_t));
+  std::memcpy(buf + n, k.data, key_size_);
+  std::memcpy(buf + n + key_size_, m.data, key_size_);
+  timers(n + 2 * key_size_).schedule(deadline(f, start_), buf);
+}
+
+
+// Returns the table's timers, whose payloads are n bytes, creating
+// them with the first timer. Timers created once the table keeps
+// time start at its last expiry, so that the next expiry fires
+// those that are due rather than only starting the wheel. The
+// timer mutex must be held.
+Timer_wheel&
+Table::timers(int n)
+{
+  if (!timers_) {
+    timers_.reset(new Timer_wheel(n, timeout_tick));
+    if (std::uint64_t now = now_.load(std::memory_order_relaxed))
+      timers_->advance(now, [](Byte const*) { });
   }
+  return *timers_;
+}
+
+
+// Saves the table's flows. Only exact tables support snapshots.
+void
+Table::save(Snapshot_writer&)
+{
+  throw std::runtime_error("Table does not support snapshots");
+}
+
+
+// Replaces the table's flows with those of a snapshot.
+void
+Table::load(Snapshot_reader const&)
+{
+  throw std::runtime_error("Table does not support snapshots");
 }
 
 
-// If no such entry exists, no action is taken.
-inline void
-Hash_table::rmv(Key const& k)
+// Adds the flow f for the key k, learned from a packet being
+// processed by the calling thread. Tables whose state is local to
+// each worker override this.
+void
+Table::learn(Key const& k, Flow f)
 {
-  erase(k);
+  install(k, f);
 }
 
 
-// Resets the miss case to default.
-inline void
-Hash_table::rmv_miss()
+// Returns the memory used by the timers. The timers are read
+// without holding their mutex, so the result is only exact while
+// no flows are being installed or expired.
+Table_memory
+Table::memory() const
 {
-  miss_ = Flow();
+  Table_memory m;
+  if (timers_)
+    m.bytes += timers_->bytes();
+  return m;
+}
+
+
+// Removes the flows whose timeouts have passed at the given time,
+// in nanoseconds. Time must not go backwards. If another thread is
+// already expiring flows, this does nothing.
+//
+// A timer only records when its flow could first expire. When it
+// fires, the flow's deadline is recomputed from its last hit, and
+// the timer is rescheduled if the flow is still live. Timers for
+// flows that were removed or replaced are discarded.
+void
+Table::expire(std::uint64_t now)
+{
+  // Nothing can expire until the next tick.
+  if (!now || now / timeout_tick <= now_.load(std::memory_order_relaxed) / timeout_tick)
+    return;
+  std::unique_lock<std::mutex> lock(timer_mutex_, std::try_to_lock);
+  if (!lock)
+    return;
+  if (!start_)
+    start_ = now;
+  now_.store(now, std::memory_order_relaxed);
+
+  if (miss_.time_.expires() && deadline(miss_, start_) <= now)
+    rmv_miss();
+
+  if (!timers_)
+    return;
+  timers_->advance(now, [this, now](Byte const* p) {
+    std::uint64_t id, pri;
+    std::memcpy(&id, p, sizeof(id));
+    std::memcpy(&pri, p + sizeof(id), sizeof(pri));
+    Key k(p + sizeof(id) + sizeof(pri), key_size_);
+    bool masked = type_ == WILDCARD;
+    Key m = masked ? Key(p + sizeof(id) + sizeof(pri) + key_size_, key_size_) : k;
+    Flow* f = masked ? find_flow(k, m, pri) : find_flow(k, pri);
+    if (!f || f->time_.timer != id)
+      return;
+    std::uint64_t d = deadline(*f, start_);
+    if (d > now)
+      timers_->schedule(d, p);
+    else if (masked)
+      rmv_flow(k, m, pri);
+    else
+      rmv_flow(k, pri);
+  });
 }
 
 } // namespace fp
@@ -3,14 +3,23 @@
 #define FP_TABLE_HPP
 
 #include "flow.hpp"
+#include "open_table.hpp"
+#include "cuckoo_table.hpp"
+#include "bloom_filter.hpp"
+#include "snapshot.hpp"
+#include "hash.hpp"
+#include "timer_wheel.hpp"
 
 #include <boost/functional/hash.hpp>
 #include <farmhash.h>
 
+#include <cassert>
 #include <cstring>
 #include <algorithm>
-#include <unordered_map>
-#include <tr1/unordered_map>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <utility>
 #include <string>
 
@@ -31,6 +40,7 @@ constexpr size_t key_size = 128;
 // A key is a sequence of bytes.
 struct Key
 {
+  Key() = default;
   Key(Byte const*, int);
 
   Byte data[key_size];
@@ -52,56 +62,271 @@ operator!=(Key const& a, Key const& b)
 }
 
 
-// Computes the hash value of a key.
+// Computes the hash value of the first width bytes of a key.
+// Only the bytes that a table actually matches on are hashed.
+//
+// Common widths are hashed a word at a time. Widths that are not
+// a multiple of the word size (e.g., a 13-byte 5-tuple) rely on
+// the key being zero-filled past its width.
 struct Key_hash
 {
-  // TODO: Cast the buffer as integers and unroll the loop.
-  // Alternatively use SSE intrinsics to parallelize the
-  // hash function.
+  Key_hash(int n = key_size)
+    : width(n)
+  { }
+
   std::size_t operator()(Key const& k) const
   {
-    const uint64_t hash = util::Hash64((char*)k.data, 128);
-    return hash;
+    switch (width) {
+      case 4: return hash_half_word(k.data);
+      case 8: return hash_words<1>(k.data);
+      case 13:
+      case 16: return hash_words<2>(k.data);
+      case 40: return hash_words<5>(k.data);
+      default: return util::Hash64((char const*)k.data, width);
+    }
+  }
+
+  int width;
+};
+
+
+// Compares the first width bytes of two keys. As with Key_hash,
+// common widths are compared a word at a time.
+struct Key_equal
+{
+  Key_equal(int n = key_size)
+    : width(n)
+  { }
+
+  bool operator()(Key const& a, Key const& b) const
+  {
+    switch (width) {
+      case 4: return load_half_word(a.data) == load_half_word(b.data);
+      case 8: return equal_words<1>(a.data, b.data);
+      case 13:
+      case 16: return equal_words<2>(a.data, b.data);
+      case 40: return equal_words<5>(a.data, b.data);
+      default: return !std::memcmp(a.data, b.data, width);
+    }
+  }
+
+  int width;
+};
+
+
+// A flow and the keys it matches, as reported when dumping the
+// counters of a table. A key k matches when (k & mask) == value.
+struct Flow_record
+{
+  Key         value;
+  Key         mask;
+  std::size_t pri;
+  std::size_t cookie;
+  Flow_stats  stats;
+};
+
+
+// Statistics on a table's negative cache. A lookup is either
+// rejected by the filter (a negative), or passed on to the table,
+// where it may still miss (a false positive).
+struct Filter_stats
+{
+  std::uint64_t lookups = 0;
+  std::uint64_t negatives = 0;
+  std::uint64_t false_positives = 0;
+  std::size_t   bytes = 0;
+
+  // Returns the fraction of lookups for absent keys that the
+  // filter failed to reject.
+  double false_positive_rate() const
+  {
+    std::uint64_t misses = negatives + false_positives;
+    return misses ? (double)false_positives / misses : 0;
   }
 };
 
 
+// The memory used by a table: the number of flows it holds,
+// including shadowed flows, and the bytes allocated to hold them.
+struct Table_memory
+{
+  std::size_t flows = 0;
+  std::size_t bytes = 0;
+
+  double bytes_per_flow() const { return flows ? (double)bytes / flows : 0; }
+};
+
+
 // The abstract table interface.
 struct Table
 {
   enum Type { EXACT, PREFIX, WILDCARD };
 
+  // The data structure implementing a table. DEFAULT selects the
+  // usual structure for the table type.
+  enum Algorithm { DEFAULT, TUPLE_SPACE, DECISION_TREE, CONCURRENT, CUCKOO };
+
+  // The number of keys that search_burst resolves together.
+  static constexpr int burst_size = 16;
+
   Table(Type t, int id, int k)
-    : type_(t), id_(id), key_size_(k), miss_()
+    : type_(t), id_(id), key_size_(k), miss_(), version_(0),
+      now_(0), start_(0), last_timer_(0)
   { }
 
   virtual ~Table() { }
 
-  virtual Flow search(Key const&) = 0;
-  // virtual Flow const search(Key const&) const = 0;
+  // Returns the flow matching the key, or the table-miss flow if
+  // none matches. The flow is owned by the table, so instructions
+  // may update it in place. The pointer is valid until the table is
+  // next modified.
+  virtual Flow* search(Key const&) = 0;
+  virtual void search_burst(Key const*, Flow**, int);
   virtual void add(Key const&, Flow const&) = 0;
+  virtual void add_bulk(Byte const*, Flow const*, std::size_t);
   virtual void rmv(Key const&) = 0;
   virtual void rmv_miss() = 0;
-  void insert_miss(Flow const& f) { miss_ = f; }
+  void insert_miss(Flow const&);
+
+  // Flows with a given priority, and in wildcard tables, with a
+  // given value and mask. Tables without masked flows find none.
+  virtual Flow* find_flow(Key const&, std::size_t);
+  virtual void  rmv_flow(Key const&, std::size_t);
+  virtual Flow* find_flow(Key const&, Key const&, std::size_t) { return nullptr; }
+  virtual void  rmv_flow(Key const&, Key const&, std::size_t) { }
+
+  // Negative caching of lookups. Tables that do not support a
+  // filter ignore these.
+  virtual void         set_filter(bool) { }
+  virtual void         rebuild_filter() { }
+  virtual Filter_stats filter_stats() const { return Filter_stats(); }
+
+  // Snapshots (see snapshot.hpp). Tables that cannot be saved
+  // throw an exception.
+  virtual void save(Snapshot_writer&);
+  virtual void load(Snapshot_reader const&);
+
+  // Flow expiry.
+  virtual void install(Key const&, Flow);
+  virtual void learn(Key const&, Flow);
+  virtual void expire(std::uint64_t);
+  void         schedule(Key const&, Flow const&);
+  void         schedule(Key const&, Key const&, Flow const&);
+  Timer_wheel& timers(int);
+
+  // Appends a record for each flow in the table, excluding the
+  // table-miss flow.
+  virtual void dump(std::vector<Flow_record>&) const = 0;
+
+  // Returns the memory used by the table. Tables add the storage of
+  // their flows to that of the timers reported here.
+  virtual Table_memory memory() const;
 
   Type type()     const { return type_; }
   int  key_size() const { return key_size_; }
   Flow miss()     const { return miss_; }
   int  id()       const { return id_; }
 
+  // Returns the version of the table's contents. The version
+  // changes whenever a flow, including the table-miss flow, is
+  // added or removed, invalidating the flows previously returned
+  // by search.
+  virtual std::uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
   Type type_;
   int id_;
   int key_size_;
   // NOTE: The default constructed Flow contains the miss rule as its instruction.
   Flow miss_;   // The miss rule
+  std::atomic<std::uint64_t> version_;
+
+  // Timers for flows with timeouts, created with the first such
+  // flow. Each timer holds the flow's timer id, priority and key,
+  // followed by its mask in wildcard tables.
+  // Timers are guarded by the mutex, since flows may be installed
+  // by several threads.
+  std::mutex                   timer_mutex_;
+  std::unique_ptr<Timer_wheel> timers_;
+  std::atomic<std::uint64_t>   now_;        // The time of the last expiry
+  std::uint64_t                start_;      // The time of the first expiry
+  std::uint64_t                last_timer_; // The last timer id assigned
 };
 
 
-// An exact match table.
+// A key of exactly N bytes. Fixed keys are used by exact match
+// tables whose key width is known at compile time, so that the
+// stored key is no larger than the bytes actually matched.
 //
-// TODO: Use an open-address table.
+// N must be 4 or a multiple of 8 so that the key can be hashed
+// and compared a word at a time.
+template<int N>
+struct Fixed_key
+{
+  static_assert(N == 4 || N % 8 == 0, "unsupported key width");
+
+  Fixed_key() = default;
+
+  // Initialize the key with the first N bytes of k.
+  Fixed_key(Key const& k)
+  {
+    std::memcpy(data, k.data, N);
+  }
+
+  // Initialize the first len bytes of the key with those in the
+  // given buffer, and zero-fill the remainder.
+  Fixed_key(Byte const* buf, int len)
+  {
+    std::memcpy(data, buf, len);
+    std::memset(data + len, 0, N - len);
+  }
+
+  Byte data[N];
+};
+
+
+// Computes the hash value of a fixed key.
+template<int N>
+struct Fixed_key_hash
+{
+  std::size_t operator()(Fixed_key<N> const& k) const
+  {
+    return N == 4 ? hash_half_word(k.data) : hash_words<N / 8>(k.data);
+  }
+};
+
+
+// Returns true when two fixed keys are equal.
+template<int N>
+struct Fixed_key_equal
+{
+  bool operator()(Fixed_key<N> const& a, Fixed_key<N> const& b) const
+  {
+    if (N == 4)
+      return load_half_word(a.data) == load_half_word(b.data);
+    else
+      return equal_words<N / 8>(a.data, b.data);
+  }
+};
+
+
+// An exact match table storing keys of type K, which must be
+// constructible from a Key. Flows are stored in a map of type M,
+// which is an open addressing table (see open_table.hpp) by
+// default, or a cuckoo table (see cuckoo_table.hpp).
 //
-// TODO: Support equivalent flows with multiple priorities.
+// A key may have several flows with different priorities. The map
+// holds the flow with the highest priority, so a lookup costs the
+// same no matter how many flows a key has. The others are kept in
+// order of decreasing priority in a separate map, and the next one
+// takes over when the flow in the map is removed.
+//
+// The table may keep a Bloom filter of the hashes of its keys, so
+// that most lookups for absent keys are answered from a single
+// cache line without probing the map. Keys are added to the filter
+// as they are added to the table. Removed keys remain in the filter
+// until it is rebuilt, which happens on demand, when the removed
+// keys outnumber the live ones, or when the table outgrows the
+// filter.
 //
 // TODO: Support move semantics for flows.
 //
@@ -109,23 +334,556 @@ struct Table
 // requires those matches to be translated into OXM's but
 // we want to be protocol agnostic. How do we solve this
 // problem?
-struct Hash_table : Table, std::tr1::unordered_map<Key, Flow, Key_hash>
+template<typename K, typename H, typename E, template<typename...> class M = Open_table>
+struct Basic_hash_table : Table, M<K, Flow, H, E>
 {
-  using Map = std::tr1::unordered_map<Key, Flow, Key_hash>;
+  using Map = M<K, Flow, H, E>;
 
-  Hash_table(int id, int size, int k)
-    : Table(Table::EXACT, id, k), Map(size)
+  // Flows that are hidden by a flow with a higher priority.
+  using Shadow_map = Open_table<K, std::vector<Flow>, H, E>;
+
+  Basic_hash_table(int id, int size, int k, H const& h = H(), E const& e = E())
+    : Table(Table::EXACT, id, k), Map(size, h, e), shadowed_(0, h, e)
   { }
 
-  Flow      search(Key const&);
-  // Flow const search(Key const&) const;
+  Flow* search(Key const&);
+  void  search_burst(Key const*, Flow**, int);
 
   void add(Key const&, Flow const&);
+  void add_bulk(Byte const*, Flow const*, std::size_t);
   void rmv(Key const&);
   void rmv_miss();
+
+  using Table::find_flow;
+  using Table::rmv_flow;
+  Flow* find_flow(Key const&, std::size_t);
+  void  rmv_flow(Key const&, std::size_t);
+
+  void         set_filter(bool);
+  void         rebuild_filter();
+  Filter_stats filter_stats() const;
+
+  void dump(std::vector<Flow_record>&) const;
+
+  Table_memory memory() const;
+
+  void save(Snapshot_writer&);
+  void load(Snapshot_reader const&);
+
+private:
+  void put(K const&, Flow const&, std::size_t);
+  void shadow(K const&, Flow const&);
+  bool adoptable(Snapshot_reader const&) const;
+  static std::uint64_t hash_check(H const&);
+  bool filtered(std::size_t);
+  void erased();
+
+  Shadow_map shadowed_;
+
+  std::unique_ptr<Bloom_filter> filter_;
+  Filter_stats                  filter_stats_;
+  std::size_t                   stale_ = 0; // Removed keys in the filter
+};
+
+
+// Returns a pointer to a flow. If no flow matches the
+// key, the table-miss flow is returned.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline Flow*
+Basic_hash_table<K, H, E, M>::search(Key const& k)
+{
+  if (!filter_) {
+    if (Flow* f = this->find(k))
+      return f;
+    else
+      return &miss_;
+  }
+
+  std::size_t h = this->hash_function()(k);
+  if (filtered(h))
+    return &miss_;
+  if (Flow* f = this->find(k, h))
+    return f;
+  ++filter_stats_.false_positives;
+  return &miss_;
+}
+
+
+// Returns true if the filter shows that no key has the hash h.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline bool
+Basic_hash_table<K, H, E, M>::filtered(std::size_t h)
+{
+  ++filter_stats_.lookups;
+  if (filter_->contains(h))
+    return false;
+  ++filter_stats_.negatives;
+  return true;
+}
+
+
+// Looks up n keys, storing the matching flows in out. Each group
+// of keys is hashed and prefetched before any of them is probed,
+// so that the cache misses of the group overlap rather than being
+// taken one after another. Keys rejected by the filter are not
+// probed.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::search_burst(Key const* keys, Flow** out, int n)
+{
+  std::size_t h[burst_size];
+  bool absent[burst_size];
+  for (int i = 0; i < n; i += burst_size) {
+    int m = std::min(n - i, burst_size);
+    for (int j = 0; j < m; ++j) {
+      h[j] = this->hash_function()(keys[i + j]);
+      absent[j] = filter_ && filtered(h[j]);
+      if (!absent[j])
+        this->prefetch(h[j]);
+    }
+    for (int j = 0; j < m; ++j) {
+      Flow* f = absent[j] ? nullptr : this->find(keys[i + j], h[j]);
+      if (!f && !absent[j] && filter_)
+        ++filter_stats_.false_positives;
+      out[i + j] = f ? f : &miss_;
+    }
+  }
+}
+
+
+// (Openflow standard)
+// If a flow entry with identical match fields and priority already resides in
+// the requested table, then that entry, including its duration,
+// must be cleared from the table, and the new flow entry added.
+//
+// A flow with a different priority is added alongside the existing
+// flows for the key.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline void
+Basic_hash_table<K, H, E, M>::add(Key const& k, Flow const& f)
+{
+  K const& key = k;
+  put(key, f, this->hash_function()(key));
+  ++version_;
+}
+
+
+// Adds the flow f for k, whose hash value is h, without changing
+// the version.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::put(K const& k, Flow const& f, std::size_t h)
+{
+  auto ins = this->insert(k, f, h);
+  if (ins.second && filter_) {
+    if (filter_->size() < filter_->capacity())
+      filter_->insert(h);
+    else
+      rebuild_filter();
+  }
+  if (!ins.second) {
+    Flow& top = *ins.first;
+    if (f.pri_ > top.pri_) {
+      shadow(k, top);
+      top = f;
+    } else if (f.pri_ < top.pri_) {
+      shadow(k, f);
+    } else {
+      // If it does exist, replace the existing entry with the new one.
+      top = f;
+    }
+  }
+}
+
+
+// Adds n flows whose keys are packed key_size_ bytes apart, with
+// the same effect as installing each in turn. The map is sized for
+// all of them up front, so that it does not rehash along the way,
+// and the flows are inserted in the order of the slots where their
+// probes start, so that the map is filled from front to back
+// rather than at random.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::add_bulk(Byte const* keys, Flow const* flows, std::size_t n)
+{
+  this->reserve(this->size() + n);
+
+  // Order the flows by the high bits of their starting slots with a
+  // counting sort. The sort is stable, so flows for the same key
+  // keep their order, and the last of several with the same
+  // priority wins.
+  std::size_t bins = std::min<std::size_t>(1 << 16, next_power_of_two(n));
+  int shift = 0;
+  while ((this->capacity() - 1) >> shift >= bins)
+    ++shift;
+  std::vector<std::size_t> hashes(n);
+  std::vector<std::uint32_t> count(bins + 1);
+  for (std::size_t i = 0; i < n; ++i) {
+    hashes[i] = this->hash_function()(K(keys + i * key_size_, key_size_));
+    ++count[(this->home(hashes[i]) >> shift) + 1];
+  }
+  for (std::size_t b = 0; b < bins; ++b)
+    count[b + 1] += count[b];
+  std::vector<std::size_t> order(n);
+  for (std::size_t i = 0; i < n; ++i)
+    order[count[this->home(hashes[i]) >> shift]++] = i;
+
+  std::unique_lock<std::mutex> lock(timer_mutex_, std::defer_lock);
+  if (std::any_of(flows, flows + n, [](Flow const& f) { return f.time_.expires(); }))
+    lock.lock();
+  for (std::size_t i : order) {
+    Byte const* p = keys + i * key_size_;
+    if (!flows[i].time_.expires()) {
+      put(K(p, key_size_), flows[i], hashes[i]);
+      continue;
+    }
+    Flow f = flows[i];
+    f.time_.created = now_.load(std::memory_order_relaxed);
+    f.time_.timer = ++last_timer_;
+    put(K(p, key_size_), f, hashes[i]);
+    schedule(Key(p, key_size_), f);
+  }
+  ++version_;
+}
+
+
+// Adds f to the flows hidden for k, replacing any with the same
+// priority.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::shadow(K const& k, Flow const& f)
+{
+  std::vector<Flow>& v = *shadowed_.insert(k, {}).first;
+  auto i = std::find_if(v.begin(), v.end(),
+                        [&f](Flow const& g) { return g.pri_ <= f.pri_; });
+  if (i != v.end() && i->pri_ == f.pri_)
+    *i = f;
+  else
+    v.insert(i, f);
+}
+
+
+// Removes every flow for the key. If no such entry exists, no
+// action is taken.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline void
+Basic_hash_table<K, H, E, M>::rmv(Key const& k)
+{
+  if (!this->erase(k))
+    return;
+  if (!shadowed_.empty())
+    shadowed_.erase(k);
+  erased();
+  ++version_;
+}
+
+
+// Notes that a key was erased from the map. The filter is rebuilt
+// once it holds more removed keys than live ones.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline void
+Basic_hash_table<K, H, E, M>::erased()
+{
+  if (filter_ && ++stale_ > this->size())
+    rebuild_filter();
+}
+
+
+// Returns the flow for the key with the given priority, or nullptr
+// if there is no such flow.
+template<typename K, typename H, typename E, template<typename...> class M>
+Flow*
+Basic_hash_table<K, H, E, M>::find_flow(Key const& k, std::size_t pri)
+{
+  Flow* top = this->find(k);
+  if (!top || top->pri_ == pri)
+    return top;
+  if (std::vector<Flow>* v = shadowed_.find(k)) {
+    for (Flow& f : *v) {
+      if (f.pri_ == pri)
+        return &f;
+    }
+  }
+  return nullptr;
+}
+
+
+// Removes the flow for the key with the given priority. If it was
+// the flow with the highest priority, the next one takes its place.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::rmv_flow(Key const& k, std::size_t pri)
+{
+  Flow* top = this->find(k);
+  if (!top)
+    return;
+  std::vector<Flow>* v = shadowed_.find(k);
+  if (top->pri_ == pri) {
+    if (!v) {
+      this->erase(k);
+      erased();
+    } else {
+      *top = v->front();
+      v->erase(v->begin());
+      if (v->empty())
+        shadowed_.erase(k);
+    }
+  } else {
+    if (!v)
+      return;
+    auto i = std::find_if(v->begin(), v->end(),
+                          [pri](Flow const& f) { return f.pri_ == pri; });
+    if (i == v->end())
+      return;
+    v->erase(i);
+    if (v->empty())
+      shadowed_.erase(k);
+  }
+  ++version_;
+}
+
+
+// Resets the miss case to default.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline void
+Basic_hash_table<K, H, E, M>::rmv_miss()
+{
+  miss_ = Flow();
+  ++version_;
+}
+
+
+// Enables or disables the filter. The statistics are reset.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::set_filter(bool on)
+{
+  filter_stats_ = Filter_stats();
+  if (on) {
+    filter_.reset(new Bloom_filter(0));
+    rebuild_filter();
+  } else {
+    filter_.reset();
+  }
+}
+
+
+// Rebuilds the filter from the keys in the table, sizing it for
+// twice as many keys so that the table can grow before the filter
+// must be rebuilt again. Does nothing if the filter is disabled.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::rebuild_filter()
+{
+  if (!filter_)
+    return;
+  std::unique_ptr<Bloom_filter> f(new Bloom_filter(2 * this->size()));
+  this->for_each([&](K const& k, Flow const&) {
+    f->insert(this->hash_function()(k));
+  });
+  filter_ = std::move(f);
+  filter_stats_.bytes = filter_->bytes();
+  stale_ = 0;
+}
+
+
+template<typename K, typename H, typename E, template<typename...> class M>
+inline Filter_stats
+Basic_hash_table<K, H, E, M>::filter_stats() const
+{
+  return filter_stats_;
+}
+
+
+// Returns the memory used by the map, the shadowed flows and the
+// filter, and the counters of every flow.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline Table_memory
+Basic_hash_table<K, H, E, M>::memory() const
+{
+  Table_memory m = Table::memory();
+  m.flows += this->size();
+  m.bytes += Map::bytes() + shadowed_.bytes();
+  if (filter_)
+    m.bytes += filter_->bytes();
+  this->for_each([&](K const&, Flow const& f) {
+    m.bytes += f.count_.bytes();
+  });
+  shadowed_.for_each([&](K const&, std::vector<Flow> const& fs) {
+    m.flows += fs.size();
+    m.bytes += fs.capacity() * sizeof(Flow);
+    for (Flow const& f : fs)
+      m.bytes += f.count_.bytes();
+  });
+  return m;
+}
+
+
+// Appends a record for each flow. Every bit of the key is
+// matched.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline void
+Basic_hash_table<K, H, E, M>::dump(std::vector<Flow_record>& v) const
+{
+  Byte ones[fp::key_size];
+  std::fill(ones, ones + key_size_, 0xff);
+
+  // Keys are copied through a zero-filled buffer, since a stored
+  // key holds no more than its own width.
+  auto key = [this](K const& k) {
+    Byte buf[fp::key_size] = {};
+    std::memcpy(buf, &k, std::min(sizeof(K), sizeof(buf)));
+    return Key(buf, key_size_);
+  };
+  this->for_each([&](K const& k, Flow const& f) {
+    v.push_back({key(k), Key(ones, key_size_), f.pri_, f.cookie_, f.count_.read()});
+  });
+  shadowed_.for_each([&](K const& k, std::vector<Flow> const& fs) {
+    Key value = key(k);
+    for (Flow const& f : fs)
+      v.push_back({value, Key(ones, key_size_), f.pri_, f.cookie_, f.count_.read()});
+  });
+}
+
+
+// Returns the hash of a fixed key, which identifies the hash
+// function used to lay out a saved map.
+template<typename K, typename H, typename E, template<typename...> class M>
+inline std::uint64_t
+Basic_hash_table<K, H, E, M>::hash_check(H const& h)
+{
+  Byte buf[fp::key_size];
+  for (std::size_t i = 0; i < fp::key_size; ++i)
+    buf[i] = i * 37 + 11;
+  return h(K(Key(buf, fp::key_size)));
+}
+
+
+// Saves the flows of the table, along with the control bytes of
+// the map and the slot of each flow in it.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::save(Snapshot_writer& w)
+{
+  this->settle();
+  w.control(Map::layout, hash_check(this->hash_function()), this->control(), this->capacity());
+  for (std::size_t i = 0; i < this->capacity(); ++i) {
+    if (Map::occupied(this->control()[i])) {
+      auto const& e = this->slot(i);
+      w.flow(i, reinterpret_cast<Byte const*>(&e.key), e.value);
+    }
+  }
+  shadowed_.for_each([&](K const& k, std::vector<Flow> const& fs) {
+    for (Flow const& f : fs)
+      w.flow(Snapshot_record::no_slot, reinterpret_cast<Byte const*>(&k), f);
+  });
+}
+
+
+// Returns true if the snapshot's map can be adopted as it is: it
+// has the same layout and hash function as this table's map, and
+// each of its occupied slots has exactly one flow.
+template<typename K, typename H, typename E, template<typename...> class M>
+bool
+Basic_hash_table<K, H, E, M>::adoptable(Snapshot_reader const& r) const
+{
+  std::size_t n = r.capacity();
+  if (r.layout() != Map::layout || r.hash_check() != hash_check(this->hash_function())
+      || !Map::adoptable(r.control(), n))
+    return false;
+
+  std::vector<bool> seen(n);
+  std::size_t full = 0;
+  for (std::size_t i = 0; i < r.flows(); ++i) {
+    std::uint64_t s = r.record(i).slot;
+    if (s == Snapshot_record::no_slot)
+      continue;
+    if (s >= n || !Map::occupied(r.control()[s]) || seen[s])
+      return false;
+    seen[s] = true;
+    ++full;
+  }
+  return full == (std::size_t)std::count_if(r.control(), r.control() + n, Map::occupied);
+}
+
+
+// Replaces the flows of the table with those of the snapshot. When
+// the snapshot's map can be adopted, each flow is stored in its
+// saved slot without being rehashed. Otherwise, the flows are
+// added as if they were new. Flows with timeouts get new timers.
+template<typename K, typename H, typename E, template<typename...> class M>
+void
+Basic_hash_table<K, H, E, M>::load(Snapshot_reader const& r)
+{
+  if (r.key_size() != key_size_)
+    throw std::runtime_error("Table snapshot has a different key width");
+
+  std::lock_guard<std::mutex> lock(timer_mutex_);
+  bool adopt = adoptable(r);
+  this->clear();
+  shadowed_.clear();
+  if (adopt)
+    this->adopt(r.copy_control(), r.capacity());
+  else
+    this->reserve(r.flows());
+
+  for (std::size_t i = 0; i < r.flows(); ++i) {
+    Key k(r.key(i), key_size_);
+    Flow f = r.flow(i);
+    if (f.time_.expires()) {
+      f.time_.created = now_.load(std::memory_order_relaxed);
+      f.time_.timer = ++last_timer_;
+    }
+    std::uint64_t s = r.record(i).slot;
+    if (!adopt)
+      add(k, f);
+    else if (s == Snapshot_record::no_slot)
+      shadow(k, f);
+    else
+      this->construct(s, k, f);
+    if (f.time_.expires())
+      schedule(k, f);
+  }
+  rebuild_filter();
+  ++version_;
+}
+
+
+// An exact match table over full-sized keys. Only the first
+// key_size_ bytes of each key are hashed and compared.
+struct Hash_table : Basic_hash_table<Key, Key_hash, Key_equal>
+{
+  Hash_table(int id, int size, int k)
+    : Basic_hash_table(id, size, k, Key_hash(k), Key_equal(k))
+  { }
 };
 
 
+// A cuckoo hash table over full-sized keys.
+struct Cuckoo_hash_table : Basic_hash_table<Key, Key_hash, Key_equal, Cuckoo_table>
+{
+  Cuckoo_hash_table(int id, int size, int k)
+    : Basic_hash_table(id, size, k, Key_hash(k), Key_equal(k))
+  { }
+};
+
+
+// An exact match table whose keys are exactly N bytes wide.
+// The hash and comparison functions are unrolled for N.
+template<int N, template<typename...> class M = Open_table>
+struct Exact_table : Basic_hash_table<Fixed_key<N>, Fixed_key_hash<N>, Fixed_key_equal<N>, M>
+{
+  using Base = Basic_hash_table<Fixed_key<N>, Fixed_key_hash<N>, Fixed_key_equal<N>, M>;
+
+  Exact_table(int id, int size, int k)
+    : Base(id, size, k)
+  { assert(k <= N); }
+};
+
+
+Table* create_exact_table(int, int, int);
+Table* create_cuckoo_table(int, int, int);
+
 
 } // end namespace fp
 
@@ -0,0 +1,47 @@
+#ifndef FP_TEST_BENCH_HPP
+#define FP_TEST_BENCH_HPP
+
+// Helpers shared by the benchmarks.
+
+#include "util/table.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+
+// Returns a mixed version of x (splitmix64).
+inline std::uint64_t
+mix(std::uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+
+// Stores the first n bytes of the i-th key of the key set at p.
+// Keys are at most 16 bytes wide.
+inline void
+make_key(std::uint64_t i, fp::Byte* p, int n)
+{
+  fp::Byte buf[16];
+  std::uint64_t a = mix(i);
+  std::uint64_t b = mix(a);
+  std::memcpy(buf, &a, 8);
+  std::memcpy(buf + 8, &b, 8);
+  std::memcpy(p, buf, n);
+}
+
+
+// Returns the i-th key of the key set, n bytes wide.
+inline fp::Key
+make_key(std::uint64_t i, int n)
+{
+  fp::Byte buf[16];
+  make_key(i, buf, n);
+  return fp::Key(buf, n);
+}
+
+
+#endif
@@ -0,0 +1,108 @@
+#include "util/table.hpp"
+#include "util/rule_file.hpp"
+#include "util/test/bench.hpp"
+
+// Measures the rate at which exact match tables are initialized
+// from a large rule set.
+//
+// Usage: bulk-bench [ <rules> [ <path> ] ]
+//
+// By default, 1M rules are added to an empty table one at a time,
+// in a single batch, and by streaming them from a rule file written
+// to /tmp/bulk-bench.rules. Rates are reported in rules per second.
+// Keys are 13-byte 5-tuples.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+
+
+// Reports the rate of a run that added n rules since start, and
+// checks that the table holds them all.
+void
+report(char const* name, Table& tbl, vector<Byte> const& keys, uint64_t n,
+       steady_clock::time_point start)
+{
+  double secs = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+  uint64_t found = 0;
+  for (uint64_t i = 0; i < n; ++i)
+    found += tbl.search(Key(&keys[i * key_width], key_width)) != &tbl.miss_;
+  if (found != n)
+    cerr << "error: found " << found << " of " << n << '\n';
+  cout << name << "\t" << secs * 1000 << "ms\t" << n / secs / 1e6 << "M rules/s\n";
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nrules = 1 << 20;
+  char const* path = "/tmp/bulk-bench.rules";
+  if (argc > 1)
+    nrules = stoull(argv[1]);
+  if (argc > 2)
+    path = argv[2];
+
+  vector<Byte> keys(nrules * key_width);
+  for (uint64_t i = 0; i < nrules; ++i)
+    make_key(i, &keys[i * key_width], key_width);
+  vector<Flow> flows(nrules);
+
+  {
+    unique_ptr<Table> tbl(create_exact_table(1, 0, key_width));
+    steady_clock::time_point start = steady_clock::now();
+    for (uint64_t i = 0; i < nrules; ++i)
+      tbl->install(Key(&keys[i * key_width], key_width), flows[i]);
+    report("install", *tbl, keys, nrules, start);
+  }
+  {
+    unique_ptr<Table> tbl(create_exact_table(1, 0, key_width));
+    steady_clock::time_point start = steady_clock::now();
+    tbl->add_bulk(keys.data(), flows.data(), nrules);
+    report("bulk", *tbl, keys, nrules, start);
+  }
+
+  // Write the rules, naming the default instructions.
+  Dl_info info;
+  if (!dladdr(reinterpret_cast<void*>(&Drop_miss), &info) || !info.dli_sname) {
+    cerr << "error: no symbol for the instructions\n";
+    return 1;
+  }
+  {
+    ofstream os(path);
+    static char const digits[] = "0123456789abcdef";
+    string line;
+    for (uint64_t i = 0; i < nrules; ++i) {
+      line.clear();
+      for (int j = 0; j < key_width; ++j) {
+        line += digits[keys[i * key_width + j] >> 4];
+        line += digits[keys[i * key_width + j] & 15];
+      }
+      line += ' ';
+      line += info.dli_sname;
+      line += '\n';
+      os << line;
+    }
+  }
+  {
+    unique_ptr<Table> tbl(create_exact_table(1, 0, key_width));
+    steady_clock::time_point start = steady_clock::now();
+    ifstream is(path);
+    uint64_t n = load_rules(*tbl, is, dlopen(nullptr, RTLD_LAZY));
+    report("file", *tbl, keys, n, start);
+  }
+  std::remove(path);
+}
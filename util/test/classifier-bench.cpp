@@ -0,0 +1,296 @@
+#include "util/wildcard_table.hpp"
+#include "util/decision_tree.hpp"
+
+// Compares wildcard table algorithms on synthetic 5-tuple rule
+// sets in the style of ClassBench access control lists.
+//
+// Usage: classifier-bench [ <rules> ... ]
+//
+// By default, rule sets of 1K, 10K and 100K rules are measured.
+// Addresses are prefixes of mixed lengths, ports are wildcards,
+// exact values or ranges expressed as a prefix, and the protocol
+// is exact or a wildcard. A sample of lookups is checked against
+// a linear search of the rules, both after the table is built and
+// after 10% of the rules have been removed. Finally, flows with
+// idle timeouts are checked to expire from both tables.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+// Source and destination addresses, ports, and protocol.
+static constexpr int key_width = 13;
+
+static constexpr int nlookups = 1 << 16;
+static constexpr int npasses = 4;
+static constexpr int nchecks = 1 << 12;
+
+
+// A rule of the synthetic rule set.
+struct Rule
+{
+  Byte value[key_width];
+  Byte mask[key_width];
+  int  pri;
+  int  id;
+};
+
+
+// Stores the low w bytes of v at p in native order.
+void
+put(Byte* p, uint64_t v, int w)
+{
+  uint32_t v32 = v;
+  uint16_t v16 = v;
+  Byte v8 = v;
+  switch (w) {
+    case 4: std::memcpy(p, &v32, 4); break;
+    case 2: std::memcpy(p, &v16, 2); break;
+    default: std::memcpy(p, &v8, 1); break;
+  }
+}
+
+
+// Sets a field of the rule r to the first len bits of v.
+void
+set_field(Rule& r, int off, int w, uint64_t v, int len)
+{
+  uint64_t m = len ? ~uint64_t(0) << (8 * w - len) : 0;
+  if (w < 8)
+    m &= (uint64_t(1) << (8 * w)) - 1;
+  put(r.value + off, v & m, w);
+  put(r.mask + off, m, w);
+}
+
+
+// Returns n distinct rules with random priorities.
+vector<Rule>
+make_rules(int n, mt19937_64& gen)
+{
+  // Address prefix lengths, biased towards hosts and /24s.
+  discrete_distribution<int> lens {
+    4, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 4,
+    1, 1, 1, 2, 2, 2, 1, 12, 1, 1, 1, 2, 2, 2, 1, 30
+  };
+
+  vector<Rule> rules;
+  set<string> seen;
+  while ((int)rules.size() < n) {
+    Rule r;
+    set_field(r, 0, 4, gen(), lens(gen));
+    set_field(r, 4, 4, gen(), lens(gen));
+
+    // Ports are wildcards, well-known ports, or ranges.
+    for (int off : {8, 10}) {
+      switch (gen() % 10) {
+        case 0: case 1: case 2: case 3: case 4:
+          set_field(r, off, 2, 0, 0);
+          break;
+        case 5: case 6: case 7: case 8:
+          set_field(r, off, 2, gen() % 1024, 16);
+          break;
+        default:
+          set_field(r, off, 2, gen(), 6 + gen() % 8);
+          break;
+      }
+    }
+    if (gen() % 5)
+      set_field(r, 12, 1, gen() % 2 ? 6 : 17, 8);
+    else
+      set_field(r, 12, 1, 0, 0);
+
+    string s((char const*)r.value, key_width);
+    s.append((char const*)r.mask, key_width);
+    if (seen.insert(s).second)
+      rules.push_back(r);
+  }
+
+  // Assign distinct priorities in a random order.
+  vector<int> pri(n);
+  for (int i = 0; i < n; ++i)
+    pri[i] = i + 1;
+  shuffle(pri.begin(), pri.end(), gen);
+  for (int i = 0; i < n; ++i)
+    rules[i].pri = pri[i];
+  for (int i = 0; i < n; ++i)
+    rules[i].id = i + 1;
+  return rules;
+}
+
+
+// Returns a lookup key. Most keys match some rule, and the
+// remainder are uniformly random.
+Key
+make_lookup(vector<Rule> const& rules, mt19937_64& gen)
+{
+  Byte buf[key_width];
+  for (Byte& b : buf)
+    b = gen();
+  if (gen() % 4) {
+    Rule const& r = rules[gen() % rules.size()];
+    for (int i = 0; i < key_width; ++i)
+      buf[i] = r.value[i] | (buf[i] & ~r.mask[i]);
+  }
+  return Key(buf, key_width);
+}
+
+
+// Returns the identifier of the highest priority rule matching k
+// by linear search, or 0 if no rule matches.
+unsigned
+reference(vector<Rule> const& rules, Key const& k)
+{
+  Rule const* best = nullptr;
+  for (Rule const& r : rules) {
+    int j = 0;
+    while (j < key_width && (k.data[j] & r.mask[j]) == r.value[j])
+      ++j;
+    if (j == key_width && (!best || r.pri > best->pri))
+      best = &r;
+  }
+  return best ? best->id : 0;
+}
+
+
+// Returns the number of lookups whose results differ from the
+// reference.
+int
+check(Classifier& tbl, vector<Rule> const& rules, vector<Key> const& keys)
+{
+  int errors = 0;
+  for (int i = 0; i < nchecks; ++i)
+    errors += tbl.search(keys[i])->egress_ != reference(rules, keys[i]);
+  return errors;
+}
+
+
+void
+run(char const* name, Classifier& tbl, vector<Rule> const& rules, vector<Key> const& keys)
+{
+  steady_clock::time_point start = steady_clock::now();
+  for (std::size_t i = 0; i < rules.size(); ++i) {
+    Flow f;
+    f.pri_ = rules[i].pri;
+    f.egress_ = rules[i].id;
+    tbl.add(Key(rules[i].value, key_width), Key(rules[i].mask, key_width), f);
+  }
+  if (Decision_tree_table* t = dynamic_cast<Decision_tree_table*>(&tbl))
+    t->sync();
+  steady_clock::time_point end = steady_clock::now();
+  double build_ms = duration_cast<milliseconds>(end - start).count();
+
+  int errors = check(tbl, rules, keys);
+
+  tbl.stats_ = Classifier_stats();
+  unsigned sum = 0;
+  start = steady_clock::now();
+  for (int i = 0; i < npasses; ++i) {
+    for (Key const& k : keys)
+      sum += tbl.search(k)->egress_;
+  }
+  end = steady_clock::now();
+  double lookup_ns = duration_cast<nanoseconds>(end - start).count() / (double)(npasses * nlookups);
+
+  // Remove every tenth rule and check again.
+  vector<Rule> rest;
+  for (std::size_t i = 0; i < rules.size(); ++i) {
+    if (i % 10)
+      rest.push_back(rules[i]);
+    else
+      tbl.rmv(Key(rules[i].value, key_width), Key(rules[i].mask, key_width));
+  }
+  if (Decision_tree_table* t = dynamic_cast<Decision_tree_table*>(&tbl))
+    t->sync();
+  errors += check(tbl, rest, keys);
+
+  cout << name << "\t" << rules.size() << " rules"
+       << "\tbuild " << build_ms << "ms"
+       << "\tlookup " << lookup_ns << "ns"
+       << "\tprobes " << tbl.stats().probes_per_lookup();
+  if (Wildcard_table* t = dynamic_cast<Wildcard_table*>(&tbl))
+    cout << "\ttuples " << t->tuples();
+  if (Decision_tree_table* t = dynamic_cast<Decision_tree_table*>(&tbl))
+    cout << "\tnodes " << t->nodes() << "\treplicas " << t->replicas();
+  cout << "\terrors " << errors
+       << "\t(" << sum << ")\n";
+}
+
+
+// Returns the number of errors in the expiry of wildcard flows
+// with idle timeouts, installed with and without a mask.
+int
+check_expiry(Classifier& tbl)
+{
+  constexpr uint64_t sec = 1000000000;
+  Decision_tree_table* tree = dynamic_cast<Decision_tree_table*>(&tbl);
+  Rule a {}, b {}, c {};
+  set_field(a, 0, 4, 0x0a000000, 8);
+  set_field(b, 0, 4, 0x0b000001, 32);
+  set_field(c, 0, 4, 0x0c000000, 8);
+  Flow f;
+  f.time_ = Flow_timeouts(1);
+  f.pri_ = 1;
+  f.egress_ = 1;
+  tbl.install(Key(a.value, key_width), Key(a.mask, key_width), f);
+  f.egress_ = 2;
+  tbl.install(Key(b.value, key_width), f);
+  Flow g;
+  g.pri_ = 1;
+  g.egress_ = 3;
+  tbl.install(Key(c.value, key_width), Key(c.mask, key_width), g);
+  if (tree)
+    tree->sync();
+
+  int errors = 0;
+  tbl.expire(sec);
+  errors += tbl.search(Key(a.value, key_width))->egress_ != 1;
+  errors += tbl.search(Key(b.value, key_width))->egress_ != 2;
+  tbl.expire(5 * sec);
+  tbl.expire(10 * sec);
+  if (tree)
+    tree->sync();
+  errors += tbl.search(Key(a.value, key_width)) != &tbl.miss_;
+  errors += tbl.search(Key(b.value, key_width)) != &tbl.miss_;
+  errors += tbl.search(Key(c.value, key_width))->egress_ != 3;
+  return errors;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  vector<int> sizes {1000, 10000, 100000};
+  if (argc > 1) {
+    sizes.clear();
+    for (int i = 1; i < argc; ++i)
+      sizes.push_back(stoi(argv[i]));
+  }
+
+  for (int n : sizes) {
+    mt19937_64 gen(n);
+    vector<Rule> rules = make_rules(n, gen);
+    vector<Key> keys;
+    keys.reserve(nlookups);
+    for (int i = 0; i < nlookups; ++i)
+      keys.push_back(make_lookup(rules, gen));
+
+    Wildcard_table tss(1, n, key_width);
+    run("tss", tss, rules, keys);
+    Decision_tree_table tree(2, n, key_width);
+    run("tree", tree, rules, keys);
+  }
+
+  Wildcard_table tss(1, 16, key_width);
+  Decision_tree_table tree(2, 16, key_width);
+  cout << "expiry\ttss errors " << check_expiry(tss)
+       << "\ttree errors " << check_expiry(tree) << '\n';
+}
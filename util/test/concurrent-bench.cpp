@@ -0,0 +1,154 @@
+#include "util/concurrent_table.hpp"
+#include "util/test/bench.hpp"
+
+// Measures the lookup throughput of the concurrent exact match
+// table from one thread up to the number of cores.
+//
+// Usage: concurrent-bench [ <flows> [ <threads> ] ]
+//
+// By default, the table holds 1M flows and the benchmark runs with
+// 1 to hardware_concurrency() lookup threads. Each configuration
+// runs twice: once with a read-only table, and once with another
+// thread replacing flows as fast as it can. Lookups are made one
+// key at a time with search, and then in bursts with search_burst;
+// before the runs, the flows found by bursts, hits and misses, are
+// checked against those found by search.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+static constexpr int nlookups = 1 << 22;
+
+
+// Runs nthreads lookup threads, each doing nlookups lookups, and
+// returns the aggregate rate in millions of lookups per second.
+// Threads look up bursts of keys if burst is true. If update is
+// non-null, a writer runs concurrently and its rate is stored
+// there.
+double
+run(Concurrent_table& tbl, uint64_t nflows, int nthreads, bool burst, double* update)
+{
+  atomic<bool> stop(false);
+  atomic<uint64_t> found(0);
+  atomic<uint64_t> updates(0);
+
+  thread writer;
+  if (update) {
+    writer = thread([&] {
+      mt19937_64 gen(7);
+      Flow f;
+      uint64_t n = 0;
+      while (!stop.load(memory_order_relaxed)) {
+        tbl.add(make_key(gen() % nflows, key_width), f);
+        ++n;
+      }
+      updates += n;
+    });
+  }
+
+  steady_clock::time_point start = steady_clock::now();
+  vector<thread> readers;
+  for (int t = 0; t < nthreads; ++t) {
+    readers.emplace_back([&, t] {
+      rcu_enter();
+      mt19937_64 gen(t);
+      uint64_t n = 0;
+      Key keys[Table::burst_size];
+      Flow* flows[Table::burst_size];
+      for (int i = 0; i < nlookups; i += Table::burst_size) {
+        for (Key& k : keys)
+          k = make_key(gen() % nflows, key_width);
+        if (burst)
+          tbl.search_burst(keys, flows, Table::burst_size);
+        else {
+          for (int j = 0; j < Table::burst_size; ++j)
+            flows[j] = tbl.search(keys[j]);
+        }
+        for (Flow* f : flows)
+          n += f != &tbl.miss_;
+        if (i % 64 == 0)
+          rcu_quiescent();
+      }
+      rcu_leave();
+      found += n;
+    });
+  }
+  for (thread& t : readers)
+    t.join();
+  steady_clock::time_point end = steady_clock::now();
+
+  stop = true;
+  if (update)
+    writer.join();
+  rcu_reclaim();
+
+  if (found != (uint64_t)nthreads * nlookups)
+    cerr << "error: found " << found << " of " << (uint64_t)nthreads * nlookups << '\n';
+
+  double secs = duration_cast<nanoseconds>(end - start).count() / 1e9;
+  if (update)
+    *update = updates / secs / 1e6;
+  return nthreads * (double)nlookups / secs / 1e6;
+}
+
+
+// Returns the number of keys for which search_burst and search
+// find different flows. Every other key misses.
+int
+check_burst(Concurrent_table& tbl, uint64_t nflows)
+{
+  mt19937_64 gen(3);
+  Key keys[Table::burst_size];
+  Flow* flows[Table::burst_size];
+  int errors = 0;
+  for (int i = 0; i < nlookups / 16; i += Table::burst_size) {
+    for (int j = 0; j < Table::burst_size; ++j)
+      keys[j] = make_key(gen() % nflows + (j % 2) * nflows, key_width);
+    tbl.search_burst(keys, flows, Table::burst_size);
+    for (int j = 0; j < Table::burst_size; ++j)
+      errors += flows[j] != tbl.search(keys[j]);
+  }
+  return errors;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 20;
+  int maxthreads = std::max(1u, thread::hardware_concurrency());
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+  if (argc > 2)
+    maxthreads = stoi(argv[2]);
+
+  Concurrent_table tbl(1, nflows, key_width);
+  Flow flow;
+  for (uint64_t i = 0; i < nflows; ++i)
+    tbl.add(make_key(i, key_width), flow);
+
+  cout << "search_burst\terrors " << check_burst(tbl, nflows) << '\n';
+  for (bool burst : {false, true}) {
+    for (int n = 1; n <= maxthreads; ++n) {
+      cout << (burst ? "search_burst\t" : "search\t") << n << " threads";
+      double ro = run(tbl, nflows, n, burst, nullptr);
+      double up;
+      double rw = run(tbl, nflows, n, burst, &up);
+      cout << "\tread-only " << ro << "M/s"
+           << "\twith updates " << rw << "M/s"
+           << "\tupdates " << up << "M/s\n";
+    }
+  }
+}
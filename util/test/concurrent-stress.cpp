@@ -0,0 +1,145 @@
+#include "util/concurrent_table.hpp"
+#include "util/test/bench.hpp"
+
+// Checks that concurrent lookups see consistent flows while other
+// threads add, replace and remove flows.
+//
+// Usage: concurrent-stress [ <readers> [ <seconds> ] ]
+//
+// A set of stable flows is added up front and never changed;
+// readers must always find them. Each writer owns a disjoint range
+// of keys, which it adds, replaces and removes at random, starting
+// from a small table so that it is rebuilt often. Every flow
+// records the key it was added for, and readers check that each
+// flow they find belongs to the key they looked up. Finally, the
+// contents of the table are compared with the writers' own record
+// of their keys. Returns nonzero on any error.
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+static constexpr uint64_t nstable = 1 << 12;
+static constexpr uint64_t nwriter_keys = 1 << 14;
+static constexpr int nwriters = 2;
+
+
+// Returns a flow for the i-th key. The version distinguishes
+// replacements.
+inline Flow
+make_flow(uint64_t i, unsigned version)
+{
+  Flow f;
+  f.cookie_ = i;
+  f.egress_ = version;
+  return f;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  int nreaders = std::max(2u, thread::hardware_concurrency());
+  int seconds = 2;
+  if (argc > 1)
+    nreaders = stoi(argv[1]);
+  if (argc > 2)
+    seconds = stoi(argv[2]);
+
+  Concurrent_table tbl(1, 16, key_width);
+  for (uint64_t i = 0; i < nstable; ++i)
+    tbl.add(make_key(i, key_width), make_flow(i, 0));
+
+  atomic<bool> stop(false);
+  atomic<uint64_t> errors(0);
+  atomic<uint64_t> lookups(0);
+  atomic<uint64_t> updates(0);
+
+  // Readers look up stable and changing keys.
+  vector<thread> threads;
+  for (int r = 0; r < nreaders; ++r) {
+    threads.emplace_back([&, r] {
+      rcu_enter();
+      mt19937_64 gen(r);
+      uint64_t n = 0;
+      uint64_t bad = 0;
+      while (!stop.load(memory_order_relaxed)) {
+        uint64_t i = gen() % (nstable + nwriters * nwriter_keys);
+        Flow* f = tbl.search(make_key(i, key_width));
+        if (f == &tbl.miss_)
+          bad += i < nstable;
+        else
+          bad += f->cookie_ != i;
+        if (++n % 64 == 0)
+          rcu_quiescent();
+      }
+      rcu_leave();
+      errors += bad;
+      lookups += n;
+    });
+  }
+
+  // Writers update their own keys, tracking the expected version.
+  vector<vector<int>> expected(nwriters, vector<int>(nwriter_keys, -1));
+  for (int w = 0; w < nwriters; ++w) {
+    threads.emplace_back([&, w] {
+      mt19937_64 gen(1000 + w);
+      uint64_t base = nstable + w * nwriter_keys;
+      vector<int>& mine = expected[w];
+      uint64_t n = 0;
+      while (!stop.load(memory_order_relaxed)) {
+        uint64_t j = gen() % nwriter_keys;
+        if (gen() % 3) {
+          ++mine[j];
+          tbl.add(make_key(base + j, key_width), make_flow(base + j, mine[j]));
+        } else {
+          tbl.rmv(make_key(base + j, key_width));
+          mine[j] = -1;
+        }
+        ++n;
+      }
+      updates += n;
+    });
+  }
+
+  this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  for (thread& t : threads)
+    t.join();
+
+  // Compare the final contents with the writers' records.
+  uint64_t wrong = 0;
+  size_t live = nstable;
+  for (int w = 0; w < nwriters; ++w) {
+    for (uint64_t j = 0; j < nwriter_keys; ++j) {
+      uint64_t i = nstable + w * nwriter_keys + j;
+      Flow* f = tbl.search(make_key(i, key_width));
+      int v = expected[w][j];
+      if (v < 0)
+        wrong += f != &tbl.miss_;
+      else
+        wrong += f == &tbl.miss_ || f->cookie_ != i || (int)f->egress_ != v;
+      live += v >= 0;
+    }
+  }
+  wrong += tbl.size() != live;
+  rcu_reclaim();
+
+  cout << nreaders << " readers"
+       << "\tlookups " << lookups
+       << "\tupdates " << updates
+       << "\tcapacity " << tbl.capacity()
+       << "\tpending " << rcu_pending()
+       << "\terrors " << errors + wrong << '\n';
+  return errors + wrong ? 1 : 0;
+}
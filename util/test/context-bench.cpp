@@ -0,0 +1,138 @@
+#include "util/context.hpp"
+
+// Compares constructing a context for each packet with resetting a
+// context that is reused for every packet.
+//
+// Usage: context-bench [ <packets> ]
+//
+// By default, 16M packets are decoded by binding two headers and
+// five fields, as a 5-tuple application would, and then given
+// actions that rewrite its destination MAC address and output it.
+// Times are reported in nanoseconds and cycles per packet, along
+// with the number of heap allocations per packet, which should be
+// zero.
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#if defined(__x86_64__)
+#  include <x86intrin.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int packet_size = 64;
+
+// Header and field identifiers.
+enum { eth, ipv4 };
+enum { eth_type, ip_src, ip_dst, udp_src, udp_dst };
+
+static Byte const mac[6] = {0x02, 0, 0, 0, 0, 1};
+
+uint64_t sink;
+uint64_t allocs; // Calls to operator new
+
+
+// Counts every allocation made by the program.
+void*
+operator new(size_t n)
+{
+  ++allocs;
+  if (void* p = malloc(n ? n : 1))
+    return p;
+  throw bad_alloc();
+}
+
+
+void
+operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+
+void
+operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+
+// Returns a cycle count, if the target has one.
+inline uint64_t
+cycles()
+{
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+
+// Decodes the packet in the context.
+inline void
+decode(Context& cxt)
+{
+  cxt.bind_header(eth);
+  cxt.bind_field(eth_type, 12, 2);
+  cxt.advance(14);
+  cxt.bind_header(ipv4);
+  cxt.bind_field(ip_src, 26, 4);
+  cxt.bind_field(ip_dst, 30, 4);
+  cxt.bind_field(udp_src, 34, 2);
+  cxt.bind_field(udp_dst, 36, 2);
+  cxt.write_action(Set_action(0, 0, sizeof(mac), mac));
+  cxt.write_action(Output_action{1});
+  sink += cxt.get_field_binding(udp_dst).offset + cxt.actions_.size();
+}
+
+
+// Runs f for each packet and reports the time per packet.
+template<typename F>
+void
+run(char const* name, uint64_t npackets, F f)
+{
+  uint64_t a = allocs;
+  steady_clock::time_point start = steady_clock::now();
+  uint64_t c = cycles();
+  for (uint64_t i = 0; i < npackets; ++i)
+    f(i);
+  c = cycles() - c;
+  double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+  a = allocs - a;
+  cout << name << "\t" << ns / npackets << "ns/packet";
+  if (c)
+    cout << "\t" << double(c) / npackets << " cycles/packet";
+  cout << "\t" << double(a) / npackets << " allocs/packet\n";
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t npackets = 1 << 24;
+  if (argc > 1)
+    npackets = stoull(argv[1]);
+
+  Byte buf[packet_size] = {};
+
+  run("construct", npackets, [&](uint64_t i) {
+    Context cxt(nullptr, buf);
+    cxt.packet().timestamp_ = i;
+    decode(cxt);
+  });
+
+  Context cxt(nullptr, buf);
+  run("reset", npackets, [&](uint64_t i) {
+    cxt.reset(buf);
+    cxt.packet().timestamp_ = i;
+    decode(cxt);
+  });
+}
@@ -0,0 +1,92 @@
+#include "util/table.hpp"
+#include "util/test/bench.hpp"
+
+// Measures the effect of an exact table's negative cache on a
+// miss-heavy workload.
+//
+// Usage: filter-bench [ <flows> [ <miss percent> ] ]
+//
+// By default, the table holds 1M flows and 95% of lookups are for
+// keys that are not in the table. Lookups are run with the filter
+// disabled and enabled, and again after a quarter of the flows have
+// been removed, before and after rebuilding the filter. Keys are
+// 13-byte 5-tuples.
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+static constexpr int nlookups = 1 << 22;
+
+
+// Looks up the keys, and reports the time per lookup and the
+// filter's statistics.
+void
+run(char const* name, Table& tbl, vector<Key> const& keys)
+{
+  Filter_stats before = tbl.filter_stats();
+  int found = 0;
+  steady_clock::time_point start = steady_clock::now();
+  for (Key const& k : keys)
+    found += tbl.search(k) != &tbl.miss_;
+  steady_clock::time_point end = steady_clock::now();
+  double ns = duration_cast<nanoseconds>(end - start).count() / (double)keys.size();
+
+  // Count only this run's lookups.
+  Filter_stats s = tbl.filter_stats();
+  s.negatives -= before.negatives;
+  s.false_positives -= before.false_positives;
+  cout << name
+       << "\tlookup " << ns << "ns"
+       << "\thits " << found
+       << "\tnegatives " << s.negatives
+       << "\tfalse positives " << s.false_positives
+       << "\trate " << s.false_positive_rate()
+       << "\tfilter " << s.bytes << " bytes\n";
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 20;
+  int miss = 95;
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+  if (argc > 2)
+    miss = stoi(argv[2]);
+
+  unique_ptr<Table> tbl(create_exact_table(1, nflows, key_width));
+  Flow flow;
+  for (uint64_t i = 0; i < nflows; ++i)
+    tbl->add(make_key(i, key_width), flow);
+
+  // Keys beyond nflows are not in the table.
+  mt19937_64 gen(42);
+  vector<Key> keys;
+  keys.reserve(nlookups);
+  for (int i = 0; i < nlookups; ++i) {
+    uint64_t n = gen() % nflows;
+    keys.push_back(make_key(int(gen() % 100) < miss ? n + nflows : n, key_width));
+  }
+
+  tbl->set_filter(false);
+  run("unfiltered", *tbl, keys);
+  tbl->set_filter(true);
+  run("filtered", *tbl, keys);
+
+  for (uint64_t i = 0; i < nflows / 4; ++i)
+    tbl->rmv(make_key(i, key_width));
+  run("removed", *tbl, keys);
+  tbl->rebuild_filter();
+  run("rebuilt", *tbl, keys);
+}
@@ -0,0 +1,194 @@
+#include "util/flow_cache.hpp"
+#include "util/context.hpp"
+#include "util/system.hpp"
+#include "util/decision_tree.hpp"
+#include "util/rcu.hpp"
+#include "util/test/bench.hpp"
+
+// Measures the cost of processing packets with and without the
+// flow cache.
+//
+// Usage: flow-cache-bench [ <flows> [ <packets> ] ]
+//
+// By default, 1M packets from 1K UDP flows are run through a
+// pipeline of three exact tables: one matching the Ethernet type,
+// one the IPv4 addresses, and one the UDP ports. Every packet of a
+// flow takes the same path, so after the first packet of each flow
+// all packets should hit the cache. Finally, the port table is
+// replaced with a decision tree, and the cached pipeline is run
+// again while a rule is added and removed every 16K packets, so that
+// the tree is rebuilt in the background. Entries that refer to the
+// flows of a replaced tree must be invalidated. Times are reported
+// in nanoseconds per packet.
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int packet_size = 64;
+
+// Field identifiers.
+enum { eth_type, ip_src, ip_dst, udp_src, udp_dst };
+
+Table* types;
+Table* hosts;
+Table* ports;
+
+
+// Stores the packet of the i-th flow at p.
+void
+make_packet(uint64_t i, Byte* p)
+{
+  uint64_t h = mix(i);
+  std::memset(p, 0, packet_size);
+  p[12] = 0x08;                   // IPv4
+  p[14] = 0x45;
+  p[23] = 17;                     // UDP
+  std::memcpy(p + 26, &h, 8);     // Addresses
+  std::memcpy(p + 34, &i, 4);     // Ports
+}
+
+
+// Flow instructions of the pipeline.
+void
+to_hosts(Flow*, Table*, Context* cxt)
+{
+  fp_goto_table(cxt, hosts, 2, ip_src, ip_dst);
+}
+
+
+void
+to_ports(Flow*, Table*, Context* cxt)
+{
+  fp_goto_table(cxt, ports, 2, udp_src, udp_dst);
+}
+
+
+void
+output(Flow* f, Table*, Context* cxt)
+{
+  cxt->set_output_port(f->egress_);
+}
+
+
+// Decodes the packet and runs it through the pipeline.
+void
+pipeline(Context& cxt)
+{
+  cxt.bind_field(eth_type, 12, 2);
+  cxt.bind_field(ip_src, 26, 4);
+  cxt.bind_field(ip_dst, 30, 4);
+  cxt.bind_field(udp_src, 34, 2);
+  cxt.bind_field(udp_dst, 36, 2);
+  fp_goto_table(&cxt, types, 1, eth_type);
+}
+
+
+// Runs the packets through the pipeline, using the cache if it is
+// not null, and reports the time per packet. If churn is true, a
+// rule that matches no packet is added to or removed from the port
+// table every 16K packets.
+void
+run(char const* name, vector<Byte>& packets, uint64_t npackets, Flow_cache* cache, bool churn = false)
+{
+  uint64_t nflows = packets.size() / packet_size;
+  uint64_t ports_out = 0;
+  Byte none[4] = {0xff, 0xff, 0xff, 0xff};
+  steady_clock::time_point start = steady_clock::now();
+  for (uint64_t i = 0; i < npackets; ++i) {
+    if (churn && i % (1 << 14) == 0) {
+      if (i % (1 << 15))
+        ports->rmv(Key(none, 4));
+      else
+        ports->add(Key(none, 4), Flow(0, Flow_counters(), output, Flow_timeouts(), 0, 0, 1));
+    }
+    rcu_quiescent();
+    Context cxt(nullptr, Packet(&packets[(i % nflows) * packet_size], packet_size));
+    cxt.packet().timestamp_ = i + 1;
+    Flow_trace trace;
+    if (!cache || !cache->replay(cxt, trace)) {
+      pipeline(cxt);
+      if (cache)
+        cache->record(cxt, trace);
+    }
+    ports_out += cxt.output_port_id();
+  }
+  double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+  if (ports_out != npackets)
+    cerr << "error: " << npackets - ports_out << " packets were not output\n";
+  cout << name << "\t" << ns / npackets << "ns/packet";
+  if (cache) {
+    Flow_cache_stats s = cache->stats();
+    cout << "\t" << s.hit_rate() * 100 << "% hits\t" << s.invalidations << " invalidations";
+  }
+  cout << '\n';
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 10;
+  uint64_t npackets = 1 << 20;
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+  if (argc > 2)
+    npackets = stoull(argv[2]);
+
+  vector<Byte> packets(nflows * packet_size);
+  for (uint64_t i = 0; i < nflows; ++i)
+    make_packet(i, &packets[i * packet_size]);
+
+  // Populate the tables with the flows of each packet. Keys are
+  // gathered in native byte order.
+  vector<Table*> tables;
+  types = create_exact_table(0, 0, 2);
+  hosts = create_exact_table(1, 0, 8);
+  ports = create_exact_table(2, 0, 4);
+  tables = {types, hosts, ports};
+  Byte type[2] = {0x00, 0x08};
+  types->add(Key(type, 2), Flow(0, Flow_counters(), to_hosts, Flow_timeouts(), 0, 0));
+  for (uint64_t i = 0; i < nflows; ++i) {
+    Byte const* p = &packets[i * packet_size];
+    Byte k[8];
+    for (int j = 0; j < 4; ++j) {
+      k[j] = p[29 - j];
+      k[4 + j] = p[33 - j];
+    }
+    hosts->add(Key(k, 8), Flow(0, Flow_counters(), to_ports, Flow_timeouts(), 0, 0));
+    for (int j = 0; j < 2; ++j) {
+      k[j] = p[35 - j];
+      k[2 + j] = p[37 - j];
+    }
+    ports->add(Key(k, 4), Flow(0, Flow_counters(), output, Flow_timeouts(), 0, 0, 1));
+  }
+
+  run("pipeline", packets, npackets, nullptr);
+  Flow_cache cache(tables);
+  run("cached", packets, npackets, &cache);
+
+  // Match ports with a decision tree, which is rebuilt by another
+  // thread whenever a rule changes.
+  Decision_tree_table* tree = new Decision_tree_table(2, nflows, 4);
+  vector<Flow_record> records;
+  ports->dump(records);
+  for (Flow_record const& r : records)
+    tree->add(r.value, Flow(0, Flow_counters(), output, Flow_timeouts(), 0, 0, 1));
+  tree->sync();
+  delete ports;
+  ports = tree;
+  tables[2] = tree;
+  Flow_cache rebuilt(tables);
+  run("rebuilding", packets, npackets, &rebuilt, true);
+  tree->sync();
+  rcu_leave();
+
+  for (Table* t : tables)
+    delete t;
+}
@@ -0,0 +1,182 @@
+#include "util/gather.hpp"
+#include "util/context.hpp"
+#include "util/system.hpp"
+#include "util/endian.hpp"
+#include "util/test/bench.hpp"
+
+// Compares building 5-tuple keys with fp_gather and with a gather
+// plan.
+//
+// Usage: gather-bench [ <packets> [ <iterations> ] ]
+//
+// By default, the keys of 1K UDP packets, whose fields are already
+// bound, are gathered 4K times each: first on their own, and then
+// as part of a lookup in an exact table holding every flow. Times
+// are reported in nanoseconds per packet. Finally, the cost of
+// converting fields of common widths to native byte order is
+// compared with that of std::reverse, in nanoseconds per field.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int packet_size = 64;
+static constexpr int key_width = 13;
+
+// Field identifiers.
+enum { ip_src, ip_dst, ip_proto, udp_src, udp_dst };
+
+uint64_t found;
+uint64_t sink;
+
+
+// Stores the packet of the i-th flow at p.
+void
+make_packet(uint64_t i, Byte* p)
+{
+  uint64_t h = mix(i);
+  std::memset(p, 0, packet_size);
+  p[12] = 0x08;                   // IPv4
+  p[14] = 0x45;
+  p[23] = 17;                     // UDP
+  std::memcpy(p + 26, &h, 8);     // Addresses
+  std::memcpy(p + 34, &i, 4);     // Ports
+}
+
+
+// Returns the key of the context's packet built by fp_gather from
+// the n fields that follow.
+Key
+gather(Context* cxt, int n, ...)
+{
+  va_list args;
+  va_start(args, n);
+  Key k = fp_gather(cxt, key_width, n, args);
+  va_end(args);
+  return k;
+}
+
+
+void
+count(Flow*, Table*, Context*)
+{
+  ++found;
+}
+
+
+// Runs f on each context, iters times, and reports the time per
+// packet.
+template<typename F>
+void
+run(char const* name, vector<unique_ptr<Context>>& cxts, int iters, F f)
+{
+  steady_clock::time_point start = steady_clock::now();
+  for (int i = 0; i < iters; ++i) {
+    for (auto& cxt : cxts)
+      f(*cxt);
+  }
+  double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+  cout << name << "\t" << ns / (double(iters) * cxts.size()) << "ns/packet\n";
+}
+
+
+// Reverses a buffer of fields of width w, and reports the time per
+// field.
+template<typename F>
+void
+report(char const* name, int w, F f)
+{
+  constexpr int nfields = 1 << 10;
+  constexpr int iters = 1 << 12;
+  vector<Byte> buf(nfields * w);
+  for (size_t i = 0; i < buf.size(); ++i)
+    buf[i] = i;
+  steady_clock::time_point start = steady_clock::now();
+  for (int i = 0; i < iters; ++i) {
+    for (int j = 0; j < nfields; ++j)
+      f(&buf[j * w], w);
+  }
+  double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+  sink += buf[0];
+  cout << name << " " << ns / (double(iters) * nfields) << "ns";
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t npackets = 1 << 10;
+  int iters = 1 << 12;
+  if (argc > 1)
+    npackets = stoull(argv[1]);
+  if (argc > 2)
+    iters = stoi(argv[2]);
+
+  vector<Byte> packets(npackets * packet_size);
+  vector<unique_ptr<Context>> cxts;
+  for (uint64_t i = 0; i < npackets; ++i) {
+    Byte* p = &packets[i * packet_size];
+    make_packet(i, p);
+    cxts.emplace_back(new Context(nullptr, Packet(p, packet_size)));
+    Context& cxt = *cxts.back();
+    cxt.bind_field(ip_src, 26, 4);
+    cxt.bind_field(ip_dst, 30, 4);
+    cxt.bind_field(ip_proto, 23, 1);
+    cxt.bind_field(udp_src, 34, 2);
+    cxt.bind_field(udp_dst, 36, 2);
+  }
+
+  Gather_plan plan(key_width, {{ip_src, 4}, {ip_dst, 4}, {ip_proto, 1},
+                               {udp_src, 2}, {udp_dst, 2}});
+
+  // Both must build the same keys.
+  unique_ptr<Table> tbl(create_exact_table(1, 0, key_width));
+  for (auto& cxt : cxts) {
+    Key a = gather(cxt.get(), 5, ip_src, ip_dst, ip_proto, udp_src, udp_dst);
+    Key b;
+    plan.gather(*cxt, b);
+    if (!Key_equal(key_width)(a, b)) {
+      cerr << "error: keys differ\n";
+      return 1;
+    }
+    tbl->add(a, Flow(0, Flow_counters(), count, Flow_timeouts(), 0, 0));
+  }
+
+  uint64_t sum = 0;
+  run("fp_gather", cxts, iters, [&](Context& cxt) {
+    Key k = gather(&cxt, 5, ip_src, ip_dst, ip_proto, udp_src, udp_dst);
+    sum += k.data[0];
+  });
+  run("plan", cxts, iters, [&](Context& cxt) {
+    Key k;
+    plan.gather(cxt, k);
+    sum += k.data[0];
+  });
+  run("fp_goto_table", cxts, iters, [&](Context& cxt) {
+    fp_goto_table(&cxt, tbl.get(), 5, ip_src, ip_dst, ip_proto, udp_src, udp_dst);
+  });
+  run("fp_goto_table_plan", cxts, iters, [&](Context& cxt) {
+    fp_goto_table_plan(&cxt, tbl.get(), &plan);
+  });
+
+  // Byte order conversion of fields, e.g., MAC and IPv6 addresses.
+  for (int w : {2, 4, 6, 8, 16, 40}) {
+    cout << w << " bytes";
+    report(" std::reverse", w, [](Byte* p, int n) { std::reverse(p, p + n); });
+    report(" reverse_bytes", w, [](Byte* p, int n) { reverse_bytes(p, n); });
+    cout << '\n';
+  }
+
+  if (found != 2 * npackets * iters)
+    cerr << "error: found " << found << " of " << 2 * npackets * iters << '\n';
+  sink += sum;
+}
@@ -0,0 +1,127 @@
+#include "util/table.hpp"
+
+// Measures the lookup cost of hashing and comparing only a
+// table's configured key width against hashing and comparing
+// the full key.
+//
+// Usage: key-bench [ <flows> ]
+//
+// For each of the common key widths, the benchmark fills an
+// exact match table with the given number of flows (1M by
+// default) and reports the average time of a successful lookup
+// and the speedup over the full-width key functions. The last
+// column shows the same for the fixed-width table that
+// create_exact_table selects for the width.
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+using Map = Open_table<Key, Flow, Key_hash, Key_equal>;
+
+static constexpr int nlookups = 1 << 22;
+
+
+// Returns a vector of n random keys of the given width.
+vector<Key>
+make_keys(int n, int width)
+{
+  mt19937_64 gen(width);
+  vector<Key> keys;
+  keys.reserve(n);
+  Byte buf[key_size];
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < width; ++j)
+      buf[j] = gen();
+    keys.push_back(Key(buf, width));
+  }
+  return keys;
+}
+
+
+// Returns the average time, in nanoseconds, to find each key
+// in the given order.
+template<typename M>
+double
+time_lookups(M& map, vector<Key> const& keys, vector<int> const& order)
+{
+  Flow flow;
+  for (Key const& k : keys)
+    map.insert(k, flow);
+
+  int found = 0;
+  steady_clock::time_point start = steady_clock::now();
+  for (int i : order)
+    found += map.find(keys[i]) != nullptr;
+  steady_clock::time_point end = steady_clock::now();
+
+  if (found != (int)order.size())
+    cerr << "error: found " << found << " of " << order.size() << '\n';
+  return duration_cast<nanoseconds>(end - start).count() / (double)order.size();
+}
+
+
+// Returns the average lookup time of a table whose key functions
+// examine hash_width bytes.
+double
+run(vector<Key> const& keys, vector<int> const& order, int hash_width)
+{
+  Map map(keys.size(), Key_hash(hash_width), Key_equal(hash_width));
+  return time_lookups(map, keys, order);
+}
+
+
+// Returns the average lookup time of a table of N-byte keys.
+template<int N>
+double
+run_fixed(vector<Key> const& keys, vector<int> const& order)
+{
+  Open_table<Fixed_key<N>, Flow, Fixed_key_hash<N>, Fixed_key_equal<N>> map(keys.size());
+  return time_lookups(map, keys, order);
+}
+
+
+double
+run_fixed(vector<Key> const& keys, vector<int> const& order, int width)
+{
+  if (width <= 4)
+    return run_fixed<4>(keys, order);
+  if (width <= 8)
+    return run_fixed<8>(keys, order);
+  if (width <= 16)
+    return run_fixed<16>(keys, order);
+  return run_fixed<40>(keys, order);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  int nflows = 1 << 20;
+  if (argc > 1)
+    nflows = stoi(argv[1]);
+
+  mt19937 gen(42);
+  uniform_int_distribution<int> dist(0, nflows - 1);
+  vector<int> order(nlookups);
+  for (int& i : order)
+    i = dist(gen);
+
+  for (int width : {4, 8, 13, 16, 40}) {
+    vector<Key> keys = make_keys(nflows, width);
+    double full = run(keys, order, key_size);
+    double part = run(keys, order, width);
+    double fixed = run_fixed(keys, order, width);
+    cout << "width " << width
+         << "\tfull " << full << "ns"
+         << "\tsized " << part << "ns (" << full / part << "x)"
+         << "\tfixed " << fixed << "ns (" << full / fixed << "x)\n";
+  }
+}
@@ -0,0 +1,79 @@
+#include "util/table.hpp"
+#include "util/concurrent_table.hpp"
+#include "util/test/bench.hpp"
+
+// Reports the memory used per flow by each kind of exact match
+// table.
+//
+// Usage: memory-bench [ <flows> ]
+//
+// By default, 1M flows with 13-byte keys (a 5-tuple) are added to
+// each table, and half of them are hit once, so that their counters
+// are allocated. Sizes are reported in bytes per flow, with and
+// without the counters, for counters sized for one worker and for
+// eight.
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+using namespace fp;
+
+static constexpr int key_width = 13;
+
+
+void
+run(char const* name, Table& tbl, uint64_t nflows)
+{
+  for (uint64_t i = 0; i < nflows; ++i)
+    tbl.add(make_key(i, key_width), Flow());
+  Table_memory before = tbl.memory();
+  for (uint64_t i = 0; i < nflows; i += 2)
+    tbl.search(make_key(i, key_width))->count_.hit(64, 1);
+  Table_memory after = tbl.memory();
+
+  if (after.flows != nflows)
+    cerr << "error: " << name << " holds " << after.flows << " flows\n";
+  cout << name << "\t" << before.bytes_per_flow() << " bytes/flow\t"
+       << after.bytes_per_flow() << " bytes/flow with counters\n";
+}
+
+
+void
+run_all(uint64_t nflows)
+{
+  {
+    Hash_table tbl(1, 0, key_width);
+    run("full key", tbl, nflows);
+  }
+  {
+    unique_ptr<Table> tbl(create_exact_table(1, 0, key_width));
+    run("exact", *tbl, nflows);
+  }
+  {
+    unique_ptr<Table> tbl(create_cuckoo_table(1, 0, key_width));
+    run("cuckoo", *tbl, nflows);
+  }
+  {
+    Concurrent_table tbl(1, 0, key_width);
+    run("concurrent", tbl, nflows);
+  }
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 20;
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+
+  cout << "sizeof(Flow) = " << sizeof(Flow) << '\n';
+  for (int workers : {1, 8}) {
+    cout << "workers " << workers << '\n';
+    Flow_counters::set_shards(workers);
+    run_all(nflows);
+  }
+}
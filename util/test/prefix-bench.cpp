@@ -0,0 +1,289 @@
+#include "util/prefix_table.hpp"
+#include "util/endian.hpp"
+
+// Measures longest prefix match lookups against a synthetic RIB
+// whose prefix length distribution resembles that of a full
+// Internet routing table.
+//
+// Usage: prefix-bench [ <ipv4-prefixes> [ <ipv6-prefixes> ] ]
+//
+// By default, the IPv4 table holds 900K prefixes and the IPv6
+// table 200K. Before timing, a sample of lookups is checked
+// against a naive longest prefix match, both after the table is
+// built and after 10% of the prefixes have been removed. Finally,
+// flows installed with an idle timeout, both through the Table
+// interface and with an explicit prefix length, are checked to
+// expire, while a flow without timeouts is kept.
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int nlookups = 1 << 20;
+static constexpr int npasses = 16;
+static constexpr int nchecks = 1 << 16;
+
+
+// An address with its most significant byte first.
+struct Address
+{
+  Byte bytes[16];
+};
+
+
+// A route in the synthetic RIB.
+struct Route
+{
+  Address addr;
+  int     len;
+};
+
+
+// Returns the key for the first w bytes of a in native order.
+Key
+make_key(Address const& a, int w)
+{
+  Byte buf[16];
+  std::memcpy(buf, a.bytes, w);
+  network_to_native_order(buf, w);
+  return Key(buf, w);
+}
+
+
+// Clear the bits of a past len.
+void
+mask(Address& a, int len)
+{
+  for (int i = 0; i < 16; ++i) {
+    int n = len - 8 * i;
+    if (n <= 0)
+      a.bytes[i] = 0;
+    else if (n < 8)
+      a.bytes[i] &= 0xff << (8 - n);
+  }
+}
+
+
+// Returns n routes with lengths drawn from the given weights,
+// indexed by prefix length.
+vector<Route>
+make_rib(int n, vector<double> const& weights, mt19937_64& gen)
+{
+  discrete_distribution<int> lens(weights.begin(), weights.end());
+  vector<Route> rib(n);
+  for (Route& r : rib) {
+    for (Byte& b : r.addr.bytes)
+      b = gen();
+    r.len = lens(gen);
+    mask(r.addr, r.len);
+  }
+  return rib;
+}
+
+
+// A naive longest prefix match over a set of routes.
+struct Reference
+{
+  Reference(int w)
+    : width(w), lens(8 * w + 1)
+  { }
+
+  static string str(Address const& a) { return string((char const*)a.bytes, 16); }
+
+  void add(Route const& r, unsigned v) { lens[r.len][str(r.addr)] = v; }
+  void rmv(Route const& r)             { lens[r.len].erase(str(r.addr)); }
+
+  unsigned search(Address a) const
+  {
+    for (int len = 8 * width; len >= 0; --len) {
+      mask(a, len);
+      auto iter = lens[len].find(str(a));
+      if (iter != lens[len].end())
+        return iter->second;
+    }
+    return 0;
+  }
+
+  int width;
+  vector<unordered_map<string, unsigned>> lens;
+};
+
+
+// Returns a lookup address. Most addresses fall within a route,
+// and the remainder are uniformly random.
+Address
+make_lookup(vector<Route> const& rib, mt19937_64& gen)
+{
+  Address a;
+  for (Byte& b : a.bytes)
+    b = gen();
+  if (gen() % 8) {
+    Route const& r = rib[gen() % rib.size()];
+    Address m = a;
+    mask(m, r.len);
+    for (int i = 0; i < 16; ++i)
+      a.bytes[i] = r.addr.bytes[i] | (a.bytes[i] ^ m.bytes[i]);
+  }
+  return a;
+}
+
+
+// Returns the number of lookups whose results differ from the
+// reference.
+int
+check(Prefix_table& tbl, Reference const& ref, vector<Key> const& keys,
+      vector<Address> const& addrs)
+{
+  int errors = 0;
+  for (int i = 0; i < nchecks; ++i)
+    errors += tbl.search(keys[i])->egress_ != ref.search(addrs[i]);
+  return errors;
+}
+
+
+void
+run(char const* name, int w, int n, vector<double> const& weights)
+{
+  mt19937_64 gen(w);
+  vector<Route> rib = make_rib(n, weights, gen);
+
+  Prefix_table tbl(1, n, w);
+  Reference ref(w);
+
+  steady_clock::time_point start = steady_clock::now();
+  for (int i = 0; i < n; ++i) {
+    Flow f;
+    f.egress_ = i + 1;
+    tbl.add(make_key(rib[i].addr, w), rib[i].len, f);
+  }
+  steady_clock::time_point end = steady_clock::now();
+  double build_ms = duration_cast<milliseconds>(end - start).count();
+
+  // Later duplicates of a route replace earlier ones.
+  for (int i = 0; i < n; ++i)
+    ref.add(rib[i], i + 1);
+
+  vector<Address> addrs(nlookups);
+  vector<Key> keys;
+  keys.reserve(nlookups);
+  for (Address& a : addrs) {
+    a = make_lookup(rib, gen);
+    mask(a, 8 * w);
+    keys.push_back(make_key(a, w));
+  }
+
+  int errors = check(tbl, ref, keys, addrs);
+
+  unsigned sum = 0;
+  start = steady_clock::now();
+  for (int i = 0; i < npasses; ++i) {
+    for (Key const& k : keys)
+      sum += tbl.search(k)->egress_;
+  }
+  end = steady_clock::now();
+  double lookup_ns = duration_cast<nanoseconds>(end - start).count() / (double)(npasses * nlookups);
+
+  // Remove every tenth route and check again.
+  for (int i = 0; i < n; i += 10) {
+    tbl.rmv(make_key(rib[i].addr, w), rib[i].len);
+    ref.rmv(rib[i]);
+  }
+  errors += check(tbl, ref, keys, addrs);
+
+  cout << name << "\t" << tbl.size() << " prefixes"
+       << "\tbuild " << build_ms << "ms"
+       << "\tlookup " << lookup_ns << "ns"
+       << "\tgroups " << tbl.groups()
+       << "\tmemory " << tbl.bytes() / (1 << 20) << "MB"
+       << "\terrors " << errors
+       << "\t(" << sum << ")\n";
+}
+
+
+// Returns the number of flows whose expiry differs from the
+// expected one.
+int
+check_expiry()
+{
+  constexpr uint64_t sec = 1000000000;
+  Prefix_table tbl(1, 16, 4);
+  Table& base = tbl;
+  Address a {{10, 0, 0, 1}};
+  Address b {{10, 1, 0, 0}};
+  Address c {{10, 2, 0, 0}};
+  Flow f;
+  f.time_ = Flow_timeouts(1);
+  f.egress_ = 1;
+  base.install(make_key(a, 4), f);
+  f.egress_ = 2;
+  tbl.install(make_key(b, 4), 16, f);
+  Flow g;
+  g.egress_ = 3;
+  base.install(make_key(c, 4), g);
+
+  int errors = 0;
+  tbl.expire(sec);
+  errors += tbl.size() != 3;
+  tbl.expire(5 * sec);
+  tbl.expire(10 * sec);
+  errors += tbl.search(make_key(a, 4)) != &tbl.miss_;
+  errors += tbl.search(make_key(b, 4)) != &tbl.miss_;
+  errors += tbl.search(make_key(c, 4))->egress_ != 3;
+  return errors;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  int n4 = 900000;
+  int n6 = 200000;
+  if (argc > 1)
+    n4 = stoi(argv[1]);
+  if (argc > 2)
+    n6 = stoi(argv[2]);
+
+  // IPv4 prefix lengths, dominated by /24s.
+  vector<double> v4(33);
+  v4[8] = 0.002;
+  for (int i = 9; i < 16; ++i)
+    v4[i] = 0.0015;
+  v4[16] = 0.014;
+  v4[17] = 0.008;
+  v4[18] = 0.014;
+  v4[19] = 0.028;
+  v4[20] = 0.04;
+  v4[21] = 0.045;
+  v4[22] = 0.12;
+  v4[23] = 0.1;
+  v4[24] = 0.6;
+  v4[32] = 0.002;
+  run("ipv4", 4, n4, v4);
+
+  // IPv6 prefix lengths, dominated by /48s.
+  vector<double> v6(129);
+  v6[28] = 0.01;
+  v6[29] = 0.05;
+  v6[32] = 0.1;
+  v6[33] = 0.02;
+  v6[36] = 0.03;
+  v6[40] = 0.05;
+  v6[44] = 0.1;
+  v6[46] = 0.02;
+  v6[47] = 0.02;
+  v6[48] = 0.58;
+  v6[56] = 0.005;
+  v6[64] = 0.005;
+  v6[128] = 0.01;
+  run("ipv6", 16, n6, v6);
+
+  cout << "expiry\terrors " << check_expiry() << '\n';
+}
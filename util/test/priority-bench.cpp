@@ -0,0 +1,239 @@
+#include "util/table.hpp"
+#include "util/test/bench.hpp"
+
+// Measures exact match tables holding several flows per key with
+// distinct priorities, and checks which flow each key matches.
+//
+// Usage: priority-bench [ <keys> ]
+//
+// First, flows are added to and removed from a single key of each
+// exact table, and after each step the flow that matches the key,
+// and the flows hidden behind it, are checked. Hidden flows with
+// timeouts must expire without disturbing the flow above them.
+//
+// Then, by default, 1M keys are given 1 and then 4 flows each, in
+// increasing order of priority, so that each flow hides the one
+// before it. The benchmark reports the time to add a flow, to look
+// up a key, and to remove the flow with the highest priority of
+// each key, which brings the next one forward. Keys are 13-byte
+// 5-tuples.
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+static constexpr int nlookups = 1 << 22;
+
+
+// Adds a flow with the given priority and egress port for k.
+void
+add(Table& tbl, Key const& k, unsigned pri, unsigned egress)
+{
+  Flow f;
+  f.pri_ = pri;
+  f.egress_ = egress;
+  tbl.add(k, f);
+}
+
+
+// Returns the egress port of the flow that k matches, or 0 if it
+// matches none.
+unsigned
+egress(Table& tbl, Key const& k)
+{
+  Flow* f = tbl.search(k);
+  return f == &tbl.miss_ ? 0 : f->egress_;
+}
+
+
+// Returns the egress port of the flow for k with the given
+// priority, or 0 if there is none.
+unsigned
+egress(Table& tbl, Key const& k, unsigned pri)
+{
+  Flow* f = tbl.find_flow(k, pri);
+  return f ? f->egress_ : 0;
+}
+
+
+// Returns the number of flows in the table's dump.
+size_t
+dumped(Table& tbl)
+{
+  vector<Flow_record> v;
+  tbl.dump(v);
+  return v.size();
+}
+
+
+// Returns the number of steps after which a key of the table
+// matches a different flow, or holds different flows, than
+// expected.
+int
+check_priorities(Table& tbl)
+{
+  Key k = make_key(1, key_width);
+  int errors = 0;
+
+  add(tbl, k, 10, 1);
+  errors += egress(tbl, k) != 1;
+  add(tbl, k, 20, 2);                 // A higher priority wins
+  errors += egress(tbl, k) != 2;
+  errors += egress(tbl, k, 10) != 1;
+  add(tbl, k, 5, 3);                  // A lower one is hidden
+  errors += egress(tbl, k) != 2;
+  errors += egress(tbl, k, 5) != 3;
+  errors += dumped(tbl) != 3;
+  add(tbl, k, 10, 4);                 // The same one replaces
+  errors += egress(tbl, k) != 2;
+  errors += egress(tbl, k, 10) != 4;
+  add(tbl, k, 20, 5);
+  errors += egress(tbl, k) != 5;
+  errors += dumped(tbl) != 3;
+
+  tbl.rmv_flow(k, 20);                // The next one takes over
+  errors += egress(tbl, k) != 4;
+  errors += egress(tbl, k, 20) != 0;
+  tbl.rmv_flow(k, 5);                 // A hidden one goes quietly
+  errors += egress(tbl, k) != 4;
+  errors += egress(tbl, k, 5) != 0;
+  tbl.rmv_flow(k, 7);                 // An absent one is ignored
+  errors += egress(tbl, k) != 4;
+  errors += dumped(tbl) != 1;
+
+  add(tbl, k, 1, 6);
+  tbl.rmv(k);                         // Every flow goes
+  errors += egress(tbl, k) != 0;
+  errors += egress(tbl, k, 1) != 0;
+  errors += egress(tbl, k, 10) != 0;
+  add(tbl, k, 3, 7);
+  tbl.rmv_flow(k, 3);                 // Nothing hidden comes back
+  errors += egress(tbl, k) != 0;
+  errors += dumped(tbl) != 0;
+  return errors;
+}
+
+
+// Returns the number of errors in the expiry of flows hidden by
+// flows with a higher priority, and of flows hiding others.
+int
+check_expiry(Table& tbl)
+{
+  constexpr uint64_t sec = 1000000000;
+  Key a = make_key(2, key_width);
+  Key b = make_key(3, key_width);
+  tbl.expire(sec);
+
+  Flow f;
+  f.pri_ = 1;
+  f.egress_ = 1;
+  f.time_ = Flow_timeouts(1);
+  tbl.install(a, f);                  // Hidden, expires
+  f.pri_ = 2;
+  f.egress_ = 2;
+  tbl.install(b, f);                  // On top, expires
+  Flow g;
+  g.pri_ = 2;
+  g.egress_ = 3;
+  tbl.install(a, g);
+  g.pri_ = 1;
+  g.egress_ = 4;
+  tbl.install(b, g);
+
+  tbl.expire(5 * sec);
+  int errors = 0;
+  errors += egress(tbl, a) != 3;
+  errors += egress(tbl, a, 1) != 0;
+  errors += egress(tbl, b) != 4;
+  errors += egress(tbl, b, 2) != 0;
+  tbl.rmv(a);
+  tbl.rmv(b);
+  return errors;
+}
+
+
+void
+check(char const* name, Table& tbl)
+{
+  cout << name << "\tpriorities errors " << check_priorities(tbl)
+       << "\texpiry errors " << check_expiry(tbl) << '\n';
+}
+
+
+void
+run(char const* name, Table& tbl, uint64_t nkeys, int nflows, vector<uint64_t> const& order)
+{
+  steady_clock::time_point start = steady_clock::now();
+  for (int p = 1; p <= nflows; ++p) {
+    for (uint64_t i = 0; i < nkeys; ++i)
+      add(tbl, make_key(i, key_width), p, p);
+  }
+  steady_clock::time_point end = steady_clock::now();
+  double add_ns = duration_cast<nanoseconds>(end - start).count() / (double)(nkeys * nflows);
+
+  uint64_t sum = 0;
+  start = steady_clock::now();
+  for (uint64_t i : order)
+    sum += egress(tbl, make_key(i, key_width));
+  end = steady_clock::now();
+  double lookup_ns = duration_cast<nanoseconds>(end - start).count() / (double)order.size();
+
+  start = steady_clock::now();
+  for (uint64_t i = 0; i < nkeys; ++i)
+    tbl.rmv_flow(make_key(i, key_width), nflows);
+  end = steady_clock::now();
+  double rmv_ns = duration_cast<nanoseconds>(end - start).count() / (double)nkeys;
+
+  // Every lookup finds the flow with the highest priority, and then
+  // the one below it, if any.
+  int errors = sum != (uint64_t)nflows * order.size();
+  for (uint64_t i = 0; i < nkeys; i += 64)
+    errors += egress(tbl, make_key(i, key_width)) != (unsigned)nflows - 1;
+
+  cout << name << "\t" << nkeys << " keys"
+       << "\t" << nflows << " flows/key"
+       << "\tadd " << add_ns << "ns"
+       << "\tlookup " << lookup_ns << "ns"
+       << "\trmv top " << rmv_ns << "ns"
+       << "\terrors " << errors << '\n';
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nkeys = 1 << 20;
+  if (argc > 1)
+    nkeys = stoull(argv[1]);
+
+  {
+    Hash_table tbl(1, 16, key_width);
+    check("full key", tbl);
+  }
+  {
+    unique_ptr<Table> tbl(create_exact_table(1, 16, key_width));
+    check("exact", *tbl);
+  }
+  {
+    unique_ptr<Table> tbl(create_cuckoo_table(1, 16, key_width));
+    check("cuckoo", *tbl);
+  }
+
+  mt19937_64 gen(42);
+  vector<uint64_t> order(nlookups);
+  for (uint64_t& i : order)
+    i = gen() % nkeys;
+  for (int nflows : {1, 4}) {
+    unique_ptr<Table> tbl(create_exact_table(1, nkeys, key_width));
+    run("exact", *tbl, nkeys, nflows, order);
+  }
+}
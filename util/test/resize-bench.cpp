@@ -0,0 +1,77 @@
+#include "util/table.hpp"
+#include "util/test/bench.hpp"
+
+// Measures the latency of individual insertions into exact match
+// tables that start small and grow.
+//
+// Usage: resize-bench [ <flows> ]
+//
+// By default, 4M flows are added to tables created for 1K flows.
+// Each insertion is timed separately, and the benchmark reports the
+// mean, tail and worst-case insertion times. The open addressing
+// table grows incrementally, so its worst case stays small; the
+// cuckoo table rehashes all at once, and its worst case grows with
+// the number of flows. Keys are 13-byte 5-tuples.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+
+
+void
+run(char const* name, Table& tbl, uint64_t nflows)
+{
+  vector<uint32_t> ns(nflows);
+  Flow flow;
+  steady_clock::time_point begin = steady_clock::now();
+  for (uint64_t i = 0; i < nflows; ++i) {
+    Key k = make_key(i, key_width);
+    steady_clock::time_point start = steady_clock::now();
+    tbl.add(k, flow);
+    steady_clock::time_point end = steady_clock::now();
+    ns[i] = duration_cast<nanoseconds>(end - start).count();
+  }
+  steady_clock::time_point end = steady_clock::now();
+  double total = duration_cast<milliseconds>(end - begin).count();
+
+  double mean = 0;
+  for (uint32_t t : ns)
+    mean += t;
+  mean /= nflows;
+  sort(ns.begin(), ns.end());
+
+  cout << name << "\t" << nflows
+       << "\ttotal " << total << "ms"
+       << "\tmean " << mean << "ns"
+       << "\tp99 " << ns[nflows * 99 / 100] << "ns"
+       << "\tp99.99 " << ns[nflows * 9999 / 10000] << "ns"
+       << "\tmax " << ns.back() / 1000.0 << "us\n";
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 22;
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+
+  {
+    unique_ptr<Table> tbl(create_exact_table(1, 1024, key_width));
+    run("Open_table", *tbl, nflows);
+  }
+  {
+    unique_ptr<Table> tbl(create_cuckoo_table(1, 1024, key_width));
+    run("Cuckoo_table", *tbl, nflows);
+  }
+}
@@ -0,0 +1,140 @@
+#include "util/sharded_table.hpp"
+#include "util/concurrent_table.hpp"
+#include "util/test/bench.hpp"
+
+// Compares a table sharded per worker with a shared concurrent
+// table, as threads learn and look up flows.
+//
+// Usage: sharded-bench [ <flows> [ <threads> ] ]
+//
+// By default, 1M flows are learned and then looked up by 1 to
+// hardware_concurrency() threads. Each flow is steered to one thread
+// by its hash, as flow-affine dispatch would. With the sharded
+// table, each thread learns into its own shard; with the concurrent
+// table, all threads learn into the same table. Rates are reported
+// in millions of operations per second.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+static constexpr int nlookups = 1 << 22;
+
+
+// Returns the keys of the flows steered to each of n threads.
+vector<vector<Key>>
+partition(uint64_t nflows, int n)
+{
+  vector<vector<Key>> keys(n);
+  for (uint64_t i = 0; i < nflows; ++i)
+    keys[steer(mix(i) >> 32, n)].push_back(make_key(i, key_width));
+  return keys;
+}
+
+
+// Runs n threads, each learning its flows into the table and then
+// looking them up. Reports the aggregate rates of both phases.
+void
+run(char const* name, Table& tbl, vector<vector<Key>> const& keys, bool rcu)
+{
+  int n = keys.size();
+  atomic<int> ready(0);
+  atomic<uint64_t> found(0);
+  vector<double> learn(n), lookup(n);
+
+  vector<thread> threads;
+  for (int t = 0; t < n; ++t) {
+    threads.emplace_back([&, t] {
+      set_worker(t);
+      if (rcu)
+        rcu_enter();
+      vector<Key> const& ks = keys[t];
+      Flow flow;
+
+      steady_clock::time_point start = steady_clock::now();
+      for (size_t i = 0; i < ks.size(); ++i) {
+        tbl.learn(ks[i], flow);
+        if (rcu && i % 64 == 0)
+          rcu_quiescent();
+      }
+      steady_clock::time_point mid = steady_clock::now();
+
+      // Wait for every thread to finish learning.
+      ++ready;
+      while (ready.load() < n) {
+        if (rcu)
+          rcu_quiescent();
+      }
+
+      uint64_t hits = 0;
+      steady_clock::time_point resume = steady_clock::now();
+      for (int i = 0; i < nlookups; ++i) {
+        hits += tbl.search(ks[i % ks.size()]) != &tbl.miss_;
+        if (rcu && i % 64 == 0)
+          rcu_quiescent();
+      }
+      steady_clock::time_point end = steady_clock::now();
+      if (rcu)
+        rcu_leave();
+
+      found += hits;
+      learn[t] = ks.size() / (duration_cast<nanoseconds>(mid - start).count() / 1e9);
+      lookup[t] = nlookups / (duration_cast<nanoseconds>(end - resume).count() / 1e9);
+    });
+  }
+  for (thread& t : threads)
+    t.join();
+  if (rcu)
+    rcu_reclaim();
+
+  if (found != (uint64_t)n * nlookups)
+    cerr << "error: found " << found << " of " << (uint64_t)n * nlookups << '\n';
+
+  double l = 0, s = 0;
+  for (int t = 0; t < n; ++t) {
+    l += learn[t];
+    s += lookup[t];
+  }
+  cout << "\t" << name << " learn " << l / 1e6 << "M/s"
+       << " lookup " << s / 1e6 << "M/s";
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 20;
+  int maxthreads = std::max(1u, thread::hardware_concurrency());
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+  if (argc > 2)
+    maxthreads = stoi(argv[2]);
+
+  for (int n = 1; n <= maxthreads; ++n) {
+    vector<vector<Key>> keys = partition(nflows, n);
+    cout << n << " threads";
+    {
+      vector<Table*> shards;
+      for (int i = 0; i < n; ++i)
+        shards.push_back(create_exact_table(1, 0, key_width));
+      Sharded_table tbl(1, key_width, shards);
+      run("sharded", tbl, keys, false);
+    }
+    {
+      Concurrent_table tbl(1, 0, key_width);
+      run("concurrent", tbl, keys, true);
+    }
+    cout << '\n';
+  }
+}
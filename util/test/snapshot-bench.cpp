@@ -0,0 +1,88 @@
+#include "util/table.hpp"
+#include "util/system.hpp"
+#include "util/test/bench.hpp"
+
+// Measures how long it takes to restore an exact match table from
+// a snapshot, compared with adding its flows one at a time.
+//
+// Usage: snapshot-bench [ <flows> [ <path> ] ]
+//
+// By default, 4M flows are saved to /tmp/snapshot-bench.snap. The
+// snapshot is loaded into a table of the same kind, whose map is
+// adopted as saved, and into a cuckoo table, whose flows must be
+// added again. Keys are 13-byte 5-tuples.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <dlfcn.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+
+
+// Returns the milliseconds elapsed since start.
+inline double
+elapsed(steady_clock::time_point start)
+{
+  return duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0;
+}
+
+
+// Loads the snapshot into tbl, and checks that every flow is found.
+void
+load(char const* name, Table& tbl, char const* path, uint64_t nflows)
+{
+  steady_clock::time_point start = steady_clock::now();
+  Snapshot_reader r(path, dlopen(nullptr, RTLD_LAZY));
+  tbl.load(r);
+  double ms = elapsed(start);
+
+  uint64_t found = 0;
+  for (uint64_t i = 0; i < nflows; ++i)
+    found += tbl.search(make_key(i, key_width)) != &tbl.miss_;
+  if (found != nflows)
+    cerr << "error: found " << found << " of " << nflows << '\n';
+  cout << name << "\t" << ms << "ms\n";
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 22;
+  char const* path = "/tmp/snapshot-bench.snap";
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+  if (argc > 2)
+    path = argv[2];
+
+  unique_ptr<Table> tbl(create_exact_table(1, nflows, key_width));
+  Flow flow;
+  steady_clock::time_point start = steady_clock::now();
+  for (uint64_t i = 0; i < nflows; ++i)
+    tbl->add(make_key(i, key_width), flow);
+  cout << "add\t" << elapsed(start) << "ms\n";
+
+  start = steady_clock::now();
+  if (fp_save_table(tbl.get(), path) < 0)
+    return 1;
+  cout << "save\t" << elapsed(start) << "ms\n";
+
+  {
+    unique_ptr<Table> t(create_exact_table(1, 0, key_width));
+    load("adopt", *t, path, nflows);
+  }
+  {
+    unique_ptr<Table> t(create_cuckoo_table(1, 0, key_width));
+    load("re-add", *t, path, nflows);
+  }
+  std::remove(path);
+}
@@ -0,0 +1,333 @@
+#include "util/table.hpp"
+#include "util/context.hpp"
+#include "util/system.hpp"
+#include "util/endian.hpp"
+#include "util/test/bench.hpp"
+
+// Compares the exact match table storage, both open addressing
+// and cuckoo hashing, against the node-based tr1::unordered_map
+// that previously backed Hash_table.
+//
+// Usage: table-bench [ <flows> ... ]
+//
+// By default, the benchmark runs with 1K, 1M and 16M flows. Keys
+// are 13-byte 5-tuples, zero-padded to the full key size. Note
+// that 16M flows requires several gigabytes of memory per table.
+// For each table, the benchmark also reports the load factor and
+// the number of bytes of storage per flow (estimated for the
+// node-based map).
+//
+// The exact and cuckoo tables are then measured through the Table
+// interface, looking up keys one at a time with search and in
+// bursts with search_burst. The flows found by each burst, hits
+// and misses, are checked against those found by search. Finally,
+// fp_goto_table_burst is checked with a packet whose instructions
+// modify the table mid-burst.
+
+#include <tr1/unordered_map>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+using Node_map = std::tr1::unordered_map<Key, Flow, Key_hash>;
+using Open_map = Open_table<Key, Flow, Key_hash>;
+using Cuckoo_map = Cuckoo_table<Key, Flow, Key_hash>;
+
+static constexpr int key_width = 13;
+static constexpr int nlookups = 1 << 22;
+
+
+// Returns a sequence of n lookup indexes in [0, m).
+vector<uint64_t>
+make_lookups(int n, uint64_t m)
+{
+  mt19937_64 gen(42);
+  uniform_int_distribution<uint64_t> dist(0, m - 1);
+  vector<uint64_t> v(n);
+  for (uint64_t& i : v)
+    i = dist(gen);
+  return v;
+}
+
+
+inline Flow*
+lookup(Node_map& m, Key const& k)
+{
+  auto iter = m.find(k);
+  return iter == m.end() ? nullptr : &iter->second;
+}
+
+
+inline Flow*
+lookup(Open_map& m, Key const& k)
+{
+  return m.find(k);
+}
+
+
+inline Flow*
+lookup(Cuckoo_map& m, Key const& k)
+{
+  return m.find(k);
+}
+
+
+inline void
+insert(Node_map& m, Key const& k, Flow const& f)
+{
+  m.insert({k, f});
+}
+
+
+inline void
+insert(Open_map& m, Key const& k, Flow const& f)
+{
+  m.insert(k, f);
+}
+
+
+inline void
+insert(Cuckoo_map& m, Key const& k, Flow const& f)
+{
+  m.insert(k, f);
+}
+
+
+// Returns the load factor and bytes of storage of each map. Nodes
+// are assumed to hold a next pointer along with the entry.
+inline pair<double, size_t>
+storage(Node_map const& m)
+{
+  size_t node = sizeof(pair<Key const, Flow>) + sizeof(void*);
+  return {m.load_factor(), m.bucket_count() * sizeof(void*) + m.size() * node};
+}
+
+
+inline pair<double, size_t>
+storage(Open_map const& m)
+{
+  size_t entry = sizeof(Key) + sizeof(Flow);
+  return {m.size() / (double)m.capacity(), m.capacity() * (1 + entry)};
+}
+
+
+inline pair<double, size_t>
+storage(Cuckoo_map const& m)
+{
+  return {m.size() / (double)m.capacity(), m.bytes()};
+}
+
+
+template<typename Map>
+void
+run(char const* name, uint64_t nflows, vector<uint64_t> const& order)
+{
+  Map map(nflows);
+  Flow flow;
+
+  steady_clock::time_point start = steady_clock::now();
+  for (uint64_t i = 0; i < nflows; ++i)
+    insert(map, make_key(i, key_width), flow);
+  steady_clock::time_point end = steady_clock::now();
+  double insert_ns = duration_cast<nanoseconds>(end - start).count() / (double)nflows;
+
+  // Hits.
+  int found = 0;
+  start = steady_clock::now();
+  for (uint64_t i : order)
+    found += lookup(map, make_key(i, key_width)) != nullptr;
+  end = steady_clock::now();
+  double hit_ns = duration_cast<nanoseconds>(end - start).count() / (double)order.size();
+
+  // Misses. Keys beyond nflows are not in the table.
+  start = steady_clock::now();
+  for (uint64_t i : order)
+    found += lookup(map, make_key(i + nflows, key_width)) != nullptr;
+  end = steady_clock::now();
+  double miss_ns = duration_cast<nanoseconds>(end - start).count() / (double)order.size();
+
+  if (found != (int)order.size())
+    cerr << "error: " << name << " found " << found << " of " << order.size() << '\n';
+
+  pair<double, size_t> mem = storage(map);
+  cout << name << "\t" << nflows
+       << "\tinsert " << insert_ns << "ns"
+       << "\thit " << hit_ns << "ns"
+       << "\tmiss " << miss_ns << "ns"
+       << "\tload " << mem.first
+       << "\t" << mem.second / nflows << " bytes/flow\n";
+}
+
+
+// Looks up the keys of order in groups of burst_size, one at a
+// time if burst is false, and returns the time per lookup in
+// nanoseconds. Keys beyond nflows miss. Keys are built a group at
+// a time in either case.
+double
+time_lookups(Table& tbl, uint64_t nflows, vector<uint64_t> const& order, bool burst, int& found)
+{
+  constexpr int n = Table::burst_size;
+  Key keys[n];
+  Flow* flows[n];
+  steady_clock::time_point start = steady_clock::now();
+  for (size_t i = 0; i + n <= order.size(); i += n) {
+    for (int j = 0; j < n; ++j)
+      keys[j] = make_key(order[i + j], key_width);
+    if (burst)
+      tbl.search_burst(keys, flows, n);
+    else {
+      for (int j = 0; j < n; ++j)
+        flows[j] = tbl.search(keys[j]);
+    }
+    for (int j = 0; j < n; ++j)
+      found += flows[j] != &tbl.miss_;
+  }
+  steady_clock::time_point end = steady_clock::now();
+  return duration_cast<nanoseconds>(end - start).count() / (double)order.size();
+}
+
+
+// Returns the number of keys for which search_burst and search
+// find different flows. Every other key misses.
+int
+check_burst(Table& tbl, uint64_t nflows, vector<uint64_t> const& order)
+{
+  constexpr int n = Table::burst_size;
+  Key keys[n];
+  Flow* flows[n];
+  int errors = 0;
+  for (size_t i = 0; i + n <= order.size(); i += n) {
+    for (int j = 0; j < n; ++j)
+      keys[j] = make_key(order[i + j] + (j % 2) * nflows, key_width);
+    tbl.search_burst(keys, flows, n);
+    for (int j = 0; j < n; ++j)
+      errors += flows[j] != tbl.search(keys[j]);
+  }
+  return errors;
+}
+
+
+void
+run_burst(char const* name, Table& tbl, uint64_t nflows, vector<uint64_t> const& order)
+{
+  Flow flow;
+  for (uint64_t i = 0; i < nflows; ++i) {
+    flow.egress_ = i + 1;
+    tbl.add(make_key(i, key_width), flow);
+  }
+
+  int found = 0;
+  double search_ns = time_lookups(tbl, nflows, order, false, found);
+  double burst_ns = time_lookups(tbl, nflows, order, true, found);
+  int errors = found != 2 * (int)order.size();
+  errors += check_burst(tbl, nflows, order);
+
+  cout << name << "\t" << nflows
+       << "\tsearch " << search_ns << "ns"
+       << "\tsearch_burst " << burst_ns << "ns"
+       << "\terrors " << errors << '\n';
+}
+
+
+// The state of check_goto_burst.
+static constexpr int nburst = Table::burst_size + 4;
+static vector<Key> burst_keys;
+static vector<unsigned> applied;
+
+
+// Records the egress port of the flow applied to a packet. The
+// first packet removes the flow of the second, replaces the flow of
+// the third, and adds enough flows for the table to grow, so that
+// the flows found for the rest of the burst are stale.
+void
+record(Flow* f, Table* tbl, Context*)
+{
+  applied.push_back(f->egress_);
+  if (applied.size() != 1)
+    return;
+  tbl->rmv(burst_keys[1]);
+  tbl->add(burst_keys[2], Flow(0, Flow_counters(), record, Flow_timeouts(), 0, 0, 1000));
+  for (uint64_t i = 0; i < 4096; ++i)
+    tbl->add(make_key(i + nburst, key_width), Flow());
+}
+
+
+// Dispatches nburst packets to an exact table with
+// fp_goto_table_burst, and returns the number of packets to which
+// a different flow than expected was applied.
+int
+check_goto_burst()
+{
+  constexpr int field = 0;
+  unique_ptr<Table> tbl(create_exact_table(1, 16, key_width));
+  tbl->insert_miss(Flow(0, Flow_counters(), record, Flow_timeouts(), 0, 0, 0));
+
+  // Each packet holds its key as a single field, in network order.
+  vector<Byte> packets(nburst * key_width);
+  vector<unique_ptr<Context>> cxts;
+  vector<Context*> ptrs;
+  for (int i = 0; i < nburst; ++i) {
+    Byte* p = &packets[i * key_width];
+    make_key(i, p, key_width);
+    Byte buf[key_width];
+    std::memcpy(buf, p, key_width);
+    network_to_native_order(buf, key_width);
+    burst_keys.push_back(Key(buf, key_width));
+    tbl->add(burst_keys.back(), Flow(0, Flow_counters(), record, Flow_timeouts(), 0, 0, i + 1));
+    cxts.emplace_back(new Context(nullptr, Packet(p, key_width)));
+    cxts.back()->bind_field(field, 0, key_width);
+    ptrs.push_back(cxts.back().get());
+  }
+
+  fp_goto_table_burst(ptrs.data(), nburst, tbl.get(), 1, field);
+
+  vector<unsigned> expected;
+  for (int i = 0; i < nburst; ++i)
+    expected.push_back(i == 1 ? 0 : i == 2 ? 1000 : i + 1);
+  int errors = applied.size() != expected.size();
+  for (size_t i = 0; i < std::min(applied.size(), expected.size()); ++i)
+    errors += applied[i] != expected[i];
+  return errors;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  vector<uint64_t> sizes;
+  for (int i = 1; i < argc; ++i)
+    sizes.push_back(stoull(argv[i]));
+  if (sizes.empty())
+    sizes = {1 << 10, 1 << 20, 1 << 24};
+
+  for (uint64_t n : sizes) {
+    vector<uint64_t> order = make_lookups(nlookups, n);
+    run<Node_map>("tr1::unordered_map", n, order);
+    run<Open_map>("Open_table", n, order);
+    run<Cuckoo_map>("Cuckoo_table", n, order);
+  }
+
+  for (uint64_t n : sizes) {
+    vector<uint64_t> order = make_lookups(nlookups, n);
+    {
+      unique_ptr<Table> tbl(create_exact_table(1, n, key_width));
+      run_burst("exact", *tbl, n, order);
+    }
+    {
+      unique_ptr<Table> tbl(create_cuckoo_table(1, n, key_width));
+      run_burst("cuckoo", *tbl, n, order);
+    }
+  }
+
+  cout << "fp_goto_table_burst\terrors " << check_goto_burst() << '\n';
+}
@@ -0,0 +1,239 @@
+#include "util/table.hpp"
+#include "util/test/bench.hpp"
+
+// Measures the expiry of flows with timeouts, and checks which
+// flows the timers remove.
+//
+// Usage: timer-bench [ <flows> ]
+//
+// First, a handful of flows with idle and hard timeouts are
+// installed and the clock is advanced past the first and second
+// level boundaries of the timer wheel (256 ms and 65.5 s). Flows
+// that matched packets must be rescheduled rather than removed,
+// hard timeouts must win over matches, and the timers of replaced
+// flows must be discarded. A flow must also expire when the clock
+// jumps past its deadline at once.
+//
+// Then, by default, 1M flows with idle timeouts of up to 300 s are
+// installed, a quarter of them match a packet at 10 s, and the
+// clock is advanced in 10 ms steps until every flow has expired.
+// The benchmark reports the time to install the flows and to
+// expire them, and checks the flows left midway and at the end.
+// Keys are 13-byte 5-tuples.
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+using namespace fp;
+
+static constexpr int key_width = 13;
+
+static constexpr uint64_t ms = 1000000;
+static constexpr uint64_t sec = 1000 * ms;
+
+// Flows are installed once the clock has started, at this time.
+static constexpr uint64_t origin = sec;
+
+// The interval at which the clock is advanced.
+static constexpr uint64_t step = 10 * ms;
+
+
+// Advances the table's clock from the time t to the time end, in
+// steps. Times are relative to the origin.
+void
+advance(Table& tbl, uint64_t& t, uint64_t end)
+{
+  while (t < end) {
+    t = std::min(t + step, end);
+    tbl.expire(origin + t);
+  }
+}
+
+
+// Installs a flow for the i-th key.
+void
+install(Table& tbl, uint64_t i, uint32_t idle, uint32_t hard)
+{
+  Flow f;
+  f.time_ = Flow_timeouts(idle, hard);
+  f.egress_ = i + 1;
+  tbl.install(make_key(i, key_width), f);
+}
+
+
+// Records a packet matching the flow for the i-th key at the time
+// t, relative to the origin.
+void
+hit(Table& tbl, uint64_t i, uint64_t t)
+{
+  tbl.search(make_key(i, key_width))->count_.hit(64, origin + t);
+}
+
+
+bool
+live(Table& tbl, uint64_t i)
+{
+  return tbl.search(make_key(i, key_width)) != &tbl.miss_;
+}
+
+
+// Returns the number of flows whose presence differs from the
+// expected one. Each check is made halfway between ticks of a
+// second, clear of the timer resolution.
+int
+check_timeouts()
+{
+  unique_ptr<Hash_table> tbl(new Hash_table(1, 16, key_width));
+  uint64_t t = 0;
+  tbl->expire(origin);
+
+  install(*tbl, 0, 2, 0);     // Idle, never matched
+  install(*tbl, 1, 2, 0);     // Idle, matched at 1.5 s
+  install(*tbl, 2, 100, 0);   // Idle past level 1, matched at 90 s
+  install(*tbl, 3, 0, 100);   // Hard, matched at 50 s and 90 s
+  install(*tbl, 4, 30, 70);   // Both, matched every 20 s
+  install(*tbl, 5, 0, 0);     // Never expires
+  install(*tbl, 6, 1000, 0);  // Idle, never matched
+  install(*tbl, 7, 2, 0);     // Replaced at 1 s
+
+  int errors = 0;
+  advance(*tbl, t, sec);
+  install(*tbl, 7, 10, 0);
+  advance(*tbl, t, 1500 * ms);
+  errors += !live(*tbl, 0);
+  hit(*tbl, 1, t);
+  advance(*tbl, t, 2500 * ms);
+  errors += live(*tbl, 0);
+  errors += !live(*tbl, 1);
+  errors += !live(*tbl, 7);
+  advance(*tbl, t, 3600 * ms);
+  errors += live(*tbl, 1);
+  errors += !live(*tbl, 7);
+  advance(*tbl, t, 10500 * ms);
+  errors += !live(*tbl, 7);
+  advance(*tbl, t, 11500 * ms);
+  errors += live(*tbl, 7);
+
+  for (uint64_t s = 20; s <= 60; s += 20) {
+    advance(*tbl, t, s * sec);
+    hit(*tbl, 4, t);
+    if (s == 50)
+      hit(*tbl, 3, t);
+  }
+  advance(*tbl, t, 69500 * ms);
+  errors += !live(*tbl, 4);
+  advance(*tbl, t, 70500 * ms);
+  errors += live(*tbl, 4);
+
+  advance(*tbl, t, 90 * sec);
+  hit(*tbl, 2, t);
+  hit(*tbl, 3, t);
+  advance(*tbl, t, 99500 * ms);
+  errors += !live(*tbl, 2);
+  errors += !live(*tbl, 3);
+  advance(*tbl, t, 100500 * ms);
+  errors += !live(*tbl, 2);
+  errors += live(*tbl, 3);
+  advance(*tbl, t, 189500 * ms);
+  errors += !live(*tbl, 2);
+  advance(*tbl, t, 190500 * ms);
+  errors += live(*tbl, 2);
+
+  advance(*tbl, t, 999500 * ms);
+  errors += !live(*tbl, 6);
+  advance(*tbl, t, 1000500 * ms);
+  errors += live(*tbl, 6);
+
+  errors += !live(*tbl, 5);
+  errors += tbl->size() != 1;
+
+  // The first flow with a timeout in a table that already keeps
+  // time expires on the first expiry past its deadline.
+  unique_ptr<Hash_table> late(new Hash_table(1, 16, key_width));
+  late->expire(origin);
+  install(*late, 0, 1, 0);
+  late->expire(origin + 2 * sec);
+  errors += live(*late, 0);
+  return errors;
+}
+
+
+// Returns the idle timeout of the i-th flow, in seconds.
+inline uint32_t
+idle_timeout(uint64_t i)
+{
+  return 1 + mix(i) % 300;
+}
+
+
+// Returns the number of flows that should be live at the time t,
+// when flows whose index is a multiple of 4 matched at 10 s.
+uint64_t
+expected(uint64_t nflows, uint64_t t)
+{
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < nflows; ++i) {
+    uint64_t d = idle_timeout(i) * sec;
+    if (i % 4 == 0 && d > 10 * sec)
+      d += 10 * sec;
+    n += d > t;
+  }
+  return n;
+}
+
+
+void
+run(uint64_t nflows)
+{
+  unique_ptr<Hash_table> tbl(new Hash_table(1, nflows, key_width));
+  uint64_t t = 0;
+  tbl->expire(origin);
+
+  steady_clock::time_point start = steady_clock::now();
+  for (uint64_t i = 0; i < nflows; ++i)
+    install(*tbl, i, idle_timeout(i), 0);
+  steady_clock::time_point end = steady_clock::now();
+  double install_ns = duration_cast<nanoseconds>(end - start).count() / (double)nflows;
+  size_t bytes = tbl->memory().bytes;
+
+  int errors = 0;
+  start = steady_clock::now();
+  advance(*tbl, t, 10 * sec);
+  end = steady_clock::now();
+  for (uint64_t i = 0; i < nflows; i += 4)
+    if (live(*tbl, i))
+      hit(*tbl, i, t);
+  steady_clock::time_point resume = steady_clock::now();
+  advance(*tbl, t, 150500 * ms);
+  steady_clock::time_point pause = steady_clock::now();
+  errors += tbl->size() != expected(nflows, t);
+  steady_clock::time_point restart = steady_clock::now();
+  advance(*tbl, t, 320 * sec);
+  steady_clock::time_point stop = steady_clock::now();
+  errors += tbl->size() != 0;
+
+  double expire_ms = duration_cast<milliseconds>((end - start) + (pause - resume) + (stop - restart)).count();
+  cout << "Hash_table\t" << nflows
+       << "\tinstall " << install_ns << "ns"
+       << "\texpire " << expire_ms << "ms"
+       << "\tper flow " << expire_ms * 1e6 / nflows << "ns"
+       << "\tmemory " << bytes / nflows << "B/flow"
+       << "\terrors " << errors << '\n';
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t nflows = 1 << 20;
+  if (argc > 1)
+    nflows = stoull(argv[1]);
+
+  cout << "timeouts\terrors " << check_timeouts() << '\n';
+  run(nflows);
+}
@@ -0,0 +1,200 @@
+#ifndef FP_TIMER_WHEEL_HPP
+#define FP_TIMER_WHEEL_HPP
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace fp
+{
+
+// A hierarchical timing wheel.
+//
+// Time is divided into ticks. The wheel has several levels of 256
+// slots each; level i holds the timers that expire within the
+// current block of 256^(i+1) ticks, hashed by their i-th digit.
+// Advancing the wheel into a new block of a level cascades that
+// level's slot for the block into the levels below, and each tick
+// fires the level 0 slot for that tick. Scheduling a timer and
+// firing it are O(1), and each timer is cascaded at most once per
+// level, so the cost of expiry does not depend on the number of
+// pending timers.
+//
+// Each timer carries a fixed-size payload that is passed to the
+// expiry callback. Timers cannot be cancelled; the callback is
+// expected to discard timers that are no longer wanted.
+//
+// Timers further in the future than the wheel can represent fire
+// at the end of the wheel's range, and should be rescheduled by
+// the callback.
+class Timer_wheel
+{
+public:
+  static constexpr int levels = 4;
+  static constexpr int bits = 8;
+  static constexpr int slots = 1 << bits;
+
+  // Creates a wheel whose timers carry n bytes of payload. Times
+  // are given in nanoseconds and rounded down to whole ticks.
+  Timer_wheel(int n, std::uint64_t tick);
+
+  void schedule(std::uint64_t, Byte const*);
+
+  template<typename F>
+  void advance(std::uint64_t, F);
+
+  // Returns the number of pending timers.
+  std::size_t size() const { return size_; }
+
+  // Returns the number of bytes held by the wheel's slots.
+  std::size_t bytes() const;
+
+  // Returns true if the wheel has been advanced at least once.
+  bool started() const { return started_; }
+
+private:
+  void place(std::uint64_t, Byte const*);
+  void start(std::uint64_t);
+
+  int           payload_; // Payload size in bytes
+  int           stride_;  // Bytes per timer: deadline and payload
+  std::uint64_t tick_;    // Tick length in nanoseconds
+  std::uint64_t now_;     // The last tick fired
+  bool          started_;
+  std::size_t   size_;
+
+  // Timers are packed into a byte buffer for each slot.
+  std::vector<Byte> wheel_[levels][slots];
+};
+
+
+inline
+Timer_wheel::Timer_wheel(int n, std::uint64_t tick)
+  : payload_(n), stride_(sizeof(std::uint64_t) + n), tick_(tick),
+    now_(0), started_(false), size_(0)
+{ }
+
+
+// Schedules a timer with the given payload to expire at the given
+// time. A timer that is already due fires on the next tick.
+inline void
+Timer_wheel::schedule(std::uint64_t when, Byte const* p)
+{
+  std::uint64_t t = std::max(when / tick_, now_ + 1);
+
+  // Clamp the deadline to the range of the wheel.
+  std::uint64_t range = (std::uint64_t(1) << (bits * levels)) - 1;
+  if ((t ^ now_) > range)
+    t = std::max(now_ | range, now_ + 1);
+
+  place(t, p);
+  ++size_;
+}
+
+
+// Stores a timer expiring at tick t in the lowest level whose
+// block contains both t and the current tick.
+inline void
+Timer_wheel::place(std::uint64_t t, Byte const* p)
+{
+  int i = 0;
+  while (i < levels - 1 && ((t ^ now_) >> (bits * (i + 1))))
+    ++i;
+  std::vector<Byte>& s = wheel_[i][(t >> (bits * i)) & (slots - 1)];
+  std::size_t n = s.size();
+  s.resize(n + stride_);
+  std::memcpy(&s[n], &t, sizeof(t));
+  std::memcpy(&s[n + sizeof(t)], p, payload_);
+}
+
+
+// Sets the current time. Timers scheduled before the wheel was
+// started are due at unknown ticks, so they fire on the next tick.
+inline void
+Timer_wheel::start(std::uint64_t t)
+{
+  std::vector<Byte> pending;
+  for (auto& level : wheel_) {
+    for (auto& s : level) {
+      pending.insert(pending.end(), s.begin(), s.end());
+      s.clear();
+    }
+  }
+  now_ = t;
+  started_ = true;
+  for (std::size_t i = 0; i < pending.size(); i += stride_)
+    place(now_ + 1, &pending[i + sizeof(std::uint64_t)]);
+}
+
+
+inline std::size_t
+Timer_wheel::bytes() const
+{
+  std::size_t n = 0;
+  for (auto const& level : wheel_) {
+    for (auto const& s : level)
+      n += s.capacity();
+  }
+  return n;
+}
+
+
+// Advances the wheel to the given time, calling f with the payload
+// of each timer that expires. The callback may schedule timers.
+template<typename F>
+void
+Timer_wheel::advance(std::uint64_t when, F f)
+{
+  std::uint64_t t = when / tick_;
+  if (!started_) {
+    start(t);
+    return;
+  }
+
+  std::vector<Byte> due;
+  while (now_ < t) {
+    // Skip ahead when nothing is pending.
+    if (!size_) {
+      now_ = t;
+      break;
+    }
+    ++now_;
+
+    // Cascade the slots of the blocks that begin at this tick,
+    // highest level first so that timers can move down several
+    // levels at once.
+    int top = 0;
+    while (top < levels - 1 && !(now_ & ((std::uint64_t(1) << (bits * (top + 1))) - 1)))
+      ++top;
+    for (int i = top; i > 0; --i) {
+      std::vector<Byte>& s = wheel_[i][(now_ >> (bits * i)) & (slots - 1)];
+      due.swap(s);
+      for (std::size_t j = 0; j < due.size(); j += stride_) {
+        std::uint64_t d;
+        std::memcpy(&d, &due[j], sizeof(d));
+        place(d, &due[j + sizeof(d)]);
+      }
+      due.clear();
+    }
+
+    // Fire the timers due at this tick.
+    std::vector<Byte>& s = wheel_[0][now_ & (slots - 1)];
+    if (s.empty())
+      continue;
+    due.swap(s);
+    size_ -= due.size() / stride_;
+    for (std::size_t j = 0; j < due.size(); j += stride_)
+      f(&due[j + sizeof(std::uint64_t)]);
+    due.clear();
+  }
+}
+
+
+} // namespace fp
+
+
+#endif
@@ -0,0 +1,237 @@
+#include "wildcard_table.hpp"
+
+#include <algorithm>
+
+
+namespace fp
+{
+
+Wildcard_table::Wildcard_table(int id, int size, int k)
+  : Classifier(id, k), words_((k + 7) / 8), size_(0)
+{ }
+
+
+// Returns a mask that matches every bit of the key.
+Key
+Classifier::all_ones() const
+{
+  Byte buf[fp::key_size];
+  std::fill(buf, buf + key_size_, 0xff);
+  return Key(buf, key_size_);
+}
+
+
+// Adds a flow matching all bits of k.
+void
+Classifier::install(Key const& k, Flow f)
+{
+  install(k, all_ones(), f);
+}
+
+
+// Adds a flow matching the bits of k selected by the mask m. If
+// the flow has timeouts, a timer is scheduled for its expiry.
+void
+Classifier::install(Key const& k, Key const& m, Flow f)
+{
+  if (!f.time_.expires()) {
+    add(k, m, f);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(timer_mutex_);
+  f.time_.created = now_.load(std::memory_order_relaxed);
+  f.time_.timer = ++last_timer_;
+  add(k, m, f);
+  schedule(k, m, f);
+}
+
+
+// Returns the tuple for the mask m, or nullptr if there is none.
+Wildcard_table::Tuple*
+Wildcard_table::find_tuple(Key const& m)
+{
+  Key_equal eq(key_size_);
+  for (auto& t : tuples_) {
+    if (eq(t->mask, m))
+      return t.get();
+  }
+  return nullptr;
+}
+
+
+// Recompute the maximum priority of the tuple t.
+void
+Wildcard_table::update_priority(Tuple& t)
+{
+  std::size_t pri = 0;
+  t.flows.for_each([&pri](Key const&, Flow const& f) {
+    pri = std::max<std::size_t>(pri, f.pri_);
+  });
+  t.max_pri = pri;
+}
+
+
+// Moves the tuple t to its place in the order of decreasing
+// maximum priority, after its maximum priority has changed. The
+// other tuples must be in order.
+void
+Wildcard_table::place_tuple(Tuple* t)
+{
+  using Ptr = std::unique_ptr<Tuple>;
+  auto pos = std::find_if(tuples_.begin(), tuples_.end(),
+                          [t](Ptr const& p) { return p.get() == t; });
+  std::size_t pri = t->max_pri;
+
+  // Move it ahead of the tuples with a lower priority, or else
+  // behind those with a higher priority.
+  auto first = std::upper_bound(tuples_.begin(), pos, pri,
+                                [](std::size_t p, Ptr const& u) { return p > u->max_pri; });
+  if (first != pos) {
+    std::rotate(first, pos, pos + 1);
+    return;
+  }
+  auto last = std::lower_bound(pos + 1, tuples_.end(), pri,
+                               [](Ptr const& u, std::size_t p) { return u->max_pri > p; });
+  std::rotate(pos, pos + 1, last);
+}
+
+
+// Adds a flow matching all bits of k.
+void
+Wildcard_table::add(Key const& k, Flow const& f)
+{
+  add(k, all_ones(), f);
+}
+
+
+// Adds a flow matching the bits of k selected by the mask m.
+void
+Wildcard_table::add(Key const& k, Key const& m, Flow const& f)
+{
+  Key mask = apply(m, all_ones());
+  Tuple* t = find_tuple(mask);
+  bool added = !t;
+  if (added) {
+    tuples_.emplace_back(new Tuple(mask, key_size_));
+    t = tuples_.back().get();
+  }
+  std::size_t max = t->max_pri;
+
+  auto ins = t->flows.insert(apply(k, mask), f);
+  if (ins.second) {
+    ++size_;
+    t->max_pri = std::max<std::size_t>(t->max_pri, f.pri_);
+  } else {
+    // The replaced flow may have held the maximum priority.
+    std::size_t old = ins.first->pri_;
+    *ins.first = f;
+    if (f.pri_ >= t->max_pri)
+      t->max_pri = f.pri_;
+    else if (old == t->max_pri)
+      update_priority(*t);
+  }
+  if (added || t->max_pri != max)
+    place_tuple(t);
+  ++version_;
+}
+
+
+// Removes the flow matching all bits of k.
+void
+Wildcard_table::rmv(Key const& k)
+{
+  rmv(k, all_ones());
+}
+
+
+// Removes the flow with the value k under the mask m. If no such
+// flow exists, no action is taken.
+void
+Wildcard_table::rmv(Key const& k, Key const& m)
+{
+  Key mask = apply(m, all_ones());
+  Key value = apply(k, mask);
+  Tuple* t = find_tuple(mask);
+  Flow const* f = t ? t->flows.find(value) : nullptr;
+  if (!f)
+    return;
+  std::size_t pri = f->pri_;
+  t->flows.erase(value);
+  --size_;
+  ++version_;
+
+  // Drop the tuple when it becomes empty. Otherwise, recompute
+  // its maximum priority if the removed flow held it.
+  if (t->flows.empty()) {
+    tuples_.erase(std::find_if(tuples_.begin(), tuples_.end(),
+      [t](std::unique_ptr<Tuple> const& p) { return p.get() == t; }));
+  } else if (pri == t->max_pri) {
+    update_priority(*t);
+    if (t->max_pri != pri)
+      place_tuple(t);
+  }
+}
+
+
+// Returns the flow with the value k under the mask m and the given
+// priority, or nullptr if there is no such flow.
+Flow*
+Wildcard_table::find_flow(Key const& k, Key const& m, std::size_t pri)
+{
+  Key mask = apply(m, all_ones());
+  Tuple* t = find_tuple(mask);
+  Flow* f = t ? t->flows.find(apply(k, mask)) : nullptr;
+  return f && f->pri_ == pri ? f : nullptr;
+}
+
+
+// Removes the flow with the value k under the mask m and the given
+// priority, if any.
+void
+Wildcard_table::rmv_flow(Key const& k, Key const& m, std::size_t pri)
+{
+  if (find_flow(k, m, pri))
+    rmv(k, m);
+}
+
+
+// Appends a record for each flow.
+void
+Wildcard_table::dump(std::vector<Flow_record>& v) const
+{
+  for (auto const& t : tuples_) {
+    t->flows.for_each([&](Key const& k, Flow const& f) {
+      v.push_back({k, t->mask, f.pri_, f.cookie_, f.count_.read()});
+    });
+  }
+}
+
+
+// Returns the memory used by the tuples and their flows.
+Table_memory
+Wildcard_table::memory() const
+{
+  Table_memory m = Table::memory();
+  m.flows += size_;
+  m.bytes += tuples_.capacity() * sizeof(tuples_[0]);
+  for (auto const& t : tuples_) {
+    m.bytes += sizeof(Tuple) + t->flows.bytes();
+    t->flows.for_each([&](Key const&, Flow const& f) {
+      m.bytes += f.count_.bytes();
+    });
+  }
+  return m;
+}
+
+
+// Resets the miss case to default.
+void
+Wildcard_table::rmv_miss()
+{
+  miss_ = Flow();
+  ++version_;
+}
+
+
+} // namespace fp
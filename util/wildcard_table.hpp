@@ -0,0 +1,154 @@
+#ifndef FP_WILDCARD_TABLE_HPP
+#define FP_WILDCARD_TABLE_HPP
+
+#include "table.hpp"
+
+#include <memory>
+#include <vector>
+
+
+namespace fp
+{
+
+// Statistics on the cost of classifying packets. A probe is a
+// single hash table lookup.
+struct Classifier_stats
+{
+  std::uint64_t lookups = 0;
+  std::uint64_t probes = 0;
+
+  double probes_per_lookup() const { return lookups ? (double)probes / lookups : 0; }
+};
+
+
+// The interface of wildcard (ternary) match tables.
+//
+// Each flow matches a value under a mask: a key k matches when
+// (k & mask) == value. When several flows match, the one with the
+// highest priority wins. A flow with timeouts is identified for
+// expiry by its value, mask and priority (see find_flow).
+struct Classifier : Table
+{
+  Classifier(int id, int k)
+    : Table(Table::WILDCARD, id, k)
+  { }
+
+  using Table::add;
+  using Table::rmv;
+  using Table::find_flow;
+  using Table::rmv_flow;
+
+  virtual void add(Key const&, Key const&, Flow const&) = 0;
+  virtual void rmv(Key const&, Key const&) = 0;
+
+  void install(Key const&, Flow);
+  void install(Key const&, Key const&, Flow);
+
+  Key all_ones() const;
+
+  Classifier_stats const& stats() const { return stats_; }
+
+  Classifier_stats stats_;
+};
+
+
+// A wildcard match table implemented with tuple space search.
+// Flows with the same mask share a tuple, which is an exact match
+// table over masked keys. A lookup masks the key and probes each
+// tuple in turn. Tuples are ordered by the highest priority of their flows,
+// so the search terminates as soon as no remaining tuple can hold
+// a flow that beats the best match so far.
+//
+// Adding a flow whose value and mask are already in the table
+// replaces that flow, regardless of priority.
+struct Wildcard_table : Classifier
+{
+  using Map = Open_table<Key, Flow, Key_hash, Key_equal>;
+
+  // The flows sharing a mask.
+  struct Tuple
+  {
+    Tuple(Key const& m, int k)
+      : mask(m), max_pri(0), flows(0, Key_hash(k), Key_equal(k))
+    { }
+
+    Key         mask;
+    std::size_t max_pri; // The highest priority in the tuple
+    Map         flows;   // Flows, indexed by masked value
+  };
+
+  Wildcard_table(int id, int size, int k);
+
+  Flow* search(Key const&);
+
+  void add(Key const&, Flow const&);
+  void add(Key const&, Key const&, Flow const&);
+  void rmv(Key const&);
+  void rmv(Key const&, Key const&);
+  void rmv_miss();
+
+  using Classifier::find_flow;
+  using Classifier::rmv_flow;
+  Flow* find_flow(Key const&, Key const&, std::size_t);
+  void  rmv_flow(Key const&, Key const&, std::size_t);
+
+  void dump(std::vector<Flow_record>&) const;
+
+  Table_memory memory() const;
+
+  // Returns the number of flows in the table.
+  std::size_t size() const { return size_; }
+
+  // Returns the number of distinct masks.
+  std::size_t tuples() const { return tuples_.size(); }
+
+private:
+  Key   apply(Key const&, Key const&) const;
+  Tuple* find_tuple(Key const&);
+  void  update_priority(Tuple&);
+  void  place_tuple(Tuple*);
+
+  int words_; // Key width in 64-bit words
+  std::size_t size_;
+  std::vector<std::unique_ptr<Tuple>> tuples_;
+};
+
+
+// Returns the key k under the mask m. Only the words spanned by
+// the key width are examined; the rest of the key is zero.
+inline Key
+Wildcard_table::apply(Key const& k, Key const& m) const
+{
+  Key r(nullptr, 0);
+  for (int i = 0; i < words_; ++i) {
+    std::uint64_t w = load_word(k.data + 8 * i) & load_word(m.data + 8 * i);
+    std::memcpy(r.data + 8 * i, &w, sizeof(w));
+  }
+  return r;
+}
+
+
+// Returns the highest priority flow matching k, or the table-miss
+// flow if no flow matches.
+inline Flow*
+Wildcard_table::search(Key const& k)
+{
+  ++stats_.lookups;
+  Flow* best = nullptr;
+  for (auto const& t : tuples_) {
+    if (best && best->pri_ >= t->max_pri)
+      break;
+    ++stats_.probes;
+    if (Flow* f = t->flows.find(apply(k, t->mask))) {
+      if (!best || f->pri_ > best->pri_)
+        best = f;
+    }
+  }
+  return best ? best : &miss_;
+}
+
+
+} // namespace fp
+
+
+#endif